@@ -0,0 +1,462 @@
+/////////////////////////////////////////////////////////////////
+// bzkTraceConv.cpp
+//
+// Converts packed binary BZK trace files (*.bzk, written by the
+//  Trace Logger with "Write packed binary records" checked) into
+//  the pipe delimited z%05d.log text the BZK 6502 Disassembler
+//  reads. The text is identical to what the Trace Logger writes
+//  in text mode.
+//  Compressed captures (*.bzk.gz) are read directly, folded loops
+//  (BZK_TRACE_REPEAT records) are expanded back to every iteration.
+//  With -f, -n or -i it looks the frame, NMI handler or instruction
+//  up in the trace index (ztrace.idx) and only reads from there.
+//
+/////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <zlib.h>
+
+#ifdef WIN32
+#include <io.h>
+#define seekFd _lseeki64
+#else
+#include <unistd.h>
+#define seekFd lseek
+#define O_BINARY 0
+#endif
+
+#include "bzktrace.h"
+#include "drivers/common/TraceFileCompressor.h"
+
+static const size_t recsPerRead = 4096;
+static char txt[recsPerRead * BZK_TRACE_TEXT_MAX_LEN];
+
+// Formats the expanded record stream, keeping the last records for BZK_TRACE_REPEAT
+class textWriter
+{
+public:
+	// The first skip records are left out, at most limit lines are written (0 for no limit)
+	textWriter(FILE *out, unsigned long long skip = 0, unsigned long long limit = 0)
+		: out(out), len(0), histPos(0), histSize(0), lines(0), skip(skip), limit(limit), error(false)
+	{
+	}
+
+	void record(const bzkTraceRecord_t &rec)
+	{
+		hist[histPos] = rec;
+		histPos = (histPos + 1) % BZK_TRACE_FOLD_MAX_PERIOD;
+		if (histSize < BZK_TRACE_FOLD_MAX_PERIOD)
+			histSize++;
+
+		if (skip > 0)
+		{
+			skip--;
+			return;
+		}
+		if (isFull())
+			return;
+
+		len += bzkTrace_FormatText(rec, txt + len);
+		lines++;
+
+		if (len > sizeof(txt) - BZK_TRACE_TEXT_MAX_LEN)
+			flush();
+	}
+
+	// Replays the loop body before the repeat record, returns false if the file doesn't have it
+	bool repeat(const bzkTraceRecord_t &rep)
+	{
+		uint32 period = rep.romAddr;
+		bzkTraceRecord_t body[BZK_TRACE_FOLD_MAX_PERIOD];
+		bzkTraceRecord_t rec;
+
+		if ((period == 0) || (period > histSize))
+			return false;
+
+		for (uint32 i = 0; i < period; i++)
+			body[i] = hist[(histPos + BZK_TRACE_FOLD_MAX_PERIOD - period + i) % BZK_TRACE_FOLD_MAX_PERIOD];
+
+		for (uint32 n = 1; n <= rep.opAddr; n++)
+		{
+			for (uint32 i = 0; i < period; i++)
+			{
+				bzkTrace_RepeatRecord(body[i], rep, n, &rec);
+				record(rec);
+			}
+		}
+		return true;
+	}
+
+	void flush()
+	{
+		if (len && (fwrite(txt, 1, len, out) != len))
+			error = true;
+		len = 0;
+	}
+
+	unsigned long long getLines() const
+	{
+		return lines;
+	}
+
+	bool isFull() const
+	{
+		return limit && (lines >= limit);
+	}
+
+	bool getError() const
+	{
+		return error;
+	}
+
+private:
+	FILE *out;
+	size_t len;
+	bzkTraceRecord_t hist[BZK_TRACE_FOLD_MAX_PERIOD];
+	uint32 histPos;
+	uint32 histSize;
+	unsigned long long lines;
+	unsigned long long skip;
+	unsigned long long limit;
+	bool error;
+};
+
+static int convertFile(const char *inPath, const char *outPath)
+{
+	gzFile in;
+	FILE *out;
+	bzkTraceHeader_t hdr;
+	static bzkTraceRecord_t recs[recsPerRead];
+	size_t n, i;
+	int ret, bytes;
+
+	// gzread passes uncompressed files through unchanged
+	in = gzopen(inPath, "rb");
+	if (in == NULL)
+	{
+		fprintf(stderr, "Error: can't open %s\n", inPath);
+		return -1;
+	}
+
+	if (gzread(in, &hdr, sizeof(hdr)) != (int)sizeof(hdr))
+		ret = -1;
+	else
+		ret = bzkTrace_CheckHeader(&hdr);
+
+	if (ret == -1)
+	{
+		fprintf(stderr, "Error: %s is not a BZK trace file\n", inPath);
+		gzclose(in);
+		return -1;
+	}
+	else if (ret == -2)
+	{
+		fprintf(stderr, "Error: %s has unsupported version %u (record size %u)\n", inPath, hdr.version, hdr.recordSize);
+		gzclose(in);
+		return -1;
+	}
+
+	if (strcmp(outPath, "-") == 0)
+		out = stdout;
+	else
+		out = fopen(outPath, "w");
+
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error: can't create %s\n", outPath);
+		gzclose(in);
+		return -1;
+	}
+
+	textWriter writer(out);
+	ret = 0;
+
+	while ((ret == 0) && ((bytes = gzread(in, recs, sizeof(recs))) > 0))
+	{
+		n = bytes / sizeof(bzkTraceRecord_t);
+		for (i = 0; i < n; i++)
+		{
+			if (!(recs[i].flags & BZK_TRACE_REPEAT))
+				writer.record(recs[i]);
+			else if (!writer.repeat(recs[i]))
+			{
+				fprintf(stderr, "Error: %s has a repeat record without a loop body\n", inPath);
+				ret = -1;
+				break;
+			}
+		}
+	}
+	writer.flush();
+
+	if (writer.getError())
+	{
+		fprintf(stderr, "Error: can't write %s\n", outPath);
+		ret = -1;
+	}
+
+	if (out != stdout)
+	{
+		fclose(out);
+		printf("%s -> %s: %llu lines\n", inPath, outPath, writer.getLines());
+	}
+	gzclose(in);
+
+	return ret;
+}
+
+// Opens a trace file for reading from the uncompressed offset on. A compressed file is entered at the
+// gzip member holding offset, so only the rest of that member has to be inflated and thrown away.
+static gzFile openAt(const std::string &path, bool compressed, uint64 offset)
+{
+	uint64 start = offset;
+	uint64 discard = 0;
+
+	if (compressed)
+	{
+		std::vector<TraceFileCompressor::FrameIndexEntry> members;
+		FILE *fp = fopen(path.c_str(), "rb");
+
+		// A file still being written has no member index yet, it is inflated from the start
+		start = 0;
+		discard = offset;
+
+		if ((fp != NULL) && TraceFileCompressor::readFrameIndex(fp, members))
+		{
+			for (size_t i = 0; (i < members.size()) && (members[i].rawOffset <= offset); i++)
+			{
+				start = members[i].fileOffset;
+				discard = offset - members[i].rawOffset;
+			}
+		}
+		if (fp != NULL)
+			fclose(fp);
+	}
+
+	int fd = open(path.c_str(), O_RDONLY | O_BINARY);
+	if (fd == -1)
+		return NULL;
+
+	gzFile in = NULL;
+	if (seekFd(fd, start, SEEK_SET) == (long long)start)
+		in = gzdopen(fd, "rb");
+	if (in == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	static char buf[1 << 16];
+	while (discard > 0)
+	{
+		unsigned n = discard < sizeof(buf) ? (unsigned)discard : (unsigned)sizeof(buf);
+
+		if (gzread(in, buf, n) != (int)n)
+		{
+			gzclose(in);
+			return NULL;
+		}
+		discard -= n;
+	}
+	return in;
+}
+
+// Writes the trace from an index entry on: the frame (kind BZK_INDEX_FRAME), the NMI handler of the frame
+// (BZK_INDEX_NMI) or, with kind 0, the instruction value. Without a line limit it stops at the next frame,
+// or for -n and -i at the next index entry, or at the end of that file.
+static int queryTrace(const std::string &dir, int kind, uint64 value, unsigned long long limit, const char *outPath)
+{
+	std::vector<bzkTraceIndexEntry_t> entries;
+	std::string idxPath = dir + BZK_TRACE_INDEX_NAME;
+	FILE *out;
+	int ret;
+
+	ret = bzkTrace_ReadIndex(idxPath.c_str(), entries);
+	if (ret == -1)
+	{
+		fprintf(stderr, "Error: %s is missing or not a trace index\n", idxPath.c_str());
+		return -1;
+	}
+	else if (ret == -2)
+	{
+		fprintf(stderr, "Error: %s has an unsupported version\n", idxPath.c_str());
+		return -1;
+	}
+
+	int idx = bzkTrace_FindIndexEntry(entries, kind, value);
+	if (idx < 0)
+	{
+		fprintf(stderr, "Error: %s has no entry for %s %llu\n", idxPath.c_str(),
+			kind == BZK_INDEX_FRAME ? "frame" : kind == BZK_INDEX_NMI ? "the NMI of frame" : "instruction", (unsigned long long)value);
+		return -1;
+	}
+
+	const bzkTraceIndexEntry_t &entry = entries[idx];
+	std::string path = dir + bzkTrace_IndexFileName(entry);
+	uint64 end = ~(uint64)0;
+
+	// Records don't follow the instruction count when only new edges were logged, start at the entry then
+	unsigned long long skip = ((kind == 0) && !(entry.flags & BZK_INDEX_EDGES)) ? value - entry.instruction : 0;
+
+	if (limit == 0)
+	{
+		for (size_t i = idx + 1; (i < entries.size()) && (entries[i].fileIdx == entry.fileIdx); i++)
+		{
+			if ((entries[i].offset > entry.offset) && ((kind != BZK_INDEX_FRAME) || (entries[i].kind == BZK_INDEX_FRAME)))
+			{
+				end = entries[i].offset;
+				break;
+			}
+		}
+	}
+
+	gzFile in = openAt(path, (entry.flags & BZK_INDEX_COMPRESSED) != 0, entry.offset);
+	if (in == NULL)
+	{
+		fprintf(stderr, "Error: can't read %s at offset %llu\n", path.c_str(), (unsigned long long)entry.offset);
+		return -1;
+	}
+
+	if (strcmp(outPath, "-") == 0)
+		out = stdout;
+	else
+		out = fopen(outPath, "w");
+
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error: can't create %s\n", outPath);
+		gzclose(in);
+		return -1;
+	}
+
+	textWriter writer(out, skip, limit);
+	uint64 pos = entry.offset;
+	ret = 0;
+
+	if (entry.flags & BZK_INDEX_BINARY)
+	{
+		bzkTraceRecord_t rec;
+
+		while ((ret == 0) && (pos < end) && !writer.isFull() && (gzread(in, &rec, sizeof(rec)) == (int)sizeof(rec)))
+		{
+			pos += sizeof(rec);
+
+			if (!(rec.flags & BZK_TRACE_REPEAT))
+				writer.record(rec);
+			else if (!writer.repeat(rec))
+			{
+				fprintf(stderr, "Error: %s has a repeat record without a loop body\n", path.c_str());
+				ret = -1;
+			}
+		}
+		writer.flush();
+	}
+	else
+	{
+		char line[BZK_TRACE_TEXT_MAX_LEN + 1];
+		unsigned long long lines = 0;
+
+		while ((pos < end) && (!limit || (lines < limit)) && (gzgets(in, line, sizeof(line)) != NULL))
+		{
+			pos += strlen(line);
+
+			if (skip > 0)
+			{
+				skip--;
+				continue;
+			}
+			fputs(line, out);
+			lines++;
+		}
+	}
+
+	if (writer.getError() || ferror(out))
+	{
+		fprintf(stderr, "Error: can't write %s\n", outPath);
+		ret = -1;
+	}
+
+	if (out != stdout)
+		fclose(out);
+	gzclose(in);
+
+	return ret;
+}
+
+static std::string defaultOutPath(const char *inPath)
+{
+	std::string path(inPath);
+
+	if ((path.size() > 3) && (path.compare(path.size() - 3, 3, ".gz") == 0))
+		path.erase(path.size() - 3);
+
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+
+	if ((dot != std::string::npos) && ((slash == std::string::npos) || (dot > slash)))
+		path.erase(dot);
+
+	return path + ".log";
+}
+
+int main(int argc, char *argv[])
+{
+	int i, errors = 0;
+
+	if (argc < 2)
+	{
+		printf("Usage: bzkTraceConv <in.bzk|in.bzk.gz> [-o <out.log>|-o -]\n");
+		printf("       bzkTraceConv <z00000_fceux.bzk> <z00001_fceux.bzk> ...\n");
+		printf("       bzkTraceConv -f <frame>|-n <frame>|-i <instruction> [-d <dir>] [-l <lines>] [-o <out.log>]\n");
+		printf("Without -o every input is written next to itself with a .log extension.\n");
+		printf("-f, -n and -i write the frame, the NMI handler of the frame or the trace from the instruction on\n");
+		printf("to stdout (or -o), looked up in the ztrace.idx of dir. -l limits the lines.\n");
+		return 1;
+	}
+
+	if ((strcmp(argv[1], "-f") == 0) || (strcmp(argv[1], "-n") == 0) || (strcmp(argv[1], "-i") == 0))
+	{
+		int kind = argv[1][1] == 'f' ? BZK_INDEX_FRAME : argv[1][1] == 'n' ? BZK_INDEX_NMI : 0;
+		uint64 value = (argc > 2) ? strtoull(argv[2], NULL, 10) : 0;
+		unsigned long long limit = 0;
+		std::string dir;
+		const char *outPath = "-";
+
+		for (i = 3; i + 1 < argc; i += 2)
+		{
+			if (strcmp(argv[i], "-d") == 0)
+			{
+				dir = argv[i + 1];
+				if (!dir.empty() && (dir[dir.size() - 1] != '/') && (dir[dir.size() - 1] != '\\'))
+					dir += "/";
+			}
+			else if (strcmp(argv[i], "-l") == 0)
+				limit = strtoull(argv[i + 1], NULL, 10);
+			else if (strcmp(argv[i], "-o") == 0)
+				outPath = argv[i + 1];
+			else
+				break;
+		}
+		if ((argc < 3) || (i != argc))
+		{
+			fprintf(stderr, "Error: bad arguments, run without any for the usage\n");
+			return 1;
+		}
+		return queryTrace(dir, kind, value, limit, outPath) ? 1 : 0;
+	}
+
+	if ((argc == 4) && (strcmp(argv[2], "-o") == 0))
+		return convertFile(argv[1], argv[3]) ? 1 : 0;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (convertFile(argv[i], defaultOutPath(argv[i]).c_str()))
+			errors++;
+	}
+
+	return errors ? 1 : 0;
+}
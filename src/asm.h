@@ -1,3 +1,4 @@
 int Assemble(unsigned char *output, int addr, char *str);
 char *Disassemble(int addr, uint8 *opcode);
 char *bzk_Disassemble(int addr, uint8 *opcode);
+int bzk_GetOperandAddress(int addr, uint8 *opcode);
@@ -0,0 +1,467 @@
+/* FCE Ultra - NES/Famicom Emulator
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/// \file
+/// \brief BZK trace record encoding, shared by the trace loggers and the offline converter.
+/// Must not depend on emulator state, bzkTraceConv links this file on its own.
+
+#include <string.h>
+
+#include "bzktrace.h"
+#include "utils/StringBuilder.h"
+
+static_assert(sizeof(bzkTraceRecord_t) == 24, "bzkTraceRecord_t layout is part of the file format");
+static_assert(sizeof(bzkTraceHeader_t) == 16, "bzkTraceHeader_t layout is part of the file format");
+
+int bzkTrace_FormatText(const bzkTraceRecord_t &rec, char *txt)
+{
+	StringBuilder sb(txt);
+
+	sb << sb_dec(rec.prevAddr) << '|'
+	   << sb_dec(rec.romAddr) << '|'
+	   << sb_dec(rec.bank) << '|'
+	   << sb_dec(rec.A) << '|'
+	   << sb_dec(rec.X) << '|'
+	   << sb_dec(rec.Y) << '|'
+	   << sb_dec(rec.P) << '|';
+
+	if (rec.flags & BZK_TRACE_OPERAND)
+		sb << sb_dec(rec.opAddr) << '|' << sb_dec(rec.opBank) << '|' << sb_dec(rec.opValue);
+	else
+		sb << '?';
+	sb << '|';
+
+	if (rec.flags & BZK_TRACE_RAMCODE)
+		sb << sb_dec(rec.ramOpcode[0]) << '|' << sb_dec(rec.ramOpcode[1]) << '|' << sb_dec(rec.ramOpcode[2]);
+	else
+		sb << '?';
+	sb << "|\n";
+
+	return (int)sb.size();
+}
+
+void bzkTrace_InitHeader(bzkTraceHeader_t *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, BZK_TRACE_MAGIC, sizeof(hdr->magic));
+	hdr->version = BZK_TRACE_VERSION;
+	hdr->byteOrder = BZK_TRACE_BYTE_ORDER;
+	hdr->recordSize = sizeof(bzkTraceRecord_t);
+}
+
+bool bzkTrace_WriteHeader(FILE *fp)
+{
+	bzkTraceHeader_t hdr;
+
+	bzkTrace_InitHeader(&hdr);
+
+	return fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+}
+
+int bzkTrace_ReadHeader(FILE *fp, bzkTraceHeader_t *hdr)
+{
+	bzkTraceHeader_t tmp;
+
+	if (hdr == NULL)
+		hdr = &tmp;
+
+	if (fread(hdr, sizeof(*hdr), 1, fp) != 1)
+		return -1;
+
+	return bzkTrace_CheckHeader(hdr);
+}
+
+int bzkTrace_CheckHeader(const bzkTraceHeader_t *hdr)
+{
+	if (memcmp(hdr->magic, BZK_TRACE_MAGIC, sizeof(hdr->magic)) != 0)
+		return -1;
+	if ((hdr->version < BZK_TRACE_MIN_VERSION) || (hdr->version > BZK_TRACE_VERSION) || (hdr->byteOrder != BZK_TRACE_BYTE_ORDER) ||
+	    (hdr->recordSize != sizeof(bzkTraceRecord_t)))
+		return -2;
+
+	return 0;
+}
+
+void bzkTrace_RepeatRecord(const bzkTraceRecord_t &body, const bzkTraceRecord_t &repeat, uint32 n, bzkTraceRecord_t *out)
+{
+	*out = body;
+	out->A = (uint8)(body.A + repeat.A * n);
+	out->X = (uint8)(body.X + repeat.X * n);
+	out->Y = (uint8)(body.Y + repeat.Y * n);
+}
+
+// Every column but A, X and Y, cheapest and most likely to differ first
+static inline bool bzkTrace_SameStep(const bzkTraceRecord_t &a, const bzkTraceRecord_t &b)
+{
+	return (a.romAddr == b.romAddr) && (a.prevAddr == b.prevAddr) && (a.P == b.P) &&
+	       (a.flags == b.flags) && (a.opAddr == b.opAddr) && (a.opValue == b.opValue) &&
+	       (a.bank == b.bank) && (a.opBank == b.opBank) &&
+	       (memcmp(a.ramOpcode, b.ramOpcode, sizeof(a.ramOpcode)) == 0);
+}
+
+bzkTraceFolder_t::bzkTraceFolder_t()
+{
+	reset();
+}
+
+void bzkTraceFolder_t::reset()
+{
+	histPos = 0;
+	histSize = 0;
+	memset(matchLen, 0, sizeof(matchLen));
+	period = 0;
+	count = 0;
+	pending = 0;
+}
+
+void bzkTraceFolder_t::push(const bzkTraceRecord_t &rec)
+{
+	hist[histPos] = rec;
+	histPos = (histPos + 1) % BZK_TRACE_FOLD_MAX_PERIOD;
+	if (histSize < BZK_TRACE_FOLD_MAX_PERIOD)
+		histSize++;
+}
+
+// Repeat record for the iterations completed so far
+int bzkTraceFolder_t::writeRepeat(bzkTraceRecord_t *out)
+{
+	if (count == 0)
+		return 0;
+
+	memset(out, 0, sizeof(*out));
+	out->flags = BZK_TRACE_REPEAT;
+	out->romAddr = period;
+	out->opAddr = count;
+	out->A = delta[0];
+	out->X = delta[1];
+	out->Y = delta[2];
+
+	count = 0;
+	return 1;
+}
+
+// Writes the repeat record and the records of the unfinished iteration
+int bzkTraceFolder_t::endLoop(bzkTraceRecord_t *out)
+{
+	int n = writeRepeat(out);
+
+	for (uint32 i = pending; i > 0; i--)
+		out[n++] = histAt(i);
+
+	period = 0;
+	pending = 0;
+	memset(matchLen, 0, sizeof(matchLen));
+
+	return n;
+}
+
+int bzkTraceFolder_t::add(const bzkTraceRecord_t &rec, bzkTraceRecord_t *out)
+{
+	int n = 0;
+
+	if (period)
+	{
+		const bzkTraceRecord_t &prev = histAt(period);
+
+		if (bzkTrace_SameStep(rec, prev) && ((uint8)(rec.A - prev.A) == delta[0]) &&
+		    ((uint8)(rec.X - prev.X) == delta[1]) && ((uint8)(rec.Y - prev.Y) == delta[2]))
+		{
+			push(rec);
+			if (++pending == period)
+			{
+				pending = 0;
+				// The repeat record refers to the expanded stream, so folding simply goes on after it
+				if (++count == 0xFFFFFFFF)
+					n = writeRepeat(out);
+			}
+			return n;
+		}
+		n = endLoop(out);
+	}
+
+	// Look for a record sequence that just repeated itself, shortest period first
+	for (uint32 p = 1; p <= histSize; p++)
+	{
+		const bzkTraceRecord_t &prev = histAt(p);
+		uint8 d[3];
+
+		if (!bzkTrace_SameStep(rec, prev))
+		{
+			matchLen[p] = 0;
+			continue;
+		}
+
+		d[0] = rec.A - prev.A;
+		d[1] = rec.X - prev.X;
+		d[2] = rec.Y - prev.Y;
+
+		if ((matchLen[p] == 0) || (memcmp(d, matchDelta[p], sizeof(d)) != 0))
+		{
+			memcpy(matchDelta[p], d, sizeof(d));
+			matchLen[p] = 0;
+		}
+
+		if (++matchLen[p] == p)
+		{
+			// This record completes the second iteration, it is still written as is
+			memset(matchLen, 0, sizeof(matchLen));
+			period = p;
+			memcpy(delta, d, sizeof(d));
+			break;
+		}
+	}
+
+	push(rec);
+	out[n++] = rec;
+
+	return n;
+}
+
+int bzkTraceFolder_t::flush(bzkTraceRecord_t *out)
+{
+	return period ? endLoop(out) : 0;
+}
+
+struct bzkEdgesHeader_t
+{
+	char   magic[8];
+	uint16 version;
+	uint16 byteOrder;
+	uint32 count;
+};
+
+static_assert(sizeof(bzkEdgesHeader_t) == 16, "bzkEdgesHeader_t layout is part of the file format");
+
+// prevAddr is at most BZK_TRACE_NO_PREV_ADDR, so no real key has all bits set
+static const uint64 bzkEdgeEmpty = ~(uint64)0;
+
+bzkTraceEdgeSet_t::bzkTraceEdgeSet_t()
+{
+	clear();
+}
+
+void bzkTraceEdgeSet_t::clear()
+{
+	bits = 16;
+	table.assign((size_t)1 << bits, bzkEdgeEmpty);
+	count = 0;
+}
+
+bool bzkTraceEdgeSet_t::insertKey(uint64 key)
+{
+	// Fibonacci hashing, the top bits of the product are well mixed
+	size_t mask = table.size() - 1;
+	size_t i = (size_t)(((key ^ (key >> 29)) * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+
+	while (table[i] != bzkEdgeEmpty)
+	{
+		if (table[i] == key)
+			return false;
+		i = (i + 1) & mask;
+	}
+
+	table[i] = key;
+	if (++count * 2 > table.size())
+		grow();
+
+	return true;
+}
+
+void bzkTraceEdgeSet_t::grow()
+{
+	std::vector<uint64> old;
+
+	old.swap(table);
+	bits++;
+	table.assign((size_t)1 << bits, bzkEdgeEmpty);
+	count = 0;
+
+	for (size_t i = 0; i < old.size(); i++)
+	{
+		if (old[i] != bzkEdgeEmpty)
+			insertKey(old[i]);
+	}
+}
+
+bool bzkTraceEdgeSet_t::insert(const bzkTraceRecord_t &rec)
+{
+	return insertKey(((uint64)rec.prevAddr << 32) | ((uint64)rec.romAddr << 3) | (rec.bank & 7));
+}
+
+bool bzkTraceEdgeSet_t::load(const char *path)
+{
+	bzkEdgesHeader_t hdr;
+	uint64 keys[1024];
+	FILE *fp = fopen(path, "rb");
+
+	if (fp == NULL)
+		return false;
+
+	if ((fread(&hdr, sizeof(hdr), 1, fp) != 1) || (memcmp(hdr.magic, BZK_EDGES_MAGIC, sizeof(hdr.magic)) != 0) ||
+	    (hdr.version != BZK_EDGES_VERSION) || (hdr.byteOrder != BZK_TRACE_BYTE_ORDER))
+	{
+		fclose(fp);
+		return false;
+	}
+
+	// Size the table up front, a saved set comes in hash order and would pile up in a smaller table
+	while ((count + hdr.count) * 2 > table.size())
+		grow();
+
+	for (uint32 left = hdr.count; left > 0; )
+	{
+		size_t n = left < 1024 ? left : 1024;
+
+		n = fread(keys, sizeof(keys[0]), n, fp);
+		if (n == 0)
+			break;
+
+		for (size_t i = 0; i < n; i++)
+			insertKey(keys[i]);
+		left -= (uint32)n;
+	}
+
+	fclose(fp);
+	return true;
+}
+
+bool bzkTraceEdgeSet_t::save(const char *path) const
+{
+	bzkEdgesHeader_t hdr;
+	FILE *fp = fopen(path, "wb");
+	bool ok;
+
+	if (fp == NULL)
+		return false;
+
+	memcpy(hdr.magic, BZK_EDGES_MAGIC, sizeof(hdr.magic));
+	hdr.version = BZK_EDGES_VERSION;
+	hdr.byteOrder = BZK_TRACE_BYTE_ORDER;
+	hdr.count = (uint32)count;
+
+	ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+	for (size_t i = 0; ok && (i < table.size()); i++)
+	{
+		if (table[i] != bzkEdgeEmpty)
+			ok = fwrite(&table[i], sizeof(table[i]), 1, fp) == 1;
+	}
+
+	return (fclose(fp) == 0) && ok;
+}
+
+static_assert(sizeof(bzkSegmentIndexHeader_t) == 32, "bzkSegmentIndexHeader_t layout is part of the file format");
+static_assert(sizeof(bzkSegmentIndexEntry_t) == 32, "bzkSegmentIndexEntry_t layout is part of the file format");
+
+void bzkTrace_InitSegmentIndexHeader(bzkSegmentIndexHeader_t *hdr, uint64 segmentSize)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, BZK_SEGMENT_INDEX_MAGIC, sizeof(hdr->magic));
+	hdr->version = BZK_SEGMENT_INDEX_VERSION;
+	hdr->byteOrder = BZK_TRACE_BYTE_ORDER;
+	hdr->entrySize = sizeof(bzkSegmentIndexEntry_t);
+	hdr->segmentSize = segmentSize;
+}
+
+int bzkTrace_CheckSegmentIndexHeader(const bzkSegmentIndexHeader_t *hdr)
+{
+	if (memcmp(hdr->magic, BZK_SEGMENT_INDEX_MAGIC, sizeof(hdr->magic)) != 0)
+		return -1;
+	if ((hdr->version != BZK_SEGMENT_INDEX_VERSION) || (hdr->byteOrder != BZK_TRACE_BYTE_ORDER) ||
+	    (hdr->entrySize != sizeof(bzkSegmentIndexEntry_t)))
+		return -2;
+
+	return 0;
+}
+
+static_assert(sizeof(bzkTraceIndexHeader_t) == 16, "bzkTraceIndexHeader_t layout is part of the file format");
+static_assert(sizeof(bzkTraceIndexEntry_t) == 32, "bzkTraceIndexEntry_t layout is part of the file format");
+
+void bzkTrace_InitIndexHeader(bzkTraceIndexHeader_t *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, BZK_TRACE_INDEX_MAGIC, sizeof(hdr->magic));
+	hdr->version = BZK_TRACE_INDEX_VERSION;
+	hdr->byteOrder = BZK_TRACE_BYTE_ORDER;
+	hdr->entrySize = sizeof(bzkTraceIndexEntry_t);
+}
+
+int bzkTrace_CheckIndexHeader(const bzkTraceIndexHeader_t *hdr)
+{
+	if (memcmp(hdr->magic, BZK_TRACE_INDEX_MAGIC, sizeof(hdr->magic)) != 0)
+		return -1;
+	if ((hdr->version != BZK_TRACE_INDEX_VERSION) || (hdr->byteOrder != BZK_TRACE_BYTE_ORDER) ||
+	    (hdr->entrySize != sizeof(bzkTraceIndexEntry_t)))
+		return -2;
+
+	return 0;
+}
+
+int bzkTrace_ReadIndex(const char *path, std::vector<bzkTraceIndexEntry_t> &entries)
+{
+	bzkTraceIndexHeader_t hdr;
+	bzkTraceIndexEntry_t entry;
+	FILE *fp;
+	int ret;
+
+	entries.clear();
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return -1;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1)
+		ret = -1;
+	else
+		ret = bzkTrace_CheckIndexHeader(&hdr);
+
+	while ((ret == 0) && (fread(&entry, sizeof(entry), 1, fp) == 1))
+		entries.push_back(entry);
+
+	fclose(fp);
+	return ret;
+}
+
+int bzkTrace_FindIndexEntry(const std::vector<bzkTraceIndexEntry_t> &entries, int kind, uint64 value)
+{
+	int found = -1;
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const bzkTraceIndexEntry_t &e = entries[i];
+
+		if (kind)
+		{
+			if ((e.kind == kind) && (e.frame == value))
+				found = (int)i;
+		}
+		else if ((e.instruction <= value) && ((found == -1) || (e.instruction >= entries[found].instruction)))
+		{
+			found = (int)i;
+		}
+	}
+	return found;
+}
+
+std::string bzkTrace_IndexFileName(const bzkTraceIndexEntry_t &entry)
+{
+	char name[64];
+
+	sprintf(name, "z%05u_fceux.%s%s", entry.fileIdx, (entry.flags & BZK_INDEX_BINARY) ? "bzk" : "log",
+		(entry.flags & BZK_INDEX_COMPRESSED) ? ".gz" : "");
+
+	return name;
+}
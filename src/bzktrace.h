@@ -0,0 +1,250 @@
+// bzktrace.h
+//
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+
+#include "types.h"
+
+// Packed binary form of the BZK disassembler trace (the "z%05d.log" pipe delimited lines).
+// A capture writes bzkTraceRecord_t structs back to back after a bzkTraceHeader_t,
+// the text is produced offline by bzkTrace_FormatText (see bzkTraceConv).
+
+#define BZK_TRACE_MAGIC        "BZKTRACE"
+#define BZK_TRACE_VERSION      2
+#define BZK_TRACE_MIN_VERSION  1 // version 1 files never contain BZK_TRACE_REPEAT records
+#define BZK_TRACE_BYTE_ORDER   0x0102
+#define BZK_TRACE_LINES_PER_FILE 4999999
+
+// initial value of the "previous ROM address" column when logging starts
+#define BZK_TRACE_NO_PREV_ADDR 0x200000
+
+// bzkTraceRecord_t::flags
+#define BZK_TRACE_OPERAND  0x01 // opAddr/opBank/opValue are valid, otherwise printed as "?"
+#define BZK_TRACE_RAMCODE  0x02 // ramOpcode[] is valid (code executed below $8000), otherwise "?"
+#define BZK_TRACE_REPEAT   0x80 // loop folding record, not an instruction (see below)
+
+// Loop folding: a BZK_TRACE_REPEAT record stands for opAddr more iterations of the loop whose
+// body is the romAddr records right before it (counting expanded records, not stored ones).
+// In iteration n (1..opAddr) every body record comes again with A, X and Y advanced by n times
+// the repeat record's A, X and Y (mod 256), all other fields unchanged. See bzkTrace_RepeatRecord.
+#define BZK_TRACE_FOLD_MAX_PERIOD 32 // longest loop body that gets folded
+#define BZK_TRACE_FOLD_MAX_OUT    (BZK_TRACE_FOLD_MAX_PERIOD + 1) // most records one bzkTraceFolder_t call returns
+
+struct bzkTraceRecord_t
+{
+	uint32 prevAddr;     // ROM address of the previous instruction
+	uint32 romAddr;      // bzk_GetNesFileAddress(PC)
+	uint32 opAddr;       // bzk_GetNesFileAddress(effective address)
+	uint8  bank;         // bzk_getBank(PC)
+	uint8  A;
+	uint8  X;
+	uint8  Y;
+	uint8  P;
+	uint8  opBank;       // bzk_getBank(effective address)
+	uint8  opValue;      // GetMem(effective address)
+	uint8  flags;
+	uint8  ramOpcode[3];
+	uint8  reserved;
+};
+
+struct bzkTraceHeader_t
+{
+	char   magic[8];
+	uint16 version;
+	uint16 byteOrder;
+	uint16 recordSize;
+	uint16 reserved;
+};
+
+// Longest possible text line, including the '\n' and terminating null
+#define BZK_TRACE_TEXT_MAX_LEN 96
+
+// Formats a record exactly like the text tracer, "\n" included. Returns the line length.
+int bzkTrace_FormatText(const bzkTraceRecord_t &rec, char *txt);
+
+void bzkTrace_InitHeader(bzkTraceHeader_t *hdr);
+bool bzkTrace_WriteHeader(FILE *fp);
+
+// Returns 0 on success, -1 if the stream isn't a BZK trace, -2 if it is an incompatible version
+int bzkTrace_ReadHeader(FILE *fp, bzkTraceHeader_t *hdr = NULL);
+
+// Same checks on a header read by other means (e.g. from a compressed stream)
+int bzkTrace_CheckHeader(const bzkTraceHeader_t *hdr);
+
+// Record of iteration n (1 based) of a folded loop, from the body record it repeats
+void bzkTrace_RepeatRecord(const bzkTraceRecord_t &body, const bzkTraceRecord_t &repeat, uint32 n, bzkTraceRecord_t *out);
+
+// Replaces the 2nd and later iterations of a loop with BZK_TRACE_REPEAT records, as long as a
+// PC sequence of up to BZK_TRACE_FOLD_MAX_PERIOD instructions repeats with all columns equal,
+// except A, X and Y which may change by the same amount every iteration (e.g. a DEX/BNE delay).
+// A wait for NMI spin loop shrinks to two iterations and one repeat record however long it runs.
+class bzkTraceFolder_t
+{
+public:
+	bzkTraceFolder_t();
+
+	// Forget everything, a new file must not refer to records of the previous one
+	void reset();
+
+	// Takes the next captured record and stores the records to write in out[BZK_TRACE_FOLD_MAX_OUT].
+	// Returns their count, 0 while a loop is being folded.
+	int add(const bzkTraceRecord_t &rec, bzkTraceRecord_t *out);
+
+	// Ends the loop being folded, if any. Call before the file is paused or closed.
+	int flush(bzkTraceRecord_t *out);
+
+private:
+	bzkTraceRecord_t hist[BZK_TRACE_FOLD_MAX_PERIOD]; // last records of the expanded stream
+	uint32 histPos;  // where the next one goes
+	uint32 histSize;
+
+	// Detection: how many records in a row equal the one p records earlier, and with which A/X/Y delta
+	uint32 matchLen[BZK_TRACE_FOLD_MAX_PERIOD + 1];
+	uint8  matchDelta[BZK_TRACE_FOLD_MAX_PERIOD + 1][3];
+
+	// Loop being folded
+	uint32 period;   // 0 if none
+	uint32 count;    // completed iterations not written yet
+	uint32 pending;  // records of the iteration in progress
+	uint8  delta[3];
+
+	const bzkTraceRecord_t &histAt(uint32 back) const
+	{
+		return hist[(histPos + BZK_TRACE_FOLD_MAX_PERIOD - back) % BZK_TRACE_FOLD_MAX_PERIOD];
+	}
+	void push(const bzkTraceRecord_t &rec);
+	int writeRepeat(bzkTraceRecord_t *out);
+	int endLoop(bzkTraceRecord_t *out);
+};
+
+// Edge coverage: the set of (prevAddr -> romAddr, bank) transitions seen so far, so a trace can
+// be limited to control flow the disassembler hasn't been shown yet. Saved per ROM next to the
+// .cdl file (<rom>.bzkedges) so coverage accumulates over sessions.
+#define BZK_EDGES_MAGIC   "BZKEDGES"
+#define BZK_EDGES_VERSION 1
+#define BZK_EDGES_EXT     ".bzkedges"
+
+class bzkTraceEdgeSet_t
+{
+public:
+	bzkTraceEdgeSet_t();
+
+	void clear();
+
+	// Returns true the first time the record's edge is seen
+	bool insert(const bzkTraceRecord_t &rec);
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	// Adds the edges of a saved set. Returns false if the file is missing or not an edge file.
+	bool load(const char *path);
+	bool save(const char *path) const;
+
+private:
+	std::vector<uint64> table; // open addressing, linear probing, kept at most half full
+	size_t count;
+	unsigned int bits;         // table.size() == 1 << bits
+
+	bool insertKey(uint64 key);
+	void grow();
+};
+
+// Memory mapped segments: instead of cutting files every BZK_TRACE_LINES_PER_FILE lines, the trace
+// is written into z%05d_fceux.* files preallocated to a fixed size (see TraceSegmentWriter) and
+// BZK_SEGMENT_INDEX_NAME in the same folder lists them. The index is a bzkSegmentIndexHeader_t
+// followed by count bzkSegmentIndexEntry_t, appended to by every logging session.
+#define BZK_SEGMENT_INDEX_MAGIC   "BZKSEGIX"
+#define BZK_SEGMENT_INDEX_VERSION 1
+#define BZK_SEGMENT_INDEX_NAME    "zsegments.idx"
+
+// bzkSegmentIndexEntry_t::flags
+#define BZK_SEGMENT_OPEN   0x01 // still being written, length is refreshed while logging (left set if the session crashed)
+#define BZK_SEGMENT_BINARY 0x02 // bzkTraceRecord_t records after a bzkTraceHeader_t, otherwise text lines
+
+struct bzkSegmentIndexHeader_t
+{
+	char   magic[8];
+	uint16 version;
+	uint16 byteOrder;
+	uint16 entrySize;
+	uint16 reserved;
+	uint32 count;       // entries in the file
+	uint32 nextFile;    // file number the next segment gets
+	uint64 segmentSize; // preallocated size of a segment while it is written
+};
+
+struct bzkSegmentIndexEntry_t
+{
+	uint32 fileIdx;          // z%05d number
+	uint32 flags;
+	uint32 firstFrame;       // frame counter at the first instruction of the segment
+	uint32 reserved;
+	uint64 firstInstruction; // instructions counter at the first instruction of the segment
+	uint64 length;           // bytes of trace data, the rest of an open segment is preallocated space
+};
+
+void bzkTrace_InitSegmentIndexHeader(bzkSegmentIndexHeader_t *hdr, uint64 segmentSize);
+
+// Returns 0 on success, -1 if it isn't a segment index, -2 if it is an incompatible version
+int bzkTrace_CheckSegmentIndexHeader(const bzkSegmentIndexHeader_t *hdr);
+
+// Trace index: BZK_TRACE_INDEX_NAME next to the trace files lists where every frame and every NMI handler
+// starts, so a tool can read from there instead of scanning the files (see bzkTraceConv -f/-n/-i).
+// The index is a bzkTraceIndexHeader_t followed by bzkTraceIndexEntry_t, appended to by every logging
+// session in the order things happened, a frame number can come again after a savestate was loaded.
+// The loop folder is flushed and reset at every entry, so a folded file can be expanded from there on.
+#define BZK_TRACE_INDEX_MAGIC   "BZKTRIDX"
+#define BZK_TRACE_INDEX_VERSION 1
+#define BZK_TRACE_INDEX_NAME    "ztrace.idx"
+
+// bzkTraceIndexEntry_t::kind
+#define BZK_INDEX_FRAME 1 // first instruction logged in a frame
+#define BZK_INDEX_NMI   2 // first instruction of the NMI handler, after the CPU took the NMI
+
+// bzkTraceIndexEntry_t::flags, how the session wrote its files
+#define BZK_INDEX_BINARY     0x01 // z%05d_fceux.bzk, otherwise .log
+#define BZK_INDEX_COMPRESSED 0x02 // .gz, offset is in the uncompressed stream
+#define BZK_INDEX_FOLDED     0x04 // may hold BZK_TRACE_REPEAT records
+#define BZK_INDEX_EDGES      0x08 // only new edges were logged, records don't follow instruction counts
+
+struct bzkTraceIndexHeader_t
+{
+	char   magic[8];
+	uint16 version;
+	uint16 byteOrder;
+	uint16 entrySize;
+	uint16 reserved;
+};
+
+struct bzkTraceIndexEntry_t
+{
+	uint32 fileIdx;     // z%05d number
+	uint8  kind;
+	uint8  flags;
+	uint16 reserved;
+	uint32 frame;       // frame counter at the instruction
+	uint32 reserved2;
+	uint64 instruction; // instructions counter at the instruction
+	uint64 offset;      // byte offset of its line or record in the file
+};
+
+void bzkTrace_InitIndexHeader(bzkTraceIndexHeader_t *hdr);
+
+// Returns 0 on success, -1 if it isn't a trace index, -2 if it is an incompatible version
+int bzkTrace_CheckIndexHeader(const bzkTraceIndexHeader_t *hdr);
+
+// Reads a whole index, with the same return values. An entry cut off by a running session is left out.
+int bzkTrace_ReadIndex(const char *path, std::vector<bzkTraceIndexEntry_t> &entries);
+
+// Entry to start reading at: the latest one of kind for frame value, or with kind 0 the latest one
+// with the highest instruction count not above value. Returns -1 if there is none.
+int bzkTrace_FindIndexEntry(const std::vector<bzkTraceIndexEntry_t> &entries, int kind, uint64 value);
+
+// z%05d_fceux.* name of the file an entry points into
+std::string bzkTrace_IndexFileName(const bzkTraceIndexEntry_t &entry);
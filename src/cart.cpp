@@ -45,6 +45,7 @@ uint8 *MMC5SPRVPage[8];
 uint8 *MMC5BGVPage[8];
 
 static uint8 PRGIsRAM[32];  /* This page is/is not PRG RAM. */
+uint32 PRGPageCacheValid;
 
 /* 16 are (sort of) reserved for UNIF/iNES and 16 to map other stuff. */
 uint8 CHRram[32];
@@ -82,15 +83,19 @@ static INLINE void setpageptr(int s, uint32 A, uint8 *p, int ram) {
 	uint32 AB = A >> 11;
 	int x;
 
+	PRGPageCacheValid &= ~((((uint32)1 << (s >> 1)) - 1) << AB);
+
 	if (p)
 		for (x = (s >> 1) - 1; x >= 0; x--) {
 			PRGIsRAM[AB + x] = ram;
 			Page[AB + x] = p - A;
+			UpdateReadDirectPRG(AB + x);
 		}
 	else
 		for (x = (s >> 1) - 1; x >= 0; x--) {
 			PRGIsRAM[AB + x] = 0;
 			Page[AB + x] = 0;
+			UpdateReadDirectPRG(AB + x);
 		}
 }
 
@@ -100,8 +105,10 @@ void ResetCartMapping(void) {
 
 	PPU_ResetHooks();
 
+	PRGPageCacheValid = 0;
 	for (x = 0; x < 32; x++) {
 		Page[x] = nothing - x * 2048;
+		UpdateReadDirectPRG(x);
 		PRGptr[x] = CHRptr[x] = 0;
 		PRGsize[x] = CHRsize[x] = 0;
 	}
@@ -113,6 +120,7 @@ void ResetCartMapping(void) {
 void SetupCartPRGMapping(int chip, uint8 *p, uint32 size, int ram) {
 	PRGptr[chip] = p;
 	PRGsize[chip] = size;
+	PRGPageCacheValid = 0;
 
 	PRGmask2[chip] = (size >> 11) - 1;
 	PRGmask4[chip] = (size >> 12) - 1;
@@ -88,6 +88,10 @@ void FCEU_ClearGameSave(CartInfo *LocalHWInfo);
 
 extern uint8 *Page[32], *VPage[8], *MMC5SPRVPage[8], *MMC5BGVPage[8];
 
+/* Bit per 2K page of Page[], cleared whenever that page is remapped.
+   Lets the debugger cache its CPU address -> PRG offset translation (see debug.cpp). */
+extern uint32 PRGPageCacheValid;
+
 void ResetCartMapping(void);
 void SetupCartPRGMapping(int chip, uint8 *p, uint32 size, int ram);
 void SetupCartCHRMapping(int chip, uint8 *p, uint32 size, int ram);
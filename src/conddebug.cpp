@@ -42,6 +42,7 @@
 */
 
 #include "types.h"
+#include "x6502.h"
 #include "conddebug.h"
 #include "utils/memory.h"
 
@@ -50,6 +51,8 @@
 #include <cstring>
 #include <cassert>
 #include <cctype>
+#include <vector>
+#include <algorithm>
 
 uint16 debugLastAddress = 0; // used by 'T' and 'R' conditions
 uint8 debugLastOpcode = 0; // used to evaluate 'W' condition
@@ -511,6 +514,198 @@ static Condition* Connect(const char** str)
 	return InfixOperator(str, Compare, ConnectOperators);
 }
 
+/*
+* Compiler from the condition tree to a CondInstr program.
+* The program computes the same value as the tree walker in debug.cpp, but constant
+* operands are folded and || and && skip their right side when the left one decides.
+* That is safe because nothing a condition reads has side effects.
+*/
+
+typedef std::vector<CondInstr> CondCode;
+
+static void emit(CondCode& code, unsigned char op, int value = 0, unsigned char arg = 0)
+{
+	CondInstr instr;
+
+	instr.op = op;
+	instr.arg = arg;
+	instr.target = 0;
+	instr.value = value;
+
+	code.push_back(instr);
+}
+
+// True if the code from start on only pushes a constant
+static bool isConstant(const CondCode& code, size_t start)
+{
+	return code.size() == start + 1 && code[start].op == CC_NUM;
+}
+
+// Pushes what getValue in debug.cpp returns for key
+static void emitGetValue(CondCode& code, unsigned int key)
+{
+	switch (key)
+	{
+		case 'A': case 'X': case 'Y': case 'P': case 'S': emit(code, CC_REG, 0, key); break;
+		case 'N': emit(code, CC_FLAG, 0, N_FLAG); break;
+		case 'V': emit(code, CC_FLAG, 0, V_FLAG); break;
+		case 'U': emit(code, CC_FLAG, 0, U_FLAG); break;
+		case 'B': emit(code, CC_FLAG, 0, B_FLAG); break;
+		case 'D': emit(code, CC_FLAG, 0, D_FLAG); break;
+		case 'I': emit(code, CC_FLAG, 0, I_FLAG); break;
+		case 'Z': emit(code, CC_FLAG, 0, Z_FLAG); break;
+		case 'C': emit(code, CC_FLAG, 0, C_FLAG); break;
+		default: emit(code, CC_NUM, 0); break;
+	}
+}
+
+static void compileNode(CondCode& code, const Condition* c);
+
+// One operand of a node: its subtree or value, then what its type does with it
+static void compileOperand(CondCode& code, const Condition* sub, unsigned int type, unsigned int value, unsigned int key)
+{
+	size_t start = code.size();
+
+	switch (type)
+	{
+		case TYPE_PC_BANK: emit(code, CC_PC_BANK); return;
+		case TYPE_DATA_BANK: emit(code, CC_DATA_BANK); return;
+		case TYPE_VALUE_READ: emit(code, CC_VALUE_READ); return;
+		case TYPE_VALUE_WRITE: emit(code, CC_VALUE_WRITE); return;
+	}
+
+	if (sub)
+	{
+		compileNode(code, sub);
+	}
+	else if (type == TYPE_ADDR || type == TYPE_NUM)
+	{
+		emit(code, CC_NUM, value);
+	}
+	else
+	{
+		emitGetValue(code, key);
+	}
+
+	if (type == TYPE_ADDR)
+	{
+		if (isConstant(code, start))
+		{
+			code[start].op = CC_MEM_NUM;
+		}
+		else
+		{
+			emit(code, CC_MEM);
+		}
+	}
+}
+
+static void compileNode(CondCode& code, const Condition* c)
+{
+	size_t start = code.size();
+
+	compileOperand(code, c->lhs, c->type1, c->value1, c->value1);
+
+	if (!c->op)
+	{
+		return;
+	}
+
+	if (c->op == OP_AND || c->op == OP_OR)
+	{
+		size_t jump = code.size();
+
+		if (isConstant(code, start))
+		{
+			int value = code[start].value;
+
+			code.pop_back();
+
+			// The left side decides, or the result is the right side as 0 or 1
+			if ((c->op == OP_AND) == (value == 0))
+			{
+				emit(code, CC_NUM, value != 0);
+				return;
+			}
+			jump = 0;
+		}
+		else
+		{
+			emit(code, c->op == OP_AND ? CC_AND : CC_OR);
+		}
+
+		size_t rhsStart = code.size();
+		compileOperand(code, c->rhs, c->type2, c->value2, c->type2);
+
+		if (isConstant(code, rhsStart))
+		{
+			code[rhsStart].value = code[rhsStart].value != 0;
+		}
+		else
+		{
+			emit(code, CC_BOOL);
+		}
+
+		if (jump)
+		{
+			code[jump].target = (unsigned short)code.size();
+		}
+		return;
+	}
+
+	size_t rhsStart = code.size();
+	compileOperand(code, c->rhs, c->type2, c->value2, c->type2);
+
+	if (rhsStart == start + 1 && code[start].op == CC_NUM && isConstant(code, rhsStart))
+	{
+		code[start].value = conditionOperator(c->op, code[start].value, code[rhsStart].value);
+		code.pop_back();
+	}
+	else
+	{
+		emit(code, CC_BINARY, 0, c->op);
+	}
+}
+
+// Returns the program for the tree c, or nullptr if it needs more stack than CC_MAX_STACK
+static CondInstr* compileCondition(const Condition* c)
+{
+	CondCode code;
+
+	compileNode(code, c);
+	emit(code, CC_END);
+
+	if (code.size() > 0xFFFF)
+	{
+		return nullptr;
+	}
+
+	int depth = 0;
+	for (size_t i = 0; i < code.size(); i++)
+	{
+		switch (code[i].op)
+		{
+			case CC_MEM:
+			case CC_BOOL:
+			case CC_END: break;
+			case CC_BINARY:
+			case CC_AND:
+			case CC_OR: depth--; break;
+			default: depth++; break;
+		}
+
+		if (depth > CC_MAX_STACK)
+		{
+			return nullptr;
+		}
+	}
+
+	CondInstr* result = new CondInstr[code.size()];
+	std::copy(code.begin(), code.end(), result);
+
+	return result;
+}
+
 /* Root of the parser generator */
 Condition* generateCondition(const char* str)
 {
@@ -524,5 +719,8 @@ Condition* generateCondition(const char* str)
 		if (c) delete c;
 		return 0;
 	}
-	else return c;
+
+	c->code = compileCondition(c);
+
+	return c;
 }
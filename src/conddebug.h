@@ -45,6 +45,33 @@
 #define OP_OR 11
 #define OP_AND 12
 
+// Instructions of the compiled form of a condition, a postfix program run on a small stack
+#define CC_END 0
+#define CC_NUM 1        // push value
+#define CC_REG 2        // push register arg ('A', 'X', 'Y', 'P' for PC or 'S')
+#define CC_FLAG 3       // push 1 if flag bit arg is set in P, else 0
+#define CC_MEM 4        // replace the top with the memory at that address
+#define CC_MEM_NUM 5    // push the memory at address value
+#define CC_PC_BANK 6    // push the bank of PC
+#define CC_DATA_BANK 7  // push the bank of the last effective address
+#define CC_VALUE_READ 8
+#define CC_VALUE_WRITE 9
+#define CC_BINARY 10    // pop the right operand and combine it with the top, arg is an OP_ code
+#define CC_AND 11       // keep 0 and jump to target if the top is 0, else pop it
+#define CC_OR 12        // replace the top with 1 and jump to target if it isn't 0, else pop it
+#define CC_BOOL 13      // replace the top with 1 if it isn't 0
+
+// Deepest stack a compiled condition may use, deeper ones are evaluated as a tree
+#define CC_MAX_STACK 32
+
+struct CondInstr
+{
+	unsigned char op;
+	unsigned char arg;
+	unsigned short target;
+	int value;
+};
+
 extern uint16 debugLastAddress;
 extern uint8 debugLastOpcode;
 
@@ -62,16 +89,21 @@ struct Condition
 	unsigned int type2;
 	unsigned int value2;
 
+	// Compiled form of the tree, only set on the root by generateCondition
+	CondInstr* code;
+
 	Condition(void)
 	{
 		op = 0;
 		lhs = rhs = nullptr;
 		type1 = value1 = 0;
 		type2 = value2 = 0;
+		code = nullptr;
 	};
 
 	~Condition(void)
 	{
+		delete[] code;
 		if (lhs)
 		{
 			delete lhs;
@@ -83,6 +115,27 @@ struct Condition
 	}
 };
 
+// Applies a binary OP_ operator, || and && included, to two values
+inline int conditionOperator(unsigned int op, int value1, int value2)
+{
+	switch (op)
+	{
+		case OP_EQ: return value1 == value2;
+		case OP_NE: return value1 != value2;
+		case OP_GE: return value1 >= value2;
+		case OP_LE: return value1 <= value2;
+		case OP_G: return value1 > value2;
+		case OP_L: return value1 < value2;
+		case OP_MULT: return value1 * value2;
+		case OP_DIV: return (value2 == 0) ? 0 : (value1 / value2);
+		case OP_PLUS: return value1 + value2;
+		case OP_MINUS: return value1 - value2;
+		case OP_OR: return value1 || value2;
+		case OP_AND: return value1 && value2;
+	}
+	return value1;
+}
+
 Condition* generateCondition(const char* str);
 
 #endif
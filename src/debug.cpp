@@ -9,11 +9,15 @@
 #include "debugsymboltable.h"
 #include "driver.h"
 #include "ppu.h"
+#include "asm.h"
+#include "bzktrace.h"
 
 #include "x6502abbrev.h"
 
 #include <cstdlib>
 #include <cstring>
+#include <vector>
+#include <algorithm>
 
 unsigned int debuggerPageSize = 14;
 int vblankScanLines = 0;	//Used to calculate scanlines 240-261 (vblank)
@@ -250,6 +254,8 @@ unsigned int NewBreak(const char* name, int start, int end, unsigned int type, c
 		watchpoint[num].flags|=BT_R;
 	}
 
+	WatchpointsChanged();
+
 	if (watchpoint[num].desc)
 		free(watchpoint[num].desc);
 
@@ -259,6 +265,22 @@ unsigned int NewBreak(const char* name, int start, int end, unsigned int type, c
 	return checkCondition(condition, num);
 }
 
+// Offset of each 2K page of Page[] from PRGptr[0], valid while its bit in PRGPageCacheValid is set.
+// The tracers translate several addresses per instruction, this saves redoing the pointer math every time.
+static int prgPageOffset[32];
+
+static INLINE int GetPRGOffset(int A)
+{
+	int page = A >> 11;
+
+	if (!(PRGPageCacheValid & (1u << page)))
+	{
+		prgPageOffset[page] = (int)(&Page[page][page << 11] - PRGptr[0]);
+		PRGPageCacheValid |= 1u << page;
+	}
+	return prgPageOffset[page] + (A & 0x7FF);
+}
+
 int GetPRGAddress(int A){
 	int result;
 	if(A > 0xFFFF)
@@ -278,7 +300,7 @@ int GetPRGAddress(int A){
 				return result + PRGsize[1];
 		}
 	} else {
-		result = &Page[A >> 11][A] - PRGptr[0];
+		result = GetPRGOffset(A);
 		if ((result > (int)PRGsize[0]) || (result < 0))
 			return -1;
 		else
@@ -315,17 +337,17 @@ int bzk_getBank(int offs)
 int GetNesFileAddress(int A){
 	int result;
 	if((A < 0x6000) || (A > 0xFFFF))return -1;
-	result = &Page[A>>11][A]-PRGptr[0];
+	result = GetPRGOffset(A);
 	if((result > (int)(PRGsize[0])) || (result < 0))return -1;
 	else return result+NES_HEADER_SIZE; //16 bytes for the header remember
 }
 
 int bzk_GetNesFileAddress(int A){
-    if (A >= 0x8000) return &Page[A >> 11][A] - PRGptr[0]; //8000-FFFF
+    if (A >= 0x8000) return GetPRGOffset(A); //8000-FFFF
     if (A <= 0x5FFF) return A + 0x100000; //0000-5FFF
     
     //6000-7FFF
-    int result = &Page[A >> 11][A] - PRGptr[0];
+    int result = GetPRGOffset(A);
     if (result >= NES_HEADER_SIZE + CHRsize[0] + PRGsize[0]) return A + 0x100000; //SRAM
     else return result; //PRG-RAM
 }
@@ -400,6 +422,53 @@ char *bzk_GetRAMopcodes(int A, uint8 *opcode) {
     return str;
 }
 
+//same columns as bzk_GetNesFileAddress/bzk_Disassemble/bzk_GetRAMopcodes, without any text formatting
+void bzk_CaptureRecord(bzkTraceRecord_t *rec, uint32 prevAddr, const opcodeinfo *op) {
+	int A = op->PC;
+	int tmp;
+
+	rec->prevAddr = prevAddr;
+	rec->romAddr = bzk_GetNesFileAddress(A);
+	rec->bank = bzk_getBank(A);
+	rec->A = _A;
+	rec->X = _X;
+	rec->Y = _Y;
+	rec->P = _P;
+	rec->flags = 0;
+	rec->reserved = 0;
+
+	tmp = bzk_GetOperandAddress(op);
+	if (tmp >= 0)
+	{
+		rec->opAddr = bzk_GetNesFileAddress(tmp);
+		rec->opBank = bzk_getBank(tmp);
+		rec->opValue = GetMem(tmp);
+		rec->flags |= BZK_TRACE_OPERAND;
+	}
+	else
+	{
+		rec->opAddr = 0;
+		rec->opBank = 0;
+		rec->opValue = 0;
+	}
+
+	if (A < 0x8000)
+	{
+		rec->ramOpcode[0] = op->opcode[0];
+		rec->ramOpcode[1] = op->opcode[1];
+		rec->ramOpcode[2] = op->opcode[2];
+		rec->flags |= BZK_TRACE_RAMCODE;
+	}
+	else
+		rec->ramOpcode[0] = rec->ramOpcode[1] = rec->ramOpcode[2] = 0;
+}
+
+//true for the first instruction of an NMI handler entered by the CPU, where the trace index marks
+//the start of the NMI handler. A JMP or JSR to the vector address doesn't count.
+bool bzk_IsNmiEntry(void) {
+	return X6502_NmiEntered != 0;
+}
+
 uint8 GetPPUMem(uint8 A) {
 	uint16 tmp = FCEUPPU_PeekAddress() & 0x3FFF;
 
@@ -493,29 +562,62 @@ int evaluate(Condition* c)
 		case TYPE_VALUE_WRITE: value2 = evaluateWrite(debugLastOpcode, debugLastAddress); break;
 	}
 
-		switch (c->op)
-		{
-			case OP_EQ: f = value1 == value2; break;
-			case OP_NE: f = value1 != value2; break;
-			case OP_GE: f = value1 >= value2; break;
-			case OP_LE: f = value1 <= value2; break;
-			case OP_G: f = value1 > value2; break;
-			case OP_L: f = value1 < value2; break;
-			case OP_MULT: f = value1 * value2; break;
-			case OP_DIV: f = (value2==0) ? 0 : (value1 / value2); break;
-			case OP_PLUS: f = value1 + value2; break;
-			case OP_MINUS: f = value1 - value2; break;
-			case OP_OR: f = value1 || value2; break;
-			case OP_AND: f = value1 && value2; break;
-		}
+		f = conditionOperator(c->op, value1, value2);
 	}
 
 	return f;
 }
 
+// Runs the compiled form of a condition, see compileCondition in conddebug.cpp
+int evaluateCode(const CondInstr* code)
+{
+	int stack[CC_MAX_STACK];
+	int* sp = stack;
+
+	for (const CondInstr* ip = code; ; ip++)
+	{
+		switch (ip->op)
+		{
+			case CC_END: return stack[0];
+			case CC_NUM: *sp++ = ip->value; break;
+			case CC_REG: *sp++ = getValue(ip->arg); break;
+			case CC_FLAG: *sp++ = (_P & ip->arg) ? 1 : 0; break;
+			case CC_MEM: sp[-1] = GetMem(sp[-1]); break;
+			case CC_MEM_NUM: *sp++ = GetMem(ip->value); break;
+			case CC_PC_BANK: *sp++ = getBank(_PC); break;
+			case CC_DATA_BANK: *sp++ = getBank(debugLastAddress); break;
+			case CC_VALUE_READ: *sp++ = GetMem(debugLastAddress); break;
+			case CC_VALUE_WRITE: *sp++ = evaluateWrite(debugLastOpcode, debugLastAddress); break;
+			case CC_BINARY:
+				sp--;
+				sp[-1] = conditionOperator(ip->arg, sp[-1], sp[0]);
+				break;
+			case CC_AND:
+				if (sp[-1] == 0)
+					ip = code + ip->target - 1;
+				else
+					sp--;
+				break;
+			case CC_OR:
+				if (sp[-1] != 0)
+				{
+					sp[-1] = 1;
+					ip = code + ip->target - 1;
+				}
+				else
+					sp--;
+				break;
+			case CC_BOOL: sp[-1] = sp[-1] != 0; break;
+		}
+	}
+}
+
 int condition(watchpointinfo* wp)
 {
-	return wp->cond == 0 || evaluate(wp->cond);
+	if (wp->cond == 0)
+		return 1;
+
+	return wp->cond->code ? evaluateCode(wp->cond->code) : evaluate(wp->cond);
 }
 
 
@@ -716,6 +818,81 @@ void BreakHit(int bp_num)
 int StackAddrBackup;
 uint16 StackNextIgnorePC = 0xFFFF;
 
+// Summary of the enabled watchpoints by address, so breakpoint() only walks watchpoint[]
+// when one of them can hit. It may report a hit that the full check then rejects, but
+// never misses one. Rebuilt on the next instruction after WatchpointsChanged or a change of numWPs.
+static struct
+{
+	uint8 cpu[0x10000];       // WP_R, WP_W and WP_X of the CPU watchpoints covering each address
+	std::vector<uint32> rom;  // sorted offsets of the single address BT_R watchpoints that execute
+	bool ppu;                 // PPU or sprite watchpoints, checked on $2000-$3FFF and $4014 accesses
+	bool stack;               // CPU watchpoints in the stack page, checked on stack changes
+	uint16 noMatch;           // bit brk_type set when a CPU watchpoint doesn't take that access type
+	int numWPs;
+	bool dirty;
+} wpIndex = { {0}, std::vector<uint32>(), false, false, 0, 0, true };
+
+void WatchpointsChanged()
+{
+	wpIndex.dirty = true;
+}
+
+static void buildWatchpointIndex()
+{
+	memset(wpIndex.cpu, 0, sizeof(wpIndex.cpu));
+	wpIndex.rom.clear();
+	wpIndex.ppu = false;
+	wpIndex.stack = false;
+	wpIndex.noMatch = 0;
+
+	for (int i = 0; i < numWPs; i++)
+	{
+		const watchpointinfo &wp = watchpoint[i];
+
+		if (!(wp.flags & WP_E))
+			continue;
+
+		if (wp.flags & (BT_P | BT_S))
+		{
+			wpIndex.ppu = true;
+			continue;
+		}
+
+		// The access types the instruction doesn't match send the watchpoint to the stack checks,
+		// which also take the StackNextIgnorePC one time skip
+		for (int type = 0; type < 16; type++)
+		{
+			if (!(wp.flags & type))
+				wpIndex.noMatch |= 1 << type;
+		}
+
+		uint32 start = wp.address;
+		uint32 end = wp.endaddress ? wp.endaddress : wp.address;
+
+		// Stack checks compare the address to $0100-$01FF whatever the break type
+		if ((wp.flags & (WP_R | WP_W)) && (start <= 0x1FF) && (end >= 0x100))
+			wpIndex.stack = true;
+
+		// Single ROM breaks compare the file offset of PC, ranges the CPU addresses
+		if ((wp.flags & BT_R) && !wp.endaddress)
+		{
+			if (wp.flags & WP_X)
+				wpIndex.rom.push_back(wp.address);
+			continue;
+		}
+
+		if (end > 0xFFFF)
+			end = 0xFFFF;
+		for (uint32 a = start; a <= end; a++)
+			wpIndex.cpu[a] |= wp.flags & (WP_R | WP_W | WP_X);
+	}
+
+	std::sort(wpIndex.rom.begin(), wpIndex.rom.end());
+
+	wpIndex.numWPs = numWPs;
+	wpIndex.dirty = false;
+}
+
 ///fires a breakpoint
 static void breakpoint(uint8 *opcode, uint16 A, int size) {
 	int i, romAddrPC;
@@ -784,8 +961,6 @@ static void breakpoint(uint8 *opcode, uint16 A, int size) {
 		return;
 	}
 
-	romAddrPC = GetNesFileAddress(_PC);
-
 	brk_type = opbrktype[opcode[0]] | WP_X;
 
 	switch (opcode[0]) {
@@ -804,6 +979,24 @@ static void breakpoint(uint8 *opcode, uint16 A, int size) {
 		default: break;
 	}
 
+	if (wpIndex.dirty || (wpIndex.numWPs != numWPs))
+		buildWatchpointIndex();
+
+	romAddrPC = wpIndex.rom.empty() ? -1 : GetNesFileAddress(_PC);
+
+	if (!(wpIndex.cpu[A] & (WP_R | WP_W)) && !(wpIndex.cpu[_PC] & WP_X) &&
+		!(wpIndex.ppu && (((A >= 0x2000) && (A < 0x4000)) || (A == 0x4014))) &&
+		!(wpIndex.stack && (stackop || ((StackAddrBackup != -1) && (X.S != StackAddrBackup)))) &&
+		!std::binary_search(wpIndex.rom.begin(), wpIndex.rom.end(), static_cast<uint32>(romAddrPC)))
+	{
+		// Nothing can hit, only do what the loop below does besides hitting
+		if ((StackNextIgnorePC == _PC) && (wpIndex.noMatch & (1 << brk_type)))
+			StackNextIgnorePC = 0xFFFF;
+
+		StackAddrBackup = X.S;
+		return;
+	}
+
 #define BREAKHIT(x) { if (CondForbidTest(x)) { breakHit = (x); goto STOPCHECKING; } }
 	int breakHit = -1;
 	for (i = 0; i < numWPs; i++)
@@ -970,10 +1163,66 @@ STOPCHECKING:
 }
 //bbit edited: this is the end of the inserted code
 
+opcodeinfo debugInstruction;
+
+void DecodeInstruction(uint16 addr, uint8 *opcode, opcodeinfo *op)
+{
+	uint16 A = 0, tmp;
+
+	op->opcode[0] = opcode[0];
+	op->opcode[1] = opcode[1];
+	op->opcode[2] = opcode[2];
+	op->size = opsize[opcode[0]];
+	op->mode = optype[opcode[0]];
+	op->flow = opflow[opcode[0]];
+	op->PC = addr;
+	op->target = -1;
+
+	switch (op->mode)
+	{
+		case 0: break;
+		case 1:
+			tmp = (opcode[1] + _X) & 0xFF;
+			A = GetMem(tmp);
+			tmp = (opcode[1] + _X + 1) & 0xFF;
+			A |= (GetMem(tmp) << 8);
+			break;
+		case 2: A = opcode[1]; break;
+		case 3: A = opcode[1] | (opcode[2] << 8); break;
+		case 4: A = (GetMem(opcode[1]) | (GetMem((opcode[1] + 1) & 0xFF) << 8)) + _Y; break;
+		case 5: A = (opcode[1] + _X) & 0xFF; break;
+		case 6: A = (opcode[1] | (opcode[2] << 8)) + _Y; break;
+		case 7: A = (opcode[1] | (opcode[2] << 8)) + _X; break;
+		case 8: A = (opcode[1] + _Y) & 0xFF; break;
+	}
+	op->A = A;
+
+	if (!op->flow || (op->flow & OPFLOW_ILLEGAL))
+		return;
+
+	if (op->flow & OPFLOW_BRANCH)
+	{
+		tmp = addr + opcode[1] + 0x02;
+		if (opcode[1] >= 0x80) tmp -= 0x100;
+	}
+	else if (op->flow & OPFLOW_JUMP)
+	{
+		tmp = opcode[1] | opcode[2] << 8;
+		if (opcode[0] == 0x6C) //indirect
+			tmp = GetMem(tmp) | GetMem(tmp + 1) << 8;
+	}
+	else if (op->flow & OPFLOW_RTS)
+		tmp = GetMem(((_S) + 1)|0x0100) + (GetMem(((_S) + 2)|0x0100) << 8) + 0x01;
+	else //RTI
+		tmp = GetMem(((_S) + 2)|0x0100) + (GetMem(((_S) + 3)|0x0100) << 8);
+
+	op->target = tmp;
+}
+
 void DebugCycle()
 {
 	uint8 opcode[3] = {0};
-	uint16 A = 0, tmp;
+	uint16 A;
 	int size;
 
 	if (scanline == 240)
@@ -1007,23 +1256,8 @@ void DebugCycle()
 			break;
 	}
 
-	switch (optype[opcode[0]])
-	{
-		case 0: break;
-		case 1:
-			tmp = (opcode[1] + _X) & 0xFF;
-			A = GetMem(tmp);
-			tmp = (opcode[1] + _X + 1) & 0xFF;
-			A |= (GetMem(tmp) << 8);
-			break;
-		case 2: A = opcode[1]; break;
-		case 3: A = opcode[1] | (opcode[2] << 8); break;
-		case 4: A = (GetMem(opcode[1]) | (GetMem((opcode[1] + 1) & 0xFF) << 8)) + _Y; break;
-		case 5: A = opcode[1] + _X; break;
-		case 6: A = (opcode[1] | (opcode[2] << 8)) + _Y; break;
-		case 7: A = (opcode[1] | (opcode[2] << 8)) + _X; break;
-		case 8: A = opcode[1] + _Y; break;
-	}
+	DecodeInstruction(_PC, opcode, &debugInstruction);
+	A = debugInstruction.A;
 
 	if (numWPs || dbgstate.step || dbgstate.runline || dbgstate.stepout || watchpoint[64].flags || dbgstate.badopbreak || break_on_cycles || break_on_instructions || break_asap)
 		breakpoint(opcode, A, size);
@@ -1048,6 +1282,21 @@ void DebugCycle()
 #endif
 }
 
+bool DebugCycleActive()
+{
+	if (numWPs || dbgstate.step || dbgstate.runline || dbgstate.stepout || watchpoint[64].flags || dbgstate.badopbreak || break_on_cycles || break_on_instructions || break_asap)
+		return true;
+
+	if (debug_loggingCD)
+		return true;
+
+#ifdef __WIN_DRIVER__
+	return FCEUD_TraceInstructionActive();
+#else
+	return traceInstructionCB != nullptr;
+#endif
+}
+
 void* FCEUI_TraceInstructionRegister( void (*func)(uint8*,int) )
 {
 	TraceInstructionCallback* cb = nullptr;
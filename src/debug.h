@@ -4,6 +4,7 @@
 #include "conddebug.h"
 #include "git.h"
 #include "nsf.h"
+#include "x6502.h"
 
 //watchpoint stuffs
 #define WP_E       0x01  //watchpoint, enable
@@ -62,6 +63,35 @@ typedef struct {
 //mbg merge 7/18/06 had to make this extern
 extern watchpointinfo watchpoint[65]; //64 watchpoints, + 1 reserved for step over
 
+//an instruction decoded once by DecodeInstruction, for the breakpoint checker, the CD logger and the tracers
+typedef struct {
+	uint8 opcode[3];
+	int size;      //opsize[], 0 for bad opcodes
+	uint8 mode;    //optype[] addressing mode
+	uint8 flow;    //opflow[] flags
+	uint16 PC;
+	uint16 A;      //effective address of the memory operand, 0 when mode is 0
+	int target;    //destination of branches, jumps, RTS and RTI (taken or not), -1 otherwise
+} opcodeinfo;
+
+//the instruction DebugCycle is about to run, valid while the tracers are called
+extern opcodeinfo debugInstruction;
+
+//decodes the instruction at addr using the current registers and memory
+void DecodeInstruction(uint16 addr, uint8 *opcode, opcodeinfo *op);
+
+//the address the BZK trace shows for an instruction: the flow target, else the memory operand of documented opcodes, else -1
+static INLINE int bzk_GetOperandAddress(const opcodeinfo *op)
+{
+	if (op->flow & OPFLOW_ILLEGAL)
+		return -1;
+	if (op->target >= 0)
+		return op->target;
+	return op->mode ? op->A : -1;
+}
+
+struct bzkTraceRecord_t;
+
 extern unsigned int debuggerPageSize;
 int getBank(int offs);
 int bzk_getBank(int offs);
@@ -75,6 +105,8 @@ uint8 *GetNesCHRPointer(int A);
 void KillDebugger();
 uint8 GetMem(uint16 A);
 char *bzk_GetRAMopcodes(int A, uint8 *opcode);
+void bzk_CaptureRecord(bzkTraceRecord_t *rec, uint32 prevAddr, const opcodeinfo *op);
+bool bzk_IsNmiEntry(void);
 uint8 GetPPUMem(uint8 A);
 
 //---------CDLogger
@@ -100,6 +132,8 @@ static INLINE int FCEUI_GetLoggingCD() { return debug_loggingCD; }
 extern int iaPC;
 extern uint32 iapoffset; //mbg merge 7/18/06 changed from int
 void DebugCycle();
+//true when DebugCycle has work: breakpoints or stepping, code/data logging or a trace logger
+bool DebugCycleActive();
 bool CondForbidTest(int bp_num);
 void BreakHit(int bp_num);
 
@@ -177,6 +211,12 @@ DebuggerState &FCEUI_Debugger();
 
 int offsetStringToInt(unsigned int type, const char* offsetBuffer, bool *conversionOk = nullptr);
 unsigned int NewBreak(const char* name, int start, int end, unsigned int type, const char* condition, unsigned int num, bool enable);
+// The two ways of checking a breakpoint condition, the tree walker and the compiled
+// program of Condition::code (both reachable for --benchmark)
+int evaluate(Condition* c);
+int evaluateCode(const CondInstr* code);
+//call after changing the flags or addresses of watchpoint[] directly, changes of numWPs and NewBreak are noticed on their own
+void WatchpointsChanged();
 
 void* FCEUI_TraceInstructionRegister( void (*func)(uint8*,int) );
 bool FCEUI_TraceInstructionUnregisterHandle( void* handle );
@@ -889,6 +889,36 @@ debugSymbol_t *debugSymbolTable_t::getSymbolAtAnyBank( const std::string &name )
 	return nullptr;
 }
 //--------------------------------------------------------------
+void debugSymbolSnapshot_t::copyFrom( debugSymbolTable_t &table )
+{
+	FCEU::autoScopedLock alock(table.cs);
+
+	pageMap.clear();
+
+	for (auto &page : table.pageMap)
+	{
+		std::map <int, debugSymbol_t> &syms = pageMap[ page.first ];
+
+		for (auto &sym : page.second->symMap)
+		{
+			syms.emplace( sym.first, debugSymbol_t( sym.second->offset(), sym.second->name().c_str(), sym.second->comment().c_str() ) );
+		}
+	}
+}
+//--------------------------------------------------------------
+const debugSymbol_t *debugSymbolSnapshot_t::getSymbolAtBankOffset( int bank, int ofs ) const
+{
+	auto it = pageMap.find( bank );
+
+	if ( it == pageMap.end() )
+	{
+		return nullptr;
+	}
+	auto sym = it->second.find( ofs );
+
+	return sym != it->second.end() ? &sym->second : nullptr;
+}
+//--------------------------------------------------------------
 void debugSymbolTable_t::save(void)
 {
 	debugSymbolPage_t *page;
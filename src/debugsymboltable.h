@@ -9,6 +9,7 @@
 
 class debugSymbolPage_t;
 class debugSymbolTable_t;
+class debugSymbolSnapshot_t;
 
 class debugSymbol_t
 {
@@ -34,12 +35,12 @@ class debugSymbol_t
 		page = nullptr;
 	}
 
-	const std::string &name(void)
+	const std::string &name(void) const
 	{
 		return _name;
 	}
 
-	const std::string &comment(void)
+	const std::string &comment(void) const
 	{
 		return _comment;
 	}
@@ -56,7 +57,7 @@ class debugSymbol_t
 		return;
 	}
 
-	int offset(void)
+	int offset(void) const
 	{
 		return ofs;
 	}
@@ -121,6 +122,7 @@ class debugSymbolPage_t
 	std::map <std::string, debugSymbol_t*> symNameMap;
 
 	friend class debugSymbolTable_t;
+	friend class debugSymbolSnapshot_t;
 };
 
 class debugSymbolTable_t
@@ -163,6 +165,22 @@ class debugSymbolTable_t
 	private:
 		std::map <int, debugSymbolPage_t*> pageMap;
 		FCEU::mutex *cs;
+
+		friend class debugSymbolSnapshot_t;
+};
+
+// Copy of the table for threads that look symbols up while it may change, the
+// trace log renderers. Taken under the table lock, read without any.
+class debugSymbolSnapshot_t
+{
+	public:
+		void copyFrom( debugSymbolTable_t &table );
+		void clear(void){ pageMap.clear(); }
+
+		const debugSymbol_t *getSymbolAtBankOffset( int bank, int ofs ) const;
+
+	private:
+		std::map <int, std::map <int, debugSymbol_t> > pageMap;
 };
 
 extern  debugSymbolTable_t  debugSymbolTable;
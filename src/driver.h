@@ -336,6 +336,9 @@ void FCEUD_DebugBreakpoint(int bp_num);
 ///the driver should log the current instruction, if it wants (we should move the code in the win driver that does this to the shared area)
 void FCEUD_TraceInstruction(uint8 *opcode, int size);
 
+///whether FCEUD_TraceInstruction logs anything now, the core doesn't call it otherwise (win32 driver only)
+bool FCEUD_TraceInstructionActive();
+
 ///the driver should flush its trace log
 void FCEUD_FlushTrace();
 
@@ -1806,10 +1806,12 @@ void 	ConsoleDebugger::bpItemClicked( QTreeWidgetItem *item, int column)
 			if ( isChecked )
 			{
 				watchpoint[row].flags |=  WP_E;
+				WatchpointsChanged();
 			}
 			else
 			{
 				watchpoint[row].flags &= ~WP_E;
+				WatchpointsChanged();
 			}
 		}
 	}
@@ -2661,6 +2663,7 @@ static void DeleteBreak(int sel)
 	watchpoint[numWPs].condText = 0;
 	watchpoint[numWPs].desc = 0;
 	numWPs--;
+	WatchpointsChanged();
 
 	FCEU_WRAPPER_UNLOCK();
 }
@@ -2699,6 +2702,7 @@ void debuggerClearAllBreakpoints(void)
 	   watchpoint[i].desc = 0;
 	}
 	numWPs = 0;
+	WatchpointsChanged();
 
 	FCEU_WRAPPER_UNLOCK();
 }
@@ -0,0 +1,494 @@
+// CpuBenchmark.cpp
+//
+// Headless benchmark of the emulation core (--benchmark). Runs the loaded game for
+// a number of frames in each configuration, with video and sound skipped, and reports
+// frames/s, instructions/s and ns/instruction. The configurations turn on what makes
+// X6502_Run take its debug loop: code/data logging, the trace logger in each format,
+// breakpoints and Lua memory hooks. The results can be saved as a baseline JSON file
+// and later runs compared with it, so slowdowns of the CPU, PPU and debugger code show.
+//
+// The cond-tree and cond-compiled configurations don't emulate, they check a breakpoint
+// condition benchCondChecksPerFrame times per frame with the tree walker and with the
+// compiled program. Each check counts as an instruction, so ns/instr is ns per check.
+//
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <QFile>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "../../types.h"
+#include "../../fceu.h"
+#include "../../git.h"
+#include "../../debug.h"
+#include "../../conddebug.h"
+#include "../../state.h"
+#include "../../driver.h"
+#include "../../emufile.h"
+#include "../../utils/md5.h"
+#include "../../utils/timeStamp.h"
+#ifdef _S9XLUA_H
+#include "../../fceulua.h"
+#endif
+
+#include "Qt/CodeDataLogger.h"
+#include "Qt/ConsoleDebugger.h"
+#include "Qt/TraceLogger.h"
+#include "Qt/CpuBenchmark.h"
+
+#define BENCH_BASELINE_VERSION  1
+
+enum benchKind_t
+{
+	BENCH_PLAIN = 0,
+	BENCH_CDL,
+	BENCH_TRACE,
+	BENCH_BREAKPOINTS,
+	BENCH_LUA,
+	BENCH_COND_TREE,
+	BENCH_COND_COMPILED,
+};
+
+struct benchConfig_t
+{
+	const char *name;
+	int kind;
+	int traceFormat;
+};
+
+static const benchConfig_t benchConfigs[] =
+{
+	{ "plain"       , BENCH_PLAIN      , 0 },
+	{ "cdl"         , BENCH_CDL        , 0 },
+	{ "trace-text"  , BENCH_TRACE      , TRACE_BATCH_TEXT },
+	{ "trace-bzk"   , BENCH_TRACE      , TRACE_BATCH_BZK },
+	{ "trace-bzkbin", BENCH_TRACE      , TRACE_BATCH_BZK_BINARY },
+	{ "breakpoints" , BENCH_BREAKPOINTS, 0 },
+#ifdef _S9XLUA_H
+	{ "lua"         , BENCH_LUA        , 0 },
+#endif
+	{ "cond-tree"    , BENCH_COND_TREE    , 0 },
+	{ "cond-compiled", BENCH_COND_COMPILED, 0 },
+};
+
+static const int numBenchConfigs = sizeof(benchConfigs) / sizeof(benchConfigs[0]);
+
+struct benchResult_t
+{
+	const benchConfig_t *config;
+	double seconds;
+	uint64 instructions;
+};
+
+// Hooks on everything the game touches, the callbacks only count
+static const char benchLuaScript[] =
+	"local count = 0\n"
+	"local function hook() count = count + 1 end\n"
+	"memory.registerwrite(0x0000, 0x0800, hook)\n"
+	"memory.registerread(0x0000, 0x0800, hook)\n"
+	"memory.registerexec(0x8000, 0x8000, hook)\n";
+
+// Breakpoints that are checked on every instruction and access, but whose
+// conditions never hold (A, X and Y are 8 bits), so emulation doesn't stop
+static bool addBenchBreakpoints(void)
+{
+	static const struct { int start; int end; unsigned int type; const char *cond; } bp[] =
+	{
+		{ 0x8000, 0xFFFF, BT_C | WP_X, "A==#100" },
+		{ 0x0000, 0x07FF, BT_C | WP_R, "X==#100" },
+		{ 0x0000, 0x07FF, BT_C | WP_W, "Y==#100" },
+	};
+
+	for (size_t i=0; i<sizeof(bp)/sizeof(bp[0]); i++)
+	{
+		if ( NewBreak( "benchmark", bp[i].start, bp[i].end, bp[i].type, bp[i].cond, numWPs, true ) != 0 )
+		{
+			return false;
+		}
+		numWPs++;
+	}
+	return true;
+}
+
+// A register compare and a memory read, where the compiled form saves the most
+static const char benchCondition[] = "A==#12 && $0300>#40";
+static const int benchCondChecksPerFrame = 10000;
+static Condition *benchCond = NULL;
+static volatile int benchCondSink; // keeps the results, and so the checks
+
+static bool startCondition( bool compiled )
+{
+	benchCond = generateCondition( benchCondition );
+
+	// The walker only needs the tree, the compiled side needs the program as well
+	return (benchCond != NULL) && (!compiled || (benchCond->code != NULL));
+}
+
+// Stands in for emulating the frames, returns the number of checks
+static uint64 runConditions( bool compiled, int frames )
+{
+	uint64 checks = (uint64)frames * benchCondChecksPerFrame;
+	int n = 0;
+
+	for (uint64 i=0; i<checks; i++)
+	{
+		n += compiled ? evaluateCode( benchCond->code ) : evaluate( benchCond );
+	}
+	benchCondSink = n;
+
+	return checks;
+}
+
+static bool startConfig( const benchConfig_t &cfg, const QString &dir )
+{
+	switch (cfg.kind)
+	{
+		case BENCH_CDL:
+			InitCDLog();
+			ResetCDLog();
+			StartCDLogging();
+		break;
+		case BENCH_TRACE:
+			return traceLoggerBatchStart( (dir + "/trace.log").toLocal8Bit().constData(), cfg.traceFormat ) == 0;
+		case BENCH_BREAKPOINTS:
+			return addBenchBreakpoints();
+		case BENCH_COND_TREE:
+		case BENCH_COND_COMPILED:
+			return startCondition( cfg.kind == BENCH_COND_COMPILED );
+#ifdef _S9XLUA_H
+		case BENCH_LUA:
+		{
+			QFile script( dir + "/benchmark.lua" );
+
+			if ( !script.open( QIODevice::WriteOnly ) ||
+					(script.write( benchLuaScript, sizeof(benchLuaScript) - 1 ) != sizeof(benchLuaScript) - 1) )
+			{
+				return false;
+			}
+			script.close();
+
+			return FCEU_LoadLuaCode( script.fileName().toLocal8Bit().constData() ) == 1;
+		}
+#endif
+		default:
+		break;
+	}
+	return true;
+}
+
+static bool stopConfig( const benchConfig_t &cfg )
+{
+	switch (cfg.kind)
+	{
+		case BENCH_CDL:
+			PauseCDLogging();
+			FreeCDLog();
+		break;
+		case BENCH_TRACE:
+			// Writing out what is still buffered is part of the cost
+			return traceLoggerBatchStop() == 0;
+		case BENCH_BREAKPOINTS:
+			debuggerClearAllBreakpoints();
+		break;
+		case BENCH_COND_TREE:
+		case BENCH_COND_COMPILED:
+			delete benchCond;
+			benchCond = NULL;
+		break;
+#ifdef _S9XLUA_H
+		case BENCH_LUA:
+			FCEU_LuaStop();
+		break;
+#endif
+		default:
+		break;
+	}
+	return true;
+}
+
+// Every run starts from the same savestate, so they all emulate the same frames
+static bool runConfig( const benchConfig_t &cfg, const cpuBenchmarkOptions_t &opts, EMUFILE_MEMORY &start, benchResult_t &best )
+{
+	uint8 *gfx = 0;
+	int32 *sound = 0;
+	int32 ssize = 0;
+
+	best.config = &cfg;
+	best.seconds = 0.0;
+	best.instructions = 0;
+
+	for (int run=0; run<opts.runs; run++)
+	{
+		FCEU::timeStampRecord tsStart, tsEnd;
+		QTemporaryDir dir;
+
+		start.fseek( 0, SEEK_SET );
+
+		if ( !FCEUSS_LoadFP( &start, SSLOADPARAM_NOBACKUP ) )
+		{
+			printf("Error: Failed to load the starting savestate\n");
+			return false;
+		}
+		if ( !dir.isValid() )
+		{
+			printf("Error: Failed to create a temporary folder\n");
+			return false;
+		}
+		FCEUI_SetEmulationPaused(0);
+
+		bool isCondition = (cfg.kind == BENCH_COND_TREE) || (cfg.kind == BENCH_COND_COMPILED);
+		uint64 startInstructions = total_instructions;
+		uint64 checks = 0;
+
+		tsStart.readNew();
+
+		if ( !startConfig( cfg, dir.path() ) )
+		{
+			printf("Error: Failed to set up configuration %s\n", cfg.name);
+			stopConfig( cfg );
+			return false;
+		}
+		if ( isCondition )
+		{
+			checks = runConditions( cfg.kind == BENCH_COND_COMPILED, opts.frames );
+		}
+		else
+		{
+			for (int i=0; i<opts.frames; i++)
+			{
+				// Skip rendering and sound, nothing shows them
+				FCEUI_Emulate(&gfx, &sound, &ssize, 2);
+			}
+		}
+		bool success = stopConfig( cfg );
+
+		tsEnd.readNew();
+
+		if ( !success )
+		{
+			printf("Error: Configuration %s failed\n", cfg.name);
+			return false;
+		}
+		double seconds = (tsEnd - tsStart).toSeconds();
+
+		if ( (run == 0) || (seconds < best.seconds) )
+		{
+			best.seconds = seconds;
+			best.instructions = isCondition ? checks : total_instructions - startInstructions;
+		}
+	}
+	return true;
+}
+
+static bool selectConfigs( const std::string &names, std::vector <const benchConfig_t*> &selected )
+{
+	if ( names.size() == 0 )
+	{
+		for (int i=0; i<numBenchConfigs; i++)
+		{
+			selected.push_back( &benchConfigs[i] );
+		}
+		return true;
+	}
+	QStringList list = QString::fromStdString( names ).split( ',', Qt::SkipEmptyParts );
+
+	for (int i=0; i<list.size(); i++)
+	{
+		QString name = list[i].trimmed();
+		int j;
+
+		for (j=0; j<numBenchConfigs; j++)
+		{
+			if ( name == benchConfigs[j].name )
+			{
+				selected.push_back( &benchConfigs[j] );
+				break;
+			}
+		}
+		if ( j == numBenchConfigs )
+		{
+			printf("Error: Unknown benchmark configuration '%s'\n", name.toLocal8Bit().constData());
+			return false;
+		}
+	}
+	return true;
+}
+
+static double nsPerInstruction( const benchResult_t &r )
+{
+	return r.instructions ? r.seconds * 1.0e9 / (double)r.instructions : 0.0;
+}
+
+static bool saveResults( const std::string &path, const cpuBenchmarkOptions_t &opts, const std::vector <benchResult_t> &results )
+{
+	QJsonObject root, configs;
+
+	for (size_t i=0; i<results.size(); i++)
+	{
+		const benchResult_t &r = results[i];
+		QJsonObject obj;
+
+		obj["seconds"] = r.seconds;
+		obj["instructions"] = QString::number( (qulonglong)r.instructions );
+		obj["fps"] = r.seconds > 0.0 ? opts.frames / r.seconds : 0.0;
+		obj["instructionsPerSecond"] = r.seconds > 0.0 ? r.instructions / r.seconds : 0.0;
+		obj["nsPerInstruction"] = nsPerInstruction( r );
+
+		configs[ r.config->name ] = obj;
+	}
+	root["version"] = BENCH_BASELINE_VERSION;
+	root["rom"] = GameInfo->name ? QString::fromUtf8( (const char*)GameInfo->name ) : QString();
+	root["md5"] = md5_asciistr( GameInfo->MD5 );
+	root["frames"] = opts.frames;
+	root["configs"] = configs;
+
+	QFile file( QString::fromStdString(path) );
+
+	if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+	{
+		return false;
+	}
+	QByteArray json = QJsonDocument(root).toJson();
+
+	return file.write( json ) == json.size();
+}
+
+static bool loadBaseline( const std::string &path, QJsonObject &root )
+{
+	QFile file( QString::fromStdString(path) );
+
+	if ( !file.open( QIODevice::ReadOnly ) )
+	{
+		printf("Error: Failed to open baseline %s\n", path.c_str());
+		return false;
+	}
+	QJsonDocument doc = QJsonDocument::fromJson( file.readAll() );
+
+	if ( !doc.isObject() || (doc.object()["version"].toInt() != BENCH_BASELINE_VERSION) )
+	{
+		printf("Error: %s is not a benchmark baseline\n", path.c_str());
+		return false;
+	}
+	root = doc.object();
+
+	return true;
+}
+
+int cpuBenchmarkRun(const cpuBenchmarkOptions_t &opts)
+{
+	std::vector <const benchConfig_t*> selected;
+	std::vector <benchResult_t> results;
+	QJsonObject baseline, baseConfigs;
+	bool hasBaseline = false;
+	int regressions = 0;
+
+	if ( GameInfo == NULL )
+	{
+		printf("Error: --benchmark needs a ROM\n");
+		return -1;
+	}
+	if ( (opts.frames <= 0) || (opts.runs <= 0) )
+	{
+		printf("Error: --benchmark needs a number of frames and --benchruns at least 1\n");
+		return -1;
+	}
+	if ( !selectConfigs( opts.configs, selected ) )
+	{
+		return -1;
+	}
+	if ( opts.baseline.size() )
+	{
+		if ( !loadBaseline( opts.baseline, baseline ) )
+		{
+			return -1;
+		}
+		hasBaseline = true;
+		baseConfigs = baseline["configs"].toObject();
+
+		if ( baseline["md5"].toString() != md5_asciistr( GameInfo->MD5 ) )
+		{
+			printf("Warning: The baseline was made with another ROM (%s)\n", baseline["rom"].toString().toLocal8Bit().constData());
+		}
+		if ( baseline["frames"].toInt() != opts.frames )
+		{
+			printf("Warning: The baseline ran %i frames, not %i\n", baseline["frames"].toInt(), opts.frames);
+		}
+	}
+
+	EMUFILE_MEMORY start;
+
+	if ( !FCEUSS_SaveMS( &start, 0 ) )
+	{
+		printf("Error: Failed to save the starting savestate\n");
+		return -1;
+	}
+
+	printf("Benchmark: %i frames, best of %i runs\n\n", opts.frames, opts.runs);
+	printf("%-14s %10s %12s %10s", "configuration", "fps", "M instr/s", "ns/instr");
+	if ( hasBaseline )
+	{
+		printf(" %10s %8s", "baseline", "change");
+	}
+	printf("\n");
+
+	for (size_t i=0; i<selected.size(); i++)
+	{
+		benchResult_t r;
+
+		if ( !runConfig( *selected[i], opts, start, r ) )
+		{
+			return -1;
+		}
+		results.push_back(r);
+
+		double ns = nsPerInstruction( r );
+
+		printf("%-14s %10.1f %12.2f %10.3f", r.config->name,
+				r.seconds > 0.0 ? opts.frames / r.seconds : 0.0,
+				r.seconds > 0.0 ? r.instructions / r.seconds * 1.0e-6 : 0.0, ns );
+
+		if ( hasBaseline && baseConfigs.contains( r.config->name ) )
+		{
+			QJsonObject base = baseConfigs[ r.config->name ].toObject();
+			double baseNs = base["nsPerInstruction"].toDouble();
+			double change = baseNs > 0.0 ? (ns - baseNs) * 100.0 / baseNs : 0.0;
+			bool slower = change > opts.tolerance;
+
+			printf(" %10.3f %+7.1f%%%s", baseNs, change, slower ? "  REGRESSION" : "");
+
+			if ( slower )
+			{
+				regressions++;
+			}
+			// Same ROM and frames, the core has to run the very same instructions
+			if ( (base["instructions"].toString().toULongLong() != r.instructions) &&
+					(baseline["md5"].toString() == md5_asciistr( GameInfo->MD5 )) && (baseline["frames"].toInt() == opts.frames) )
+			{
+				printf("  (%llu instructions, the baseline ran %s)", (unsigned long long)r.instructions,
+						base["instructions"].toString().toLocal8Bit().constData());
+			}
+		}
+		printf("\n");
+	}
+
+	if ( opts.saveFile.size() )
+	{
+		if ( !saveResults( opts.saveFile, opts, results ) )
+		{
+			printf("Error: Failed to write the results to %s\n", opts.saveFile.c_str());
+			return -1;
+		}
+		printf("\nResults saved to %s\n", opts.saveFile.c_str());
+	}
+	if ( regressions )
+	{
+		printf("\n%i configuration(s) more than %.1f%% slower than the baseline\n", regressions, opts.tolerance);
+		return 1;
+	}
+	return 0;
+}
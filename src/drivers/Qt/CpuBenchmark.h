@@ -0,0 +1,24 @@
+// CpuBenchmark.h
+//
+#pragma once
+
+#include <string>
+
+struct cpuBenchmarkOptions_t
+{
+	int frames;            // frames emulated per run
+	int runs;              // runs per configuration, the fastest one counts
+	std::string configs;   // configuration names separated by commas, empty for all of them
+	std::string baseline;  // results file to compare with, or empty
+	std::string saveFile;  // file to write the results to as a new baseline, or empty
+	double tolerance;      // percent ns/instruction may grow over the baseline before it is a regression
+
+	cpuBenchmarkOptions_t(void)
+		: frames(0), runs(3), tolerance(10.0)
+	{
+	}
+};
+
+// Headless benchmark (--benchmark) of the loaded game in every configuration asked for.
+// Returns 0, 1 if a configuration got slower than the baseline allows, or -1 on errors.
+int cpuBenchmarkRun(const cpuBenchmarkOptions_t &opts);
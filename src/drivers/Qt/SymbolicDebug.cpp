@@ -40,24 +40,30 @@
 
 
 //--------------------------------------------------------------
-debugSymbol_t *replaceSymbols( int flags, int addr, char *str )
+// The snapshot needs no lock, trace lines are rendered on several threads
+static const debugSymbol_t *lookupSymbol( int bank, int addr, const debugSymbolSnapshot_t *syms )
 {
-	debugSymbol_t *sym;
+	return syms ? syms->getSymbolAtBankOffset( bank, addr ) : debugSymbolTable.getSymbolAtBankOffset( bank, addr );
+}
+//--------------------------------------------------------------
+// bank is getBank(addr), trace lines pass the one saved when the instruction ran.
+// Symbols come from syms when given, else from debugSymbolTable.
+const debugSymbol_t *replaceSymbols( int flags, int addr, char *str, int bank, const debugSymbolSnapshot_t *syms )
+{
+	const debugSymbol_t *sym;
 	StringBuilder sb(str);
   
 	if ( addr >= 0x8000 )
 	{
-		int bank = getBank(addr);
-
-  		sym = debugSymbolTable.getSymbolAtBankOffset( bank, addr );
+  		sym = lookupSymbol( bank, addr, syms );
 	}
 	else
 	{
-  		sym = debugSymbolTable.getSymbolAtBankOffset( -1, addr );
+  		sym = lookupSymbol( -1, addr, syms );
 
 		if ( (sym == NULL) && (flags & ASM_DEBUG_REGS) )
 		{
-  			sym = debugSymbolTable.getSymbolAtBankOffset( -2, addr );
+  			sym = lookupSymbol( -2, addr, syms );
 		}
 	}
 
@@ -75,10 +81,10 @@ debugSymbol_t *replaceSymbols( int flags, int addr, char *str )
 	return sym;
 }
 //--------------------------------------------------------------
-int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugSymbol_t *symOut, debugSymbol_t *symOut2 )
+int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugSymbol_t *symOut, debugSymbol_t *symOut2, const asmTraceValues_t *vals )
 {
-	debugSymbol_t *sym  = NULL;
-	debugSymbol_t *sym2 = NULL;
+	const debugSymbol_t *sym  = NULL;
+	const debugSymbol_t *sym2 = NULL;
 	const char *chr;
 	char indReg;
 	uint16_t tmp,tmp2;
@@ -89,9 +95,13 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 	symDebugEnable = (flags & ASM_DEBUG_SYMS  ) ? true : false;
 	showTrace      = (flags & ASM_DEBUG_TRACES) ? true : false;
 
-	//these may be replaced later with passed-in values to make a lighter-weight disassembly mode that may not query the referenced values
-	#define RX (X.X)
-	#define RY (X.Y)
+	//registers and referenced values come from vals when the instruction ran earlier, else from the emulator
+	#define RX (vals ? vals->X : X.X)
+	#define RY (vals ? vals->Y : X.Y)
+	#define opValue(a) (vals ? vals->val : GetMem(a))
+	#define symBank(a)  (vals ? vals->bank  : getBank(a))
+	#define symBank2(a) (vals ? vals->bank2 : getBank(a))
+	#define symTable    (vals ? vals->syms  : NULL)
 
 	switch (opcode[0]) 
 	{
@@ -106,12 +116,18 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 			(a) = (opcode[1]+(i))&0xFF; \
 		}
 		#define indirectX(a) { \
-			(a) = (opcode[1]+RX)&0xFF; \
-			(a) = GetMem((a)) | (GetMem(((a)+1)&0xff))<<8; \
+			if (vals) (a) = vals->addr; \
+			else { \
+				(a) = (opcode[1]+RX)&0xFF; \
+				(a) = GetMem((a)) | (GetMem(((a)+1)&0xff))<<8; \
+			} \
 		}
 		#define indirectY(a) { \
-			(a) = GetMem(opcode[1]) | (GetMem((opcode[1]+1)&0xff))<<8; \
-			(a) += RY; \
+			if (vals) (a) = vals->addr; \
+			else { \
+				(a) = GetMem(opcode[1]) | (GetMem((opcode[1]+1)&0xff))<<8; \
+				(a) += RY; \
+			} \
 		}
 
 
@@ -168,7 +184,7 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 
 		_indirect:
 			if ( symDebugEnable )
-				sym = replaceSymbols( flags, tmp, stmp );
+				sym = replaceSymbols( flags, tmp, stmp, symBank(tmp), symTable );
 
 			sb << chr << " (" << sb_addr(opcode[1], 2) << ',' << indReg << ')';
 
@@ -180,7 +196,7 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 				else
 					sb << sb_addr(tmp);
 
-				sb << " = " << sb_lit(GetMem(tmp));
+				sb << " = " << sb_lit(opValue(tmp));
 			}
 			break;
 
@@ -213,14 +229,14 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 			sb << chr << ' ';
 			if ( symDebugEnable )
 			{
-				sym = replaceSymbols( flags | ASM_DEBUG_ADDR_02X, opcode[1], stmp );
+				sym = replaceSymbols( flags | ASM_DEBUG_ADDR_02X, opcode[1], stmp, symBank(opcode[1]), symTable );
 				sb << stmp;
 			}
 			else
 				sb << sb_addr(opcode[1], 2);
 
 			if (showTrace)
-				sb << " = " << sb_lit(GetMem(opcode[1]));
+				sb << " = " << sb_lit(opValue(opcode[1]));
 
 		// ################################## End of SP CODE ###########################
 			break;
@@ -270,14 +286,14 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 			sb << chr << ' ';
 			if ( symDebugEnable )
 			{
-				sym = replaceSymbols( flags, tmp, stmp );
+				sym = replaceSymbols( flags, tmp, stmp, symBank(tmp), symTable );
 				sb << stmp;
 			}
 			else
 				sb << sb_addr(tmp);
 
 			if (showTrace)
-				sb << " = " << sb_lit(GetMem(tmp));
+				sb << " = " << sb_lit(opValue(tmp));
 
 			break;
 
@@ -296,7 +312,7 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 			sb << chr << ' ';
 			if ( symDebugEnable )
 			{
-				sym = replaceSymbols( flags, tmp, stmp );
+				sym = replaceSymbols( flags, tmp, stmp, symBank(tmp), symTable );
 				sb << stmp;
 			}
 			else
@@ -344,7 +360,7 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 		// ################################## Start of SP CODE ###########################
 		// Change width to %04X // don't!
 			if ( symDebugEnable )
-				sym = replaceSymbols( flags, tmp, stmp );
+				sym = replaceSymbols( flags, tmp, stmp, symBank(tmp), symTable );
 				
 			sb << chr << ' ' << sb_addr(opcode[1], 2) << ',' << indReg;
 			if (showTrace)
@@ -355,7 +371,7 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 				else
 					sb << sb_addr(tmp);
 
-				sb << " = " << sb_lit(GetMem(tmp));
+				sb << " = " << sb_lit(opValue(tmp));
 			}
 		// ################################## End of SP CODE ###########################
 			break;
@@ -379,8 +395,8 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 			sb << chr << ' ';
 			if ( symDebugEnable )
 			{
-				sym  = replaceSymbols( flags, tmp , stmp  );
-				sym2 = replaceSymbols( flags, tmp2, stmp2 );
+				sym  = replaceSymbols( flags, tmp , stmp , symBank2(tmp), symTable );
+				sym2 = replaceSymbols( flags, tmp2, stmp2, symBank(tmp2), symTable );
 				sb << stmp;
 			}
 			else
@@ -396,7 +412,7 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 				else
 					sb << sb_addr(tmp2);
 
-				sb << " = " << sb_lit(GetMem(tmp2));
+				sb << " = " << sb_lit(opValue(tmp2));
 			}
 
 			break;
@@ -433,7 +449,7 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 			sb << chr << ' ';
 			if (symDebugEnable)
 			{
-				sym = replaceSymbols(flags, tmp, stmp);
+				sym = replaceSymbols(flags, tmp, stmp, symBank(tmp), symTable);
 				sb << stmp;
 			}
 			else
@@ -443,9 +459,17 @@ int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugS
 
 		case 0x6C:
 			absolute(tmp); 
+			tmp2 = vals ? vals->target : GetMem(tmp) | GetMem(tmp + 1) << 8;
 
-			sb << "JMP (" << sb_addr(tmp);
-			sb << ") = " << sb_addr(GetMem(tmp) | GetMem(tmp + 1) << 8);
+			sb << "JMP (";
+			if (symDebugEnable)
+			{
+				sym  = replaceSymbols( flags, tmp , stmp , symBank(tmp), symTable );
+				sym2 = replaceSymbols( flags, tmp2, stmp2, symBank2(tmp2), symTable );
+				sb << stmp << ") = " << stmp2;
+			}
+			else
+				sb << sb_addr(tmp) << ") = " << sb_addr(tmp2);
 			
 			break;
 
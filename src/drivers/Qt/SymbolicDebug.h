@@ -88,6 +88,20 @@ int generateNLFilenameForAddress(int address, std::string &NLfilename);
 #define  ASM_DEBUG_ADDR_02X   0x0008
 #define  ASM_DEBUG_TRACES     0x0010
 
-int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugSymbol_t *symOut = NULL, debugSymbol_t *symOut2 = NULL );
+// What DisassembleWithDebug reads from the emulator, saved when an instruction runs
+// so it can be disassembled later (the trace logger renders its lines on demand)
+struct asmTraceValues_t
+{
+	uint8_t  X;
+	uint8_t  Y;
+	uint8_t  val;    // byte at addr
+	uint16_t addr;   // effective address of the memory operand, the pointer of JMP ()
+	uint16_t target; // destination of JMP ()
+	int32_t  bank;   // getBank of addr, of the branch or jump target, of the pointer of JMP ()
+	int32_t  bank2;  // getBank of the base of abs,X and abs,Y, and of the destination of JMP ()
+	const debugSymbolSnapshot_t *syms; // symbols to use instead of debugSymbolTable, NULL for the table
+};
+
+int DisassembleWithDebug(int addr, uint8_t *opcode, int flags, char *str, debugSymbol_t *symOut = NULL, debugSymbol_t *symOut2 = NULL, const asmTraceValues_t *vals = NULL );
 
 #endif
@@ -2,6 +2,8 @@
 #pragma once
 #include <stdint.h>
 #include <vector>
+#include <deque>
+#include <memory>
 
 #include "Qt/TasEditor/laglog.h"
 
@@ -17,6 +19,8 @@
 
 #define PROGRESSBAR_UPDATE_RATE 1000	// progressbar is updated after every 1000 savestates loaded from FM3 file
 
+namespace FCEU { struct compressJob; }
+
 class GREENZONE
 {
 public:
@@ -50,6 +54,7 @@ public:
 
 private:
 	void collectCurrentState();
+	void collectCompressedStates(bool wait);
 	bool clearSavestateOfFrame(unsigned int frame);
 	bool clearSavestateAndFreeMemory(unsigned int frame);
 
@@ -62,5 +67,14 @@ private:
 
 	// not saved data
 	uint64_t nextCleaningTime;
+
+	// savestates being compressed in the background, oldest first. Until its job is done a frame holds its uncompressed savestate
+	struct PENDING_SAVESTATE
+	{
+		unsigned int frame;
+		std::shared_ptr<FCEU::compressJob> job;
+	};
+	std::deque<PENDING_SAVESTATE> pendingSavestates;
+	void swapInCompressedState(PENDING_SAVESTATE& pending);
 	
 };
@@ -22,10 +22,10 @@
 //
 #include <stdio.h>
 #include <math.h>
+#include <atomic>
 
 #ifdef WIN32
 #include <windows.h>
-#include "../win/TraceFileWriter.h"
 #else
 #include <unistd.h>
 #include <sys/types.h>
@@ -34,6 +34,7 @@
 #endif
 
 #include <QDir>
+#include <QFile>
 #include <QMenu>
 #include <QMenuBar>
 #include <QAction>
@@ -57,6 +58,14 @@
 #include "../../movie.h"
 
 #include "common/os_utils.h"
+#include "common/TraceFileWriter.h"
+#include "common/TraceFileCompressor.h"
+#include "common/TraceSegmentWriter.h"
+#include "common/TraceIndexWriter.h"
+#include "common/TraceFilter.h"
+#include "common/TraceMemAccess.h"
+#include "common/TraceRing.h"
+#include "common/TraceTextRenderer.h"
 #include "utils/StringBuilder.h"
 
 #include "Qt/NetPlay.h"
@@ -84,6 +93,20 @@
 #define LOG_CYCLES_COUNT 0x00000400
 #define LOG_INSTRUCTIONS_COUNT 0x00000800
 #define LOG_BANK_NUMBER 0x00001000
+#define LOG_BZK_FORMAT 0x00002000
+#define LOG_BZK_BINARY 0x00004000
+#define LOG_BZK_COMPRESS 0x00008000
+#define LOG_BZK_FOLD 0x00010000
+#define LOG_BZK_EDGES 0x00020000
+#define LOG_BZK_SEGMENTS 0x00040000
+#define LOG_MEM_ACCESSES 0x00080000
+
+// traceRecord_t::flags, 0x01 and 0x02 mark overflowed and undefined opcodes
+#define TRACE_REC_BZK 0x04 // bzk columns are valid instead of ins
+#define TRACE_REC_MSG 0x08 // msg is valid instead of ins
+#define TRACE_REC_WRITE 0x10 // the instruction writes to the operand address
+#define TRACE_REC_CALL 0x20 // ins.opAddr is the subroutine an RTS returns from
+#define TRACE_REC_NMI 0x40 // first instruction of an NMI handler, for the BZK trace index
 
 #define LOG_LINE_MAX_LEN 160
 // Frames count - 1+6+1 symbols
@@ -114,24 +137,47 @@ static traceRecord_t *recBuf = NULL;
 static int recBufMax = 0;
 static int recBufHead = 0;
 static int recBufNum = 0;
-static traceRecord_t *logBuf = NULL;
+// Records on their way to the disk thread, open while it runs
+static TraceRing<traceRecord_t> logRing;
 static int logBufMax = 3000000;
-// logBufHead and logBufTail are volatile because they are shared use by both the emulation and disk logger threads.
-// Ensure that the compiler doesn't do any thread caching optimizations on them so that changes to these
-// variables are immediately visible by the other thread.
-static volatile int logBufHead = 0;
-static volatile int logBufTail = 0;
 static bool overrunWarningArmed = true;
 static TraceLoggerDialog_t *traceLogWindow = NULL;
+static TraceLogDiskThread_t *batchDiskThread = NULL; // --tracelog, logging without the window
 static void pushMsgToLogBuffer(const char *msg);
-#ifdef WIN32
-#include <windows.h>
-static HANDLE logFile = INVALID_HANDLE_VALUE;
-#else
-static int logFile = -1;
-#endif
+static void startBzkLogSession(void);
+static void initTraceSymbols(void);
+static void endBzkLogSession(void);
 static std::string  logFilePath;
 static void* traceRegistrationHandle = nullptr;
+static int bzkLogMode = 0; // LOG_BZK_* options, latched when logging starts
+static uint32 bzkPrevAddr = BZK_TRACE_NO_PREV_ADDR;
+static std::atomic<bool> bzkIndexFailed(false); // set by the disk thread, no NMI entries to look for
+static bzkTraceEdgeSet_t bzkEdgeSet; // LOG_BZK_EDGES coverage, kept in <rom>.bzkedges
+static TraceFilter traceFilter; // compiled when logging starts
+static void initTraceFilter(void);
+
+// LOG_MEM_ACCESSES, every bus access to <log file>.mem through the same disk thread
+static TraceRing<traceMemAccess_t> memRing;
+static const size_t memBufMax = 1 << 22;
+static TraceMemFilter memFilter;
+static bool memHooksOn = false;
+static uint16 memTracePC = 0;
+static traceMemAccess_t memPending; // last access, the exec hook may turn it into an opcode fetch
+static bool memPendingValid = false;
+static bool startMemTraceSession(void);
+static void setMemTraceHooks(bool enable);
+// Written by the emulation thread before the records that use them. Records hold a 24 bit
+// sequence number and the table the last 65536 of them, older keys read as stale.
+static const uint32_t traceKeyMask = 0xFFFFFF;
+static const uint32_t traceKeyLive = 65536 - 256; // leaves the slots about to be reused out
+static traceKeyframe_t traceKeys[65536];
+// Symbols for the lines, taken when logging starts before any renderer runs. The renderer
+// threads share it without locking, symbols edited while logging show in the next session.
+static debugSymbolSnapshot_t traceSymbols;
+static std::atomic<uint32_t> traceKeySeq(0);
+static bool traceKeyValid = false;
+
+static_assert(sizeof(traceRecord_t) == 32, "traceRecord_t layout");
 //----------------------------------------------------
 static void initLogOption( const char *name, int bitmask )
 {
@@ -149,6 +195,45 @@ static void initLogOption( const char *name, int bitmask )
 	}
 }
 //----------------------------------------------------
+static void initLogOptions(void)
+{
+	initLogOption("SDL.TraceLogRegisterState", LOG_REGISTERS );
+	initLogOption("SDL.TraceLogProcessorState", LOG_PROCESSOR_STATUS );
+	initLogOption("SDL.TraceLogNewInstructions", LOG_NEW_INSTRUCTIONS );
+	initLogOption("SDL.TraceLogNewData", LOG_NEW_DATA );
+	initLogOption("SDL.TraceLogFrameCount", LOG_FRAMES_COUNT );
+	initLogOption("SDL.TraceLogCycleCount", LOG_CYCLES_COUNT );
+	initLogOption("SDL.TraceLogInstructionCount", LOG_INSTRUCTIONS_COUNT );
+	initLogOption("SDL.TraceLogMessages", LOG_MESSAGES );
+	initLogOption("SDL.TraceLogBreakpointHits", LOG_BREAKPOINTS );
+	initLogOption("SDL.TraceLogBankNumber", LOG_BANK_NUMBER );
+	initLogOption("SDL.TraceLogSymbolic", LOG_SYMBOLIC );
+	initLogOption("SDL.TraceLogStackTabbing", LOG_CODE_TABBING );
+	initLogOption("SDL.TraceLogLeftDisassembly", LOG_TO_THE_LEFT );
+
+	initLogOption("SDL.TraceLogBzkFormat", LOG_BZK_FORMAT );
+	initLogOption("SDL.TraceLogBzkBinary", LOG_BZK_BINARY );
+	initLogOption("SDL.TraceLogBzkCompress", LOG_BZK_COMPRESS );
+	initLogOption("SDL.TraceLogBzkFold", LOG_BZK_FOLD );
+	initLogOption("SDL.TraceLogBzkEdges", LOG_BZK_EDGES );
+	initLogOption("SDL.TraceLogBzkSegments", LOG_BZK_SEGMENTS );
+
+	initLogOption("SDL.TraceLogMemAccesses", LOG_MEM_ACCESSES );
+}
+//----------------------------------------------------
+// Error dialogs need the main window, a headless capture prints them
+static void queueErrorMsg(const char *msg)
+{
+	if ( consoleWindow )
+	{
+		consoleWindow->QueueErrorMsgWindow(msg);
+	}
+	else
+	{
+		fprintf(stderr, "%s\n", msg);
+	}
+}
+//----------------------------------------------------
 TraceLoggerDialog_t::TraceLoggerDialog_t(QWidget *parent)
 	: QDialog(parent, Qt::Window)
 {
@@ -163,6 +248,7 @@ TraceLoggerDialog_t::TraceLoggerDialog_t(QWidget *parent)
 	QLabel *lbl;
 	int opt, useNativeMenuBar;
 	QShortcut *shortcut;
+	std::string memRanges, filterTxt;
 
 	if (recBufMax == 0)
 	{
@@ -317,19 +403,7 @@ TraceLoggerDialog_t::TraceLoggerDialog_t(QWidget *parent)
 	logInstrCountCbox = new QCheckBox(tr("Log Instructions Count"));
 	logBankNumCbox = new QCheckBox(tr("Log Bank Number"));
 
-	initLogOption("SDL.TraceLogRegisterState", LOG_REGISTERS );
-	initLogOption("SDL.TraceLogProcessorState", LOG_PROCESSOR_STATUS );
-	initLogOption("SDL.TraceLogNewInstructions", LOG_NEW_INSTRUCTIONS );
-	initLogOption("SDL.TraceLogNewData", LOG_NEW_DATA );
-	initLogOption("SDL.TraceLogFrameCount", LOG_FRAMES_COUNT );
-	initLogOption("SDL.TraceLogCycleCount", LOG_CYCLES_COUNT );
-	initLogOption("SDL.TraceLogInstructionCount", LOG_INSTRUCTIONS_COUNT );
-	initLogOption("SDL.TraceLogMessages", LOG_MESSAGES );
-	initLogOption("SDL.TraceLogBreakpointHits", LOG_BREAKPOINTS );
-	initLogOption("SDL.TraceLogBankNumber", LOG_BANK_NUMBER );
-	initLogOption("SDL.TraceLogSymbolic", LOG_SYMBOLIC );
-	initLogOption("SDL.TraceLogStackTabbing", LOG_CODE_TABBING );
-	initLogOption("SDL.TraceLogLeftDisassembly", LOG_TO_THE_LEFT );
+	initLogOptions();
 
 	logRegCbox->setChecked((logging_options & LOG_REGISTERS) ? true : false);
 	logFrameCbox->setChecked((logging_options & LOG_FRAMES_COUNT) ? true : false);
@@ -378,6 +452,9 @@ TraceLoggerDialog_t::TraceLoggerDialog_t(QWidget *parent)
 
 	logNewMapCodeCbox->setChecked((logging_options & LOG_NEW_INSTRUCTIONS) ? true : false);
 	logNewMapDataCbox->setChecked((logging_options & LOG_NEW_DATA) ? true : false);
+	// The BZK format logs every instruction
+	logNewMapCodeCbox->setEnabled((logging_options & LOG_BZK_FORMAT) ? false : true);
+	logNewMapDataCbox->setEnabled((logging_options & LOG_BZK_FORMAT) ? false : true);
 
 	connect(logNewMapCodeCbox, SIGNAL(stateChanged(int)), this, SLOT(logNewMapCodeChanged(int)));
 	connect(logNewMapDataCbox, SIGNAL(stateChanged(int)), this, SLOT(logNewMapDataChanged(int)));
@@ -387,6 +464,108 @@ TraceLoggerDialog_t::TraceLoggerDialog_t(QWidget *parent)
 
 	mainLayout->addWidget(frame, 1);
 
+	grid = new QGridLayout();
+	frame = new QGroupBox(tr("BZK 6502 Disassembler"));
+	frame->setLayout(grid);
+
+	bzkFormatCbox = new QCheckBox(tr("Log in BZK Format (z00000.log files in the log file folder)"));
+	bzkBinaryCbox = new QCheckBox(tr("Write Packed Binary Records (*.bzk, convert with bzkTraceConv)"));
+	bzkCompressCbox = new QCheckBox(tr("Compress Files (*.gz frames)"));
+	bzkFoldCbox = new QCheckBox(tr("Fold Repeated Loops (binary records only)"));
+	bzkEdgesCbox = new QCheckBox(tr("Only Log New Edges (coverage saved per ROM)"));
+	bzkSegmentsCbox = new QCheckBox(tr("Memory Mapped Segments (zsegments.idx index, no compression)"));
+
+	bzkFormatCbox->setChecked((logging_options & LOG_BZK_FORMAT) ? true : false);
+	bzkBinaryCbox->setChecked((logging_options & LOG_BZK_BINARY) ? true : false);
+	bzkBinaryCbox->setEnabled((logging_options & LOG_BZK_FORMAT) ? true : false);
+	bzkCompressCbox->setChecked((logging_options & LOG_BZK_COMPRESS) ? true : false);
+	bzkCompressCbox->setEnabled((logging_options & LOG_BZK_FORMAT) ? true : false);
+	bzkFoldCbox->setChecked((logging_options & LOG_BZK_FOLD) ? true : false);
+	bzkFoldCbox->setEnabled((logging_options & LOG_BZK_FORMAT) && (logging_options & LOG_BZK_BINARY) ? true : false);
+	bzkEdgesCbox->setChecked((logging_options & LOG_BZK_EDGES) ? true : false);
+	bzkEdgesCbox->setEnabled((logging_options & LOG_BZK_FORMAT) ? true : false);
+	bzkSegmentsCbox->setChecked((logging_options & LOG_BZK_SEGMENTS) ? true : false);
+	bzkSegmentsCbox->setEnabled((logging_options & LOG_BZK_FORMAT) ? true : false);
+
+	connect(bzkFormatCbox, SIGNAL(stateChanged(int)), this, SLOT(bzkFormatStateChanged(int)));
+	connect(bzkBinaryCbox, SIGNAL(stateChanged(int)), this, SLOT(bzkBinaryStateChanged(int)));
+	connect(bzkCompressCbox, SIGNAL(stateChanged(int)), this, SLOT(bzkCompressStateChanged(int)));
+	connect(bzkFoldCbox, SIGNAL(stateChanged(int)), this, SLOT(bzkFoldStateChanged(int)));
+	connect(bzkEdgesCbox, SIGNAL(stateChanged(int)), this, SLOT(bzkEdgesStateChanged(int)));
+	connect(bzkSegmentsCbox, SIGNAL(stateChanged(int)), this, SLOT(bzkSegmentsStateChanged(int)));
+
+	grid->addWidget(bzkFormatCbox, 0, 0, Qt::AlignLeft);
+	grid->addWidget(bzkBinaryCbox, 0, 1, Qt::AlignLeft);
+	grid->addWidget(bzkCompressCbox, 1, 1, Qt::AlignLeft);
+	grid->addWidget(bzkFoldCbox, 2, 1, Qt::AlignLeft);
+	grid->addWidget(bzkEdgesCbox, 1, 0, Qt::AlignLeft);
+	grid->addWidget(bzkSegmentsCbox, 2, 0, Qt::AlignLeft);
+
+	mainLayout->addWidget(frame, 1);
+
+	grid = new QGridLayout();
+	frame = new QGroupBox(tr("Capture Filter (checked before an instruction is logged)"));
+	frame->setLayout(grid);
+
+	filterPcEdit = new QLineEdit();
+	filterBanksEdit = new QLineEdit();
+	filterRamCbox = new QCheckBox(tr("Only Code Run from RAM"));
+	filterNmiCbox = new QCheckBox(tr("Only in NMI Handlers"));
+	filterIrqCbox = new QCheckBox(tr("Only in IRQ/BRK Handlers"));
+
+	filterPcEdit->setPlaceholderText(tr("All addresses, or e.g. 8000-9FFF, E000-FFFF"));
+	filterBanksEdit->setPlaceholderText(tr("All banks, or BZK bank numbers e.g. 0-3, 62"));
+
+	g_config->getOption("SDL.TraceLogFilterPC", &filterTxt);
+	filterPcEdit->setText(QString::fromStdString(filterTxt));
+	g_config->getOption("SDL.TraceLogFilterBanks", &filterTxt);
+	filterBanksEdit->setText(QString::fromStdString(filterTxt));
+	g_config->getOption("SDL.TraceLogFilterRamOnly", &opt);
+	filterRamCbox->setChecked(opt ? true : false);
+	g_config->getOption("SDL.TraceLogFilterNmi", &opt);
+	filterNmiCbox->setChecked(opt ? true : false);
+	g_config->getOption("SDL.TraceLogFilterIrq", &opt);
+	filterIrqCbox->setChecked(opt ? true : false);
+
+	connect(filterPcEdit, SIGNAL(textChanged(const QString &)), this, SLOT(filterPcChanged(const QString &)));
+	connect(filterBanksEdit, SIGNAL(textChanged(const QString &)), this, SLOT(filterBanksChanged(const QString &)));
+	connect(filterRamCbox, SIGNAL(stateChanged(int)), this, SLOT(filterRamStateChanged(int)));
+	connect(filterNmiCbox, SIGNAL(stateChanged(int)), this, SLOT(filterNmiStateChanged(int)));
+	connect(filterIrqCbox, SIGNAL(stateChanged(int)), this, SLOT(filterIrqStateChanged(int)));
+
+	grid->addWidget(new QLabel(tr("PC:")), 0, 0, Qt::AlignLeft);
+	grid->addWidget(filterPcEdit, 0, 1);
+	grid->addWidget(new QLabel(tr("Banks:")), 0, 2, Qt::AlignLeft);
+	grid->addWidget(filterBanksEdit, 0, 3);
+	grid->addWidget(filterRamCbox, 1, 0, 1, 2, Qt::AlignLeft);
+	grid->addWidget(filterNmiCbox, 1, 2, 1, 1, Qt::AlignLeft);
+	grid->addWidget(filterIrqCbox, 1, 3, 1, 1, Qt::AlignLeft);
+
+	mainLayout->addWidget(frame, 1);
+
+	grid = new QGridLayout();
+	frame = new QGroupBox(tr("Memory Access Trace"));
+	frame->setLayout(grid);
+
+	memAccessCbox = new QCheckBox(tr("Log Every Bus Access (binary records in <log file>.mem)"));
+	memRangesEdit = new QLineEdit();
+	memRangesEdit->setPlaceholderText(tr("All addresses, or e.g. 0000-07FF, 4016"));
+
+	g_config->getOption("SDL.TraceLogMemRanges", &memRanges);
+
+	memAccessCbox->setChecked((logging_options & LOG_MEM_ACCESSES) ? true : false);
+	memRangesEdit->setText(QString::fromStdString(memRanges));
+	memRangesEdit->setEnabled((logging_options & LOG_MEM_ACCESSES) ? true : false);
+
+	connect(memAccessCbox, SIGNAL(stateChanged(int)), this, SLOT(memAccessStateChanged(int)));
+	connect(memRangesEdit, SIGNAL(textChanged(const QString &)), this, SLOT(memRangesChanged(const QString &)));
+
+	grid->addWidget(memAccessCbox, 0, 0, 1, 2, Qt::AlignLeft);
+	grid->addWidget(new QLabel(tr("Addresses:")), 1, 0, Qt::AlignLeft);
+	grid->addWidget(memRangesEdit, 1, 1);
+
+	mainLayout->addWidget(frame, 1);
+
 	setLayout(mainLayout);
 
 	traceViewCounter = 0;
@@ -408,8 +587,13 @@ TraceLoggerDialog_t::~TraceLoggerDialog_t(void)
 	updateTimer->stop();
 
 	//logging = 0;
+	// Instruction logging may go on without the window, the memory trace has no file left to go to
+	FCEU_WRAPPER_LOCK();
+	setMemTraceHooks(false);
+	FCEU_WRAPPER_UNLOCK();
 	msleep(1);
 	diskThread->requestInterruption();
+	logRing.wakeAll();
 	diskThread->quit();
 	diskThread->wait( 1000000 );
 
@@ -515,13 +699,17 @@ void TraceLoggerDialog_t::toggleLoggingOnOff(void)
 {
 	if (logging)
 	{
+		// Under the lock, so the emulation thread is not in the middle of a record
+		FCEU_WRAPPER_LOCK();
 		logging = 0;
-		msleep(1);
 		pushMsgToLogBuffer("Logging Finished");
+		setMemTraceHooks(false);
+		FCEU_WRAPPER_UNLOCK();
 		startStopButton->setText(tr("Start Logging"));
 		startStopButton->setIcon( style()->standardIcon( QStyle::SP_MediaPlay ) );
 
 		diskThread->requestInterruption();
+		logRing.wakeAll();
 		diskThread->quit();
 		diskThread->wait(1000);
 
@@ -535,18 +723,28 @@ void TraceLoggerDialog_t::toggleLoggingOnOff(void)
 			traceRegistrationHandle = nullptr;
 		}
 		FCEU_WRAPPER_UNLOCK();
+		endBzkLogSession();
 		traceView->update();
 	}
 	else
 	{
+		startBzkLogSession();
+		initTraceFilter();
+		initTraceSymbols();
+
 		if (logFileCbox->isChecked())
 		{
 			if ( logFilePath.size() == 0 )
 			{
 				openLogFile();
 			}
+			// Opened before any record is traced, the disk thread closes it when it ends
+			if ( !logRing.open(logBufMax) )
+			{
+				queueErrorMsg("Error: Failed to allocate the trace log disk buffer");
+			}
+			startMemTraceSession();
 			diskThread->start();
-			msleep(100);
 		}
 		pushMsgToLogBuffer("Log Start");
 		startStopButton->setText(tr("Stop Logging"));
@@ -558,6 +756,7 @@ void TraceLoggerDialog_t::toggleLoggingOnOff(void)
 			traceRegistrationHandle = FCEUI_TraceInstructionRegister( FCEUD_TraceInstruction );
 		}
 		logging = 1;
+		setMemTraceHooks(true);
 		FCEU_WRAPPER_UNLOCK();
 	}
 }
@@ -907,40 +1106,222 @@ void TraceLoggerDialog_t::logNewMapDataChanged(int state)
 	g_config->setOption("SDL.TraceLogNewData", (logging_options & LOG_NEW_DATA) ? 1 : 0 );
 }
 //----------------------------------------------------
+void TraceLoggerDialog_t::bzkFormatStateChanged(int state)
+{
+	if (state == Qt::Unchecked)
+	{
+		logging_options &= ~LOG_BZK_FORMAT;
+	}
+	else
+	{
+		logging_options |= LOG_BZK_FORMAT;
+	}
+	bzkBinaryCbox->setEnabled((logging_options & LOG_BZK_FORMAT) ? true : false);
+	bzkCompressCbox->setEnabled((logging_options & LOG_BZK_FORMAT) ? true : false);
+	bzkFoldCbox->setEnabled((logging_options & LOG_BZK_FORMAT) && (logging_options & LOG_BZK_BINARY) ? true : false);
+	bzkEdgesCbox->setEnabled((logging_options & LOG_BZK_FORMAT) ? true : false);
+	bzkSegmentsCbox->setEnabled((logging_options & LOG_BZK_FORMAT) ? true : false);
+	logNewMapCodeCbox->setEnabled((logging_options & LOG_BZK_FORMAT) ? false : true);
+	logNewMapDataCbox->setEnabled((logging_options & LOG_BZK_FORMAT) ? false : true);
+	g_config->setOption("SDL.TraceLogBzkFormat", (logging_options & LOG_BZK_FORMAT) ? 1 : 0 );
+}
+//----------------------------------------------------
+void TraceLoggerDialog_t::bzkBinaryStateChanged(int state)
+{
+	if (state == Qt::Unchecked)
+	{
+		logging_options &= ~LOG_BZK_BINARY;
+	}
+	else
+	{
+		logging_options |= LOG_BZK_BINARY;
+	}
+	bzkFoldCbox->setEnabled((logging_options & LOG_BZK_FORMAT) && (logging_options & LOG_BZK_BINARY) ? true : false);
+	g_config->setOption("SDL.TraceLogBzkBinary", (logging_options & LOG_BZK_BINARY) ? 1 : 0 );
+}
+//----------------------------------------------------
+void TraceLoggerDialog_t::bzkCompressStateChanged(int state)
+{
+	if (state == Qt::Unchecked)
+	{
+		logging_options &= ~LOG_BZK_COMPRESS;
+	}
+	else
+	{
+		logging_options |= LOG_BZK_COMPRESS;
+	}
+	g_config->setOption("SDL.TraceLogBzkCompress", (logging_options & LOG_BZK_COMPRESS) ? 1 : 0 );
+}
+//----------------------------------------------------
+void TraceLoggerDialog_t::bzkFoldStateChanged(int state)
+{
+	if (state == Qt::Unchecked)
+	{
+		logging_options &= ~LOG_BZK_FOLD;
+	}
+	else
+	{
+		logging_options |= LOG_BZK_FOLD;
+	}
+	g_config->setOption("SDL.TraceLogBzkFold", (logging_options & LOG_BZK_FOLD) ? 1 : 0 );
+}
+//----------------------------------------------------
+void TraceLoggerDialog_t::bzkEdgesStateChanged(int state)
+{
+	if (state == Qt::Unchecked)
+	{
+		logging_options &= ~LOG_BZK_EDGES;
+	}
+	else
+	{
+		logging_options |= LOG_BZK_EDGES;
+	}
+	g_config->setOption("SDL.TraceLogBzkEdges", (logging_options & LOG_BZK_EDGES) ? 1 : 0 );
+}
+//----------------------------------------------------
+void TraceLoggerDialog_t::bzkSegmentsStateChanged(int state)
+{
+	if (state == Qt::Unchecked)
+	{
+		logging_options &= ~LOG_BZK_SEGMENTS;
+	}
+	else
+	{
+		logging_options |= LOG_BZK_SEGMENTS;
+	}
+	g_config->setOption("SDL.TraceLogBzkSegments", (logging_options & LOG_BZK_SEGMENTS) ? 1 : 0 );
+}
+//----------------------------------------------------
+void TraceLoggerDialog_t::memAccessStateChanged(int state)
+{
+	if (state == Qt::Unchecked)
+	{
+		logging_options &= ~LOG_MEM_ACCESSES;
+	}
+	else
+	{
+		logging_options |= LOG_MEM_ACCESSES;
+	}
+	memRangesEdit->setEnabled((logging_options & LOG_MEM_ACCESSES) ? true : false);
+	g_config->setOption("SDL.TraceLogMemAccesses", (logging_options & LOG_MEM_ACCESSES) ? 1 : 0 );
+}
+//----------------------------------------------------
+// The filter settings are compiled when logging starts
+void TraceLoggerDialog_t::filterPcChanged(const QString &txt)
+{
+	g_config->setOption("SDL.TraceLogFilterPC", txt.toStdString() );
+}
+//----------------------------------------------------
+void TraceLoggerDialog_t::filterBanksChanged(const QString &txt)
+{
+	g_config->setOption("SDL.TraceLogFilterBanks", txt.toStdString() );
+}
+//----------------------------------------------------
+void TraceLoggerDialog_t::filterRamStateChanged(int state)
+{
+	g_config->setOption("SDL.TraceLogFilterRamOnly", (state != Qt::Unchecked) ? 1 : 0 );
+}
+//----------------------------------------------------
+void TraceLoggerDialog_t::filterNmiStateChanged(int state)
+{
+	g_config->setOption("SDL.TraceLogFilterNmi", (state != Qt::Unchecked) ? 1 : 0 );
+}
+//----------------------------------------------------
+void TraceLoggerDialog_t::filterIrqStateChanged(int state)
+{
+	g_config->setOption("SDL.TraceLogFilterIrq", (state != Qt::Unchecked) ? 1 : 0 );
+}
+//----------------------------------------------------
+void TraceLoggerDialog_t::memRangesChanged(const QString &txt)
+{
+	// Checked when logging starts
+	g_config->setOption("SDL.TraceLogMemRanges", txt.toStdString() );
+}
+//----------------------------------------------------
 traceRecord_t::traceRecord_t(void)
 {
-	cpu.PC = 0;
-	cpu.A = 0;
-	cpu.X = 0;
-	cpu.Y = 0;
-	cpu.S = 0;
-	cpu.P = 0;
+	init();
+}
+//----------------------------------------------------
+void traceRecord_t::init(void)
+{
+	memset( (void*)this, 0, sizeof(*this) );
 
-	opCode[0] = 0;
-	opCode[1] = 0;
-	opCode[2] = 0;
-	opSize = 0;
-	asmTxtSize = 0;
-	asmTxt[0] = 0;
+	ins.bank = -1;
+	ins.opBank = -1;
+	ins.opBank2 = -1;
+}
+//----------------------------------------------------
+bool traceRecord_t::getCounters(uint64_t &frameCount, uint64_t &cycleCount, uint64_t &instrCount) const
+{
+	uint32_t key = getKey();
 
-	cycleCount = 0;
-	instrCount = 0;
-	flags = 0;
+	if ( ((traceKeySeq.load(std::memory_order_acquire) - key) & traceKeyMask) >= traceKeyLive )
+	{
+		frameCount = cycleCount = instrCount = 0;
+		return false;
+	}
+	const traceKeyframe_t &k = traceKeys[key & 0xFFFF];
 
-	callAddr = -1;
-	romAddr = -1;
-	bank = -1;
-	skippedLines = 0;
+	frameCount = k.frameCount;
+	cycleCount = k.cycleCount + ((flags & (TRACE_REC_BZK | TRACE_REC_MSG)) ? 0 : ins.cycleDelta);
+	instrCount = k.instrCount + instrDelta;
+	return true;
 }
 //----------------------------------------------------
-int traceRecord_t::appendAsmText(const char *txt)
+uint8_t traceRecord_t::getS(void) const
 {
-	size_t len = strlen(txt);
-	memcpy(asmTxt + asmTxtSize, txt, len + 1);
-
-	asmTxtSize += len;
+	if (flags & TRACE_REC_MSG)
+	{
+		return 0;
+	}
+	return (flags & TRACE_REC_BZK) ? bzk.reserved : ins.S;
+}
+//----------------------------------------------------
+void traceRecord_t::setS(uint8_t S)
+{
+	if (flags & TRACE_REC_BZK)
+	{
+		bzk.reserved = S;
+	}
+	else if ( !(flags & TRACE_REC_MSG) )
+	{
+		ins.S = S;
+	}
+}
+//----------------------------------------------------
+int traceRecord_t::getBank(void) const
+{
+	return (flags & (TRACE_REC_BZK | TRACE_REC_MSG)) ? -1 : ins.bank;
+}
+//----------------------------------------------------
+int traceRecord_t::getWriteAddr(uint8_t *preWriteVal) const
+{
+	int addr = -1;
+	uint8_t val = 0;
 
-	return 0;
+	if (flags & TRACE_REC_WRITE)
+	{
+		if (flags & TRACE_REC_BZK)
+		{
+			// Only the file address is kept, it is the CPU address plus 0x100000 below $8000 except for PRG-RAM
+			if (bzk.opAddr >= 0x100000)
+			{
+				addr = bzk.opAddr - 0x100000;
+				val = bzk.opValue;
+			}
+		}
+		else
+		{
+			addr = ins.opAddr;
+			val = ins.opValue;
+		}
+	}
+	if (preWriteVal)
+	{
+		*preWriteVal = val;
+	}
+	return addr;
 }
 //----------------------------------------------------
 int traceRecord_t::convToText(char *txt, int *len)
@@ -952,48 +1333,77 @@ int traceRecord_t::convToText(char *txt, int *len)
 	str_procstatus[0] = 0;
 
 	txt[0] = 0;
-	if (opSize == 0)
+	if (flags & TRACE_REC_MSG)
 	{
-		strcpy(txt, asmTxt);
+		memcpy(txt, msg, sizeof(msg));
+		txt[sizeof(msg)] = 0;
 
+		if (len)
+		{
+			*len = (int)strlen(txt);
+		}
+		return -1;
+	}
+
+	if (flags & TRACE_REC_BZK)
+	{
+		// drop the '\n', callers add their own line ending
+		i = bzkTrace_FormatText(bzk, txt) - 1;
+		txt[i] = '\0';
+
+		if (len)
+		{
+			*len = i;
+		}
+		return 0;
+	}
+
+	// Undefined opcodes make an empty line
+	if (ins.opSize == 0)
+	{
 		return -1;
 	}
 
+	uint64_t frameCount, cycleCount, instrCount;
+
+	// A recycled keyframe would give another frame's counters, leave them out
+	bool haveCounters = getCounters(frameCount, cycleCount, instrCount);
+
 	StringBuilder sb(txt + i);
-	if (skippedLines > 0)
-		sb << '(' << sb_dec(skippedLines) << " lines skipped) ";
+	if (ins.skippedLines > 0)
+		sb << '(' << sb_dec(ins.skippedLines) << " lines skipped) ";
 
 	// Start filling the str_temp line: Frame count, Cycles count, Instructions count, AXYS state, Processor status, Tabs, Address, Data, Disassembly
-	if (logging_options & LOG_FRAMES_COUNT)
+	if (haveCounters && (logging_options & LOG_FRAMES_COUNT))
 		sb << 'f' << sb_dec(frameCount, -6);
 
-	if (logging_options & LOG_CYCLES_COUNT)
+	if (haveCounters && (logging_options & LOG_CYCLES_COUNT))
 		sb << 'c' << sb_dec(cycleCount, -11);
 
-	if (logging_options & LOG_INSTRUCTIONS_COUNT)
+	if (haveCounters && (logging_options & LOG_INSTRUCTIONS_COUNT))
 		sb << 'i' << sb_dec(instrCount, -11);
 
 	if (logging_options & LOG_REGISTERS)
 	{
 		StringBuilder sb(str_axystate);
-		sb << "A:" << sb_hex(cpu.A, 2)
-			<< " X:" << sb_hex(cpu.X, 2)
-			<< " Y:" << sb_hex(cpu.Y, 2)
-			<< " S:" << sb_hex(cpu.S, 2)
+		sb << "A:" << sb_hex(ins.A, 2)
+			<< " X:" << sb_hex(ins.X, 2)
+			<< " Y:" << sb_hex(ins.Y, 2)
+			<< " S:" << sb_hex(ins.S, 2)
 			<< ' ';
 	}
 
 	if (logging_options & LOG_PROCESSOR_STATUS)
 	{
 		char *s = str_procstatus;
-		*(s++) = cpu.P & 0x80 ? 'N' : 'n';
-		*(s++) = cpu.P & 0x40 ? 'V' : 'v';
-		*(s++) = cpu.P & 0x20 ? 'U' : 'u';
-		*(s++) = cpu.P & 0x10 ? 'B' : 'b';
-		*(s++) = cpu.P & 0x08 ? 'D' : 'd';
-		*(s++) = cpu.P & 0x04 ? 'I' : 'i';
-		*(s++) = cpu.P & 0x02 ? 'Z' : 'z';
-		*(s++) = cpu.P & 0x01 ? 'C' : 'c';
+		*(s++) = ins.P & 0x80 ? 'N' : 'n';
+		*(s++) = ins.P & 0x40 ? 'V' : 'v';
+		*(s++) = ins.P & 0x20 ? 'U' : 'u';
+		*(s++) = ins.P & 0x10 ? 'B' : 'b';
+		*(s++) = ins.P & 0x08 ? 'D' : 'd';
+		*(s++) = ins.P & 0x04 ? 'I' : 'i';
+		*(s++) = ins.P & 0x02 ? 'Z' : 'z';
+		*(s++) = ins.P & 0x01 ? 'C' : 'c';
 		*(s++) = ' ';
 		*(s++) = '\0';
 	}
@@ -1009,7 +1419,7 @@ int traceRecord_t::convToText(char *txt, int *len)
 	if (logging_options & LOG_CODE_TABBING)
 	{
 		// add spaces at the beginning of the line according to stack pointer
-		int spaces = (0xFF - cpu.S) & LOG_TABS_MASK;
+		int spaces = (0xFF - ins.S) & LOG_TABS_MASK;
 
 		for (; spaces > 0; spaces--)
 			sb << ' ';
@@ -1019,25 +1429,52 @@ int traceRecord_t::convToText(char *txt, int *len)
 
 	if (logging_options & LOG_BANK_NUMBER)
 	{
-		if (cpu.PC >= 0x8000)
-			sb << sb_addr((uint8_t)bank, 2) << ':';
+		if (PC >= 0x8000)
+			sb << sb_addr((uint8_t)ins.bank, 2) << ':';
 		else
 			sb << "  $";
 	}
 	else
 		sb << '$';
 
-	sb << sb_hex(cpu.PC, 4) << ": ";
+	sb << sb_hex(PC, 4) << ": ";
 
-	for (j = 0; j < opSize; j++)
-		sb << sb_hex(opCode[j], 2) << ' ';
+	for (j = 0; j < ins.opSize; j++)
+		sb << sb_hex(ins.opCode[j], 2) << ' ';
 	for (; j < 3; j++)
 		sb << "   ";
 
-	sb << asmTxt;
+	// Overflowed and undefined opcodes have no disassembly
+	if (!(flags & 0x03))
+	{
+		char asmStr[256];
+		int asmFlags = ASM_DEBUG_TRACES;
+		asmTraceValues_t vals;
+
+		vals.X = ins.X;
+		vals.Y = ins.Y;
+		vals.val = ins.opValue;
+		vals.addr = ins.opAddr;
+		vals.target = ins.opAddr;
+		vals.bank = ins.opBank;
+		vals.bank2 = ins.opBank2;
+		vals.syms = &traceSymbols;
+
+		if (logging_options & LOG_SYMBOLIC)
+		{
+			asmFlags |= ASM_DEBUG_SYMS | ASM_DEBUG_REGS;
+		}
+
+		DisassembleWithDebug(PC + ins.opSize, ins.opCode, asmFlags, asmStr, NULL, NULL, &vals);
+
+		// Long symbol names must leave room for the rest of the line, lines are at most 255 characters
+		asmStr[100] = 0;
+
+		sb << asmStr;
+	}
 
-	if (callAddr >= 0)
-		sb << " (from " << sb_addr((uint16_t)callAddr) << ')';
+	if (flags & TRACE_REC_CALL)
+		sb << " (from " << sb_addr(ins.opAddr) << ')';
 
 	if (!(logging_options & LOG_TO_THE_LEFT))
 	{
@@ -1103,39 +1540,36 @@ void openTraceLoggerWindow(QWidget *parent)
 	traceLogWindow->show();
 }
 //----------------------------------------------------
+// FCEUD_TraceInstruction builds its record in place at recBuf[recBufHead],
+// so only the copy for the disk thread is made here
 static void pushToLogBuffer(traceRecord_t &rec)
 {
-
-	recBuf[recBufHead] = rec;
+	if ( &rec != &recBuf[recBufHead] )
+	{
+		recBuf[recBufHead] = rec;
+	}
 	recBufHead = (recBufHead + 1) % recBufMax;
 
-	if ( recBufNum < recBufMax )
+	// The slot at recBufHead is being filled, and may be left half done by a
+	// filtered out instruction, so it never counts as history
+	if ( recBufNum < recBufMax - 1 )
 	{
 		recBufNum++;
 	}
 
-	if ( logBuf )
+	if ( logRing.getOpen() )
 	{
-		int nextHead, delayCount = 0;
-		logBuf[logBufHead] = rec;
-		nextHead = (logBufHead + 1) % logBufMax;
-
-		while (nextHead == logBufTail)
-		{
-			SDL_Delay(1);
+		// Wait up to 10 seconds for the disk thread, then drop the record
+		traceRecord_t *slot = logRing.claim(10000);
 
-			delayCount++;
+		bool overrun = slot == NULL;
 
-			if ( delayCount > 10000 )
-			{
-				break;
-			}
+		if (slot)
+		{
+			*slot = rec;
+			logRing.commit();
 		}
 
-		bool overrun = nextHead == logBufTail;
-
-		logBufHead = nextHead;
-
 		if ( overrunWarningArmed )
 		{	// Don't spam with buffer overrun warning messages,
 			// we will print once if this happens.
@@ -1156,35 +1590,267 @@ static void pushMsgToLogBuffer(const char *msg)
 {
 	traceRecord_t rec;
 
-	strncpy(rec.asmTxt, msg, sizeof(rec.asmTxt));
+	strncpy(rec.msg, msg, sizeof(rec.msg) - 1);
 
-	rec.asmTxt[sizeof(rec.asmTxt) - 1] = 0;
+	rec.flags = TRACE_REC_MSG;
+	rec.setKey( traceKeySeq.load(std::memory_order_relaxed) );
 
 	pushToLogBuffer(rec);
+
+	// Messages mark the start and end of logging, the disk thread must see them right away
+	if ( logRing.getOpen() )
+	{
+		logRing.publish();
+	}
 }
 //----------------------------------------------------
-int FCEUD_TraceLoggerStart(void)
+// Same place and naming as the default .cdl file
+static int getBzkEdgesFile(std::string &filepath)
 {
-	if ( !logging )
+	const char *romFile;
+	std::string dir, baseFile;
+
+	filepath.clear();
+
+	romFile = getRomFile();
+
+	if (romFile == NULL)
 	{
-		if (recBufMax == 0)
-		{
-			initTraceLogBuffer(1000000);
-		}
-		FCEU_WRAPPER_LOCK();
-		if (traceRegistrationHandle == nullptr)
-		{
-			traceRegistrationHandle = FCEUI_TraceInstructionRegister( FCEUD_TraceInstruction );
-		}
-		logging = 1;
-		FCEU_WRAPPER_UNLOCK();
+		return -1;
 	}
-	return logging;
+
+	parseFilepath(romFile, &dir, &baseFile);
+
+	filepath.assign(dir);
+	filepath.append(baseFile);
+	filepath.append(BZK_EDGES_EXT);
+
+	return 0;
 }
 //----------------------------------------------------
-int FCEUD_TraceLoggerStop(void)
+static void startBzkLogSession(void)
 {
-	if (!logging)
+	// The disk thread and FCEUD_TraceInstruction must agree on the format for the whole session
+	bzkLogMode = logging_options & (LOG_BZK_FORMAT | LOG_BZK_BINARY | LOG_BZK_COMPRESS | LOG_BZK_FOLD | LOG_BZK_EDGES | LOG_BZK_SEGMENTS);
+	bzkPrevAddr = BZK_TRACE_NO_PREV_ADDR;
+	bzkIndexFailed.store(false, std::memory_order_relaxed);
+
+	if ((bzkLogMode & LOG_BZK_FORMAT) && (bzkLogMode & LOG_BZK_EDGES))
+	{
+		std::string path;
+
+		// Coverage accumulates over sessions, a missing file just starts from scratch
+		bzkEdgeSet.clear();
+		if ( getBzkEdgesFile(path) == 0 )
+		{
+			bzkEdgeSet.load( path.c_str() );
+		}
+	}
+}
+//----------------------------------------------------
+// Whatever the options, symbolic output can be turned on while logging
+static void initTraceSymbols(void)
+{
+	traceSymbols.copyFrom( debugSymbolTable );
+}
+//----------------------------------------------------
+static void endBzkLogSession(void)
+{
+	if ((bzkLogMode & LOG_BZK_FORMAT) && (bzkLogMode & LOG_BZK_EDGES))
+	{
+		std::string path;
+
+		if ( (getBzkEdgesFile(path) != 0) || !bzkEdgeSet.save( path.c_str() ) )
+		{
+			char stmp[1024];
+			snprintf( stmp, sizeof(stmp), "Error: Failed to save the edge coverage file: %s", path.c_str() );
+			queueErrorMsg(stmp);
+		}
+	}
+	bzkLogMode = 0;
+}
+//----------------------------------------------------
+// Compiles the capture filter from the config, while no instruction is being traced
+static void initTraceFilter(void)
+{
+	std::string txt;
+	int opt;
+	unsigned int intMask = 0;
+
+	g_config->getOption("SDL.TraceLogFilterPC", &txt);
+	if ( !traceFilter.setPcRanges( txt.c_str() ) )
+	{
+		char stmp[1024];
+		snprintf( stmp, sizeof(stmp), "Error: Invalid trace filter addresses, logging all of them: %s", txt.c_str() );
+		queueErrorMsg(stmp);
+	}
+	g_config->getOption("SDL.TraceLogFilterBanks", &txt);
+	if ( !traceFilter.setBanks( txt.c_str() ) )
+	{
+		char stmp[1024];
+		snprintf( stmp, sizeof(stmp), "Error: Invalid trace filter banks, logging all of them: %s", txt.c_str() );
+		queueErrorMsg(stmp);
+	}
+	g_config->getOption("SDL.TraceLogFilterRamOnly", &opt);
+	traceFilter.setRamOnly( opt ? true : false );
+
+	g_config->getOption("SDL.TraceLogFilterNmi", &opt);
+	if (opt)
+	{
+		intMask |= TraceFilter::IntNmi;
+	}
+	g_config->getOption("SDL.TraceLogFilterIrq", &opt);
+	if (opt)
+	{
+		intMask |= TraceFilter::IntIrq;
+	}
+	traceFilter.setInterrupts( intMask );
+
+	traceFilter.compile();
+}
+//----------------------------------------------------
+static void pushMemAccess(const traceMemAccess_t &acc)
+{
+	// Wait up to 10 seconds for the disk thread, then drop the access
+	traceMemAccess_t *slot = memRing.claim(10000);
+
+	if (slot)
+	{
+		*slot = acc;
+		memRing.commit();
+	}
+	else if ( overrunWarningArmed )
+	{
+		printf("Memory Trace Overrun!!!\n");
+		overrunWarningArmed = false;
+	}
+}
+//----------------------------------------------------
+// The access is held back one call, so the exec hook that comes after an opcode fetch can mark it
+static inline void recordMemAccess(unsigned int address, unsigned int value, uint8 kind)
+{
+	if ( !memFilter.match(address) )
+	{
+		return;
+	}
+	if ( memPendingValid )
+	{
+		pushMemAccess(memPending);
+	}
+	memPending.cycle = timestampbase + (uint64)timestamp - total_cycles_base;
+	memPending.addr  = address;
+	memPending.pc    = memTracePC;
+	memPending.value = value;
+	memPending.kind  = kind;
+	memPendingValid  = true;
+}
+//----------------------------------------------------
+static void memReadHook(unsigned int address, unsigned int value, void *userData)
+{
+	recordMemAccess(address, value, TRACE_MEM_READ);
+}
+//----------------------------------------------------
+static void memWriteHook(unsigned int address, unsigned int value, void *userData)
+{
+	recordMemAccess(address, value, TRACE_MEM_WRITE);
+}
+//----------------------------------------------------
+static void memExecHook(unsigned int address, unsigned int value, void *userData)
+{
+	memTracePC = address;
+
+	// The opcode was the last read, unless the filter dropped it
+	if ( memPendingValid && (memPending.kind == TRACE_MEM_READ) && (memPending.addr == address) )
+	{
+		memPending.kind = TRACE_MEM_EXEC;
+		memPending.pc   = address;
+	}
+}
+//----------------------------------------------------
+// Opens the ring for the disk thread if LOG_MEM_ACCESSES is set, before the thread starts
+static bool startMemTraceSession(void)
+{
+	std::string ranges;
+
+	if ( !(logging_options & LOG_MEM_ACCESSES) )
+	{
+		return false;
+	}
+	g_config->getOption("SDL.TraceLogMemRanges", &ranges);
+
+	if ( !memFilter.parse( ranges.c_str() ) )
+	{
+		char stmp[1024];
+		snprintf( stmp, sizeof(stmp), "Error: Invalid memory trace addresses, logging all of them: %s", ranges.c_str() );
+		queueErrorMsg(stmp);
+	}
+	memPendingValid = false;
+	memTracePC = X.PC;
+
+	memset( &memPending, 0, sizeof(memPending) );
+
+	if ( !memRing.open(memBufMax) )
+	{
+		queueErrorMsg("Error: Failed to allocate the memory trace buffer");
+		return false;
+	}
+	return true;
+}
+//----------------------------------------------------
+// Called with logging turned on and off, the core only pays for the hooks while they are registered
+static void setMemTraceHooks(bool enable)
+{
+	if ( enable && !memHooksOn && memRing.getOpen() )
+	{
+		X6502_MemHook::Add( X6502_MemHook::Read , memReadHook  );
+		X6502_MemHook::Add( X6502_MemHook::Write, memWriteHook );
+		X6502_MemHook::Add( X6502_MemHook::Exec , memExecHook  );
+		memHooksOn = true;
+	}
+	else if ( !enable && memHooksOn )
+	{
+		X6502_MemHook::Remove( X6502_MemHook::Read , memReadHook  );
+		X6502_MemHook::Remove( X6502_MemHook::Write, memWriteHook );
+		X6502_MemHook::Remove( X6502_MemHook::Exec , memExecHook  );
+		memHooksOn = false;
+
+		if ( memPendingValid )
+		{
+			pushMemAccess(memPending);
+			memPendingValid = false;
+		}
+		if ( memRing.getOpen() )
+		{
+			memRing.publish();
+		}
+	}
+}
+//----------------------------------------------------
+int FCEUD_TraceLoggerStart(void)
+{
+	if ( !logging )
+	{
+		if (recBufMax == 0)
+		{
+			initTraceLogBuffer(1000000);
+		}
+		startBzkLogSession();
+		initTraceFilter();
+		initTraceSymbols();
+		FCEU_WRAPPER_LOCK();
+		if (traceRegistrationHandle == nullptr)
+		{
+			traceRegistrationHandle = FCEUI_TraceInstructionRegister( FCEUD_TraceInstruction );
+		}
+		logging = 1;
+		FCEU_WRAPPER_UNLOCK();
+	}
+	return logging;
+}
+//----------------------------------------------------
+int FCEUD_TraceLoggerStop(void)
+{
+	if (!logging)
 	{
 		return 0;
 	}
@@ -1194,9 +1860,11 @@ int FCEUD_TraceLoggerStop(void)
 	}
 	else
 	{
+		FCEU_WRAPPER_LOCK();
 		logging = 0;
-		msleep(1);
 		pushMsgToLogBuffer("Logging Finished");
+		setMemTraceHooks(false);
+		FCEU_WRAPPER_UNLOCK();
 	}
 	FCEU_WRAPPER_LOCK();
 	if (traceRegistrationHandle != nullptr)
@@ -1209,6 +1877,7 @@ int FCEUD_TraceLoggerStop(void)
 
 	}
 	FCEU_WRAPPER_UNLOCK();
+	endBzkLogSession();
 	return logging;
 }
 //----------------------------------------------------
@@ -1216,65 +1885,132 @@ int FCEUD_TraceLoggerRunning(void)
 {
 	return logging;
 }
-
-void FCEUD_FlushTrace()
+//----------------------------------------------------
+// The trace logger settings from the config, with the format replaced by a TRACE_BATCH_* one
+static void initBatchLogOptions(int format)
 {
-	//not needed, since it's doing something in a thread, i guess.
-	//seems weird that there's no way to rendezvous with it
-}
+	initLogOptions();
 
+	switch (format)
+	{
+		case TRACE_BATCH_TEXT:
+			logging_options &= ~LOG_BZK_FORMAT;
+		break;
+		case TRACE_BATCH_BZK:
+			logging_options |= LOG_BZK_FORMAT;
+			logging_options &= ~LOG_BZK_BINARY;
+		break;
+		case TRACE_BATCH_BZK_BINARY:
+			logging_options |= LOG_BZK_FORMAT | LOG_BZK_BINARY;
+		break;
+		case TRACE_BATCH_BZK_PART:
+			logging_options |= LOG_BZK_FORMAT | LOG_BZK_BINARY;
+			logging_options &= ~(LOG_BZK_COMPRESS | LOG_BZK_FOLD | LOG_BZK_EDGES | LOG_BZK_SEGMENTS);
+		break;
+		default:
+		break;
+	}
+}
 //----------------------------------------------------
-void FCEUD_TraceInstruction(uint8 *opcode, int size)
+int traceLoggerBatchStart(const char *path, int format)
 {
-	if (NetPlayActive())
+	if ( logging || (batchDiskThread != NULL) )
 	{
-		NetPlayTraceInstruction(opcode, size);
+		return -1;
 	}
+	initBatchLogOptions(format);
 
-	if (!logging)
-		return;
+	logFilePath.assign(path);
+	overrunWarningArmed = true;
 
-	traceRecord_t rec;
+	// Only the disk thread reads the records, the history just has to hold the one being built
+	if ( (recBufMax == 0) && initTraceLogBuffer(65536) )
+	{
+		queueErrorMsg("Error: Failed to allocate the trace log buffer");
+		return -1;
+	}
+	startBzkLogSession();
+	initTraceFilter();
+	initTraceSymbols();
 
-	char asmTxt[256];
-	unsigned int addr = X.PC;
-	static int unloggedlines = 0;
-	int asmFlags = ASM_DEBUG_TRACES;
+	if ( !logRing.open(logBufMax) )
+	{
+		queueErrorMsg("Error: Failed to allocate the trace log disk buffer");
+		endBzkLogSession();
+		return -1;
+	}
+	startMemTraceSession();
+
+	batchDiskThread = new TraceLogDiskThread_t(NULL);
+	batchDiskThread->start();
 
-	rec.cpu.PC = X.PC;
-	rec.cpu.A = X.A;
-	rec.cpu.X = X.X;
-	rec.cpu.Y = X.Y;
-	rec.cpu.S = X.S;
-	rec.cpu.P = X.P;
+	// The caller runs the emulation, there is no emulation thread to lock out
+	pushMsgToLogBuffer("Log Start");
 
-	for (int i = 0; i < size; i++)
+	traceRegistrationHandle = FCEUI_TraceInstructionRegister( FCEUD_TraceInstruction );
+	logging = 1;
+	setMemTraceHooks(true);
+
+	return 0;
+}
+//----------------------------------------------------
+int traceLoggerBatchStop(void)
+{
+	if (batchDiskThread == NULL)
 	{
-		rec.opCode[i] = opcode[i];
+		return -1;
 	}
-	rec.opSize = size;
-	rec.romAddr = GetPRGAddress(addr);
-	rec.bank = getBank(addr);
+	// The disk thread only closes the ring by itself when it couldn't open the files
+	bool diskThreadRan = logRing.getOpen();
 
-	rec.frameCount = currFrameCounter;
-	rec.instrCount = total_instructions;
+	logging = 0;
+	pushMsgToLogBuffer("Logging Finished");
+	setMemTraceHooks(false);
 
-	int64 counter_value = timestampbase + (uint64)timestamp - total_cycles_base;
-	if (counter_value < 0) // sanity check
+	if (traceRegistrationHandle != nullptr)
 	{
-		ResetDebugStatisticsCounters();
-		counter_value = 0;
+		FCEUI_TraceInstructionUnregisterHandle( traceRegistrationHandle );
+		traceRegistrationHandle = nullptr;
 	}
-	rec.cycleCount = counter_value;
 
-	if (logging_options & LOG_SYMBOLIC)
+	batchDiskThread->requestInterruption();
+	logRing.wakeAll();
+	batchDiskThread->wait();
+
+	delete batchDiskThread;
+	batchDiskThread = NULL;
+
+	endBzkLogSession();
+
+	return diskThreadRan ? 0 : -1;
+}
+
+void FCEUD_FlushTrace()
+{
+	// Called once a frame and when emulation pauses, hands the partial batch to the disk thread
+	if ( logRing.getOpen() )
+	{
+		logRing.publish();
+	}
+	if ( memRing.getOpen() )
 	{
-		asmFlags |= ASM_DEBUG_SYMS | ASM_DEBUG_REGS;
+		memRing.publish();
 	}
+}
+
+//----------------------------------------------------
+// Applies the Code/Data Logger filters and saves what only the running
+// emulator knows. The text is made later by convToText, on the disk thread
+// and for the visible rows of the window. Returns non-zero when the
+// instruction is filtered out.
+static int traceDisassemble(traceRecord_t &rec, const opcodeinfo *op, int size)
+{
+	unsigned int addr = rec.PC;
+	static int unloggedlines = 0;
 
 	// if instruction executed from the RAM, skip this, log all instead
 	// TODO: loops folding mame-lyke style
-	if (rec.romAddr != -1)
+	if (GetPRGAddress(addr) != -1)
 	{
 		if (((logging_options & LOG_NEW_INSTRUCTIONS) && (oldcodecount != codecount)) ||
 			((logging_options & LOG_NEW_DATA) && (olddatacount != datacount)))
@@ -1285,7 +2021,7 @@ void FCEUD_TraceInstruction(uint8 *opcode, int size)
 			if (unloggedlines > 0)
 			{
 				//snprintf(str_result, "(%d lines skipped)", unloggedlines);
-				rec.skippedLines = unloggedlines;
+				rec.ins.skippedLines = unloggedlines;
 				unloggedlines = 0;
 			}
 		}
@@ -1298,112 +2034,179 @@ void FCEUD_TraceInstruction(uint8 *opcode, int size)
 				{
 					unloggedlines++;
 				}
-				return;
+				return -1;
 			}
 		}
 	}
 
+	// The decoder already followed the pointers of the operand
+	if (op->opcode[0] == 0x6C)
+	{
+		rec.ins.opAddr = op->target;
+	}
+	else
+	{
+		rec.ins.opAddr = op->A;
+
+		// JSR and JMP only show their target
+		if (op->mode && !(op->flow & OPFLOW_JUMP))
+		{
+			rec.ins.opValue = GetMem(op->A);
+		}
+	}
+
+	// Banks for the symbols, the line is made after the mapper may have switched them.
+	// Taken whatever the options, renderer threads must never call getBank themselves.
+	int symAddr  = (op->flow & OPFLOW_BRANCH) ? op->target : op->A;
+	int symAddr2 = -1;
+
+	if (op->opcode[0] == 0x6C)
+	{
+		symAddr  = op->opcode[1] | (op->opcode[2] << 8);
+		symAddr2 = op->target;
+	}
+	else if ((op->mode == 6) || (op->mode == 7))
+	{
+		// base of abs,Y and abs,X
+		symAddr2 = op->opcode[1] | (op->opcode[2] << 8);
+	}
+	if (symAddr >= 0x8000)
+	{
+		rec.ins.opBank = getBank(symAddr);
+	}
+	if (symAddr2 >= 0x8000)
+	{
+		rec.ins.opBank2 = getBank(symAddr2);
+	}
+
 	if ((addr + size) > 0xFFFF)
 	{
 		//snprintf(str_data, "%02X        ", opcode[0]);
 		//snprintf(str_disassembly, "OVERFLOW");
 		rec.flags |= 0x01;
+		return 0;
 	}
-	else
+	if (size == 0)
 	{
-		char *a = 0;
-		switch (size)
-		{
-		case 0:
-			//snprintf(str_disassembly,"UNDEFINED");
-			rec.flags |= 0x02;
-			break;
-		case 1:
-		{
-			DisassembleWithDebug(addr + 1, opcode, asmFlags, asmTxt);
-			// special case: an RTS opcode
-			if (opcode[0] == 0x60)
-			{
-				// add the beginning address of the subroutine that we exit from
-				unsigned int caller_addr = GetMem(((X.S) + 1) | 0x0100) + (GetMem(((X.S) + 2) | 0x0100) << 8) - 0x2;
-				if (GetMem(caller_addr) == 0x20)
-				{
-					// this was a JSR instruction - take the subroutine address from it
-					unsigned int call_addr = GetMem(caller_addr + 1) + (GetMem(caller_addr + 2) << 8);
-					rec.callAddr = call_addr;
-				}
-			}
-			a = asmTxt;
-			break;
-		}
-		case 2:
-			DisassembleWithDebug(addr + 2, opcode, asmFlags, asmTxt);
-			a = asmTxt;
-			break;
-		case 3:
-			DisassembleWithDebug(addr + 3, opcode, asmFlags, asmTxt);
-			a = asmTxt;
-			break;
-		}
+		//snprintf(str_disassembly,"UNDEFINED");
+		rec.flags |= 0x02;
+		return 0;
+	}
 
-		if (a)
+	// special case: an RTS opcode
+	if (op->opcode[0] == 0x60)
+	{
+		// add the beginning address of the subroutine that we exit from
+		unsigned int caller_addr = GetMem(((X.S) + 1) | 0x0100) + (GetMem(((X.S) + 2) | 0x0100) << 8) - 0x2;
+		if (GetMem(caller_addr) == 0x20)
 		{
-			rec.appendAsmText(a);
+			// this was a JSR instruction - take the subroutine address from it
+			unsigned int call_addr = GetMem(caller_addr + 1) + (GetMem(caller_addr + 2) << 8);
+			rec.ins.opAddr = call_addr;
+			rec.flags |= TRACE_REC_CALL;
 		}
 	}
 
-	switch ( opcode[0] )
+	return 0;
+}
+//----------------------------------------------------
+void FCEUD_TraceInstruction(uint8 *opcode, int size)
+{
+	if (NetPlayActive())
 	{
-		// Zero page
-		case 0x85: // STA - Store Accumulator
-		case 0x86: // STX - Store X Register
-		case 0x84: // STY - Store Y Register
-		case 0xC6: // DEC - Decrement Memory
-		case 0xE6: // INC - Increment Memory
-			rec.writeAddr = opcode[1];
-		break;
-		// Absolute
-		case 0x8D: // STA - Store Accumulator
-		case 0x8E: // STX - Store X Register
-		case 0x8C: // STY - Store Y Register
-		case 0xCE: // DEC - Decrement Memory
-		case 0xEE: // INC - Increment Memory
-			rec.writeAddr = opcode[1] | opcode[2] << 8;
-		break;
-		// Indirect X
-		case 0x81: // STA - Store A Register
-			rec.writeAddr = (opcode[1] + X.X) & 0xFF;
-			rec.writeAddr = GetMem((rec.writeAddr)) | (GetMem(((rec.writeAddr)+1)&0xff))<<8;
-		break;
-		// Indirect Y
-		case 0x91: // STA - Store A Register
-			rec.writeAddr  = GetMem(opcode[1]) | (GetMem((opcode[1]+1)&0xff))<<8;
-			rec.writeAddr += X.Y;
-		break;
-		// Zero Page X
-		case 0x95: // STA - Store Accumulator
-		case 0x94: // STY - Store Y Register
-		case 0xD6: // DEC - Decrement Memory
-		case 0xF6: // INC - Increment Memory
-			rec.writeAddr = (opcode[1]+ X.X) & 0xFF;
-		break;
-		// Zero Page Y
-		case 0x96: // STX - Store X Register
-			rec.writeAddr = (opcode[1]+ X.Y) & 0xFF;
-		break;
-		default:
-			rec.writeAddr = -1;
-		break;
+		NetPlayTraceInstruction(opcode, size);
+	}
+
+	if (!logging)
+		return;
+
+	if ( !traceFilter.pass(X.PC) )
+	{
+		// The next logged instruction doesn't follow the last one
+		bzkPrevAddr = BZK_TRACE_NO_PREV_ADDR;
+		return;
+	}
+
+	// Built in place, pushToLogBuffer only commits it
+	traceRecord_t &rec = recBuf[recBufHead];
+
+	rec.init();
+
+	int64 counter_value = timestampbase + (uint64)timestamp - total_cycles_base;
+	if (counter_value < 0) // sanity check
+	{
+		ResetDebugStatisticsCounters();
+		counter_value = 0;
+	}
+	uint64 cycleCount = counter_value;
+
+	// New keyframe for every frame, and when the counters were reset or a delta doesn't fit
+	uint32_t keySeq = traceKeySeq.load(std::memory_order_relaxed);
+	traceKeyframe_t *key = &traceKeys[keySeq & 0xFFFF];
+
+	if ( !traceKeyValid || (key->frameCount != currFrameCounter) ||
+		(cycleCount < key->cycleCount) || (cycleCount - key->cycleCount > 0xFFFF) ||
+		(total_instructions < key->instrCount) || (total_instructions - key->instrCount > 0xFFFF) )
+	{
+		keySeq = (keySeq + 1) & traceKeyMask;
+		key = &traceKeys[keySeq & 0xFFFF];
+		key->frameCount = currFrameCounter;
+		key->cycleCount = cycleCount;
+		key->instrCount = total_instructions;
+		traceKeySeq.store(keySeq, std::memory_order_release);
+		traceKeyValid = true;
 	}
+	rec.setKey(keySeq);
+	rec.instrDelta = (uint16_t)(total_instructions - key->instrCount);
 
-	if ( rec.writeAddr >= 0 )
+	rec.PC = X.PC;
+
+	if (opwrite[opcode[0]] && debugInstruction.mode)
+	{
+		rec.flags |= TRACE_REC_WRITE;
+	}
+
+	if (bzkLogMode & LOG_BZK_FORMAT)
 	{
-		rec.preWriteVal = GetMem( rec.writeAddr );
+		// Only the raw BZK columns are needed, the disk thread formats them
+		bzk_CaptureRecord(&rec.bzk, bzkPrevAddr, &debugInstruction);
+		bzkPrevAddr = rec.bzk.romAddr;
+		rec.flags |= TRACE_REC_BZK;
+
+		// Only the index uses it, which the disk thread writes
+		if ( logRing.getOpen() && !bzkIndexFailed.load(std::memory_order_relaxed) && bzk_IsNmiEntry() )
+		{
+			rec.flags |= TRACE_REC_NMI;
+		}
+
+		if ( (bzkLogMode & LOG_BZK_EDGES) && !bzkEdgeSet.insert(rec.bzk) )
+		{
+			return;
+		}
 	}
 	else
 	{
-		rec.preWriteVal = 0;
+		rec.ins.A = X.A;
+		rec.ins.X = X.X;
+		rec.ins.Y = X.Y;
+		rec.ins.P = X.P;
+
+		for (int i = 0; i < size; i++)
+		{
+			rec.ins.opCode[i] = opcode[i];
+		}
+		rec.ins.opSize = size;
+		rec.ins.bank = getBank(X.PC);
+		rec.ins.cycleDelta = (uint16_t)(cycleCount - key->cycleCount);
+
+		// Also reads the byte a write instruction changes, for undo
+		if (traceDisassemble(rec, &debugInstruction, size))
+		{
+			return;
+		}
 	}
+	// After the edge check, bzk.reserved holds it
+	rec.setS(X.S);
 
 	pushToLogBuffer(rec);
 
@@ -1996,9 +2799,9 @@ void QTraceLogView::openBpEditWindow(int editIdx, watchpointinfo *wp, traceRecor
 				if (wp->address >= 0x8000)
 				{
 					char str[64];
-					if ((wp->address == recp->cpu.PC) && (recp->bank >= 0))
+					if ((wp->address == recp->PC) && (recp->getBank() >= 0))
 					{
-						snprintf(str, sizeof(str), "K==#%02X", recp->bank);
+						snprintf(str, sizeof(str), "K==#%02X", recp->getBank());
 					}
 					else
 					{
@@ -2163,9 +2966,9 @@ void QTraceLogView::ctxMenuAddSym(void)
 	{
 		if (recp != NULL)
 		{
-			if ((addr == recp->cpu.PC) && (recp->bank >= 0))
+			if ((addr == recp->PC) && (recp->getBank() >= 0))
 			{
-				bank = recp->bank;
+				bank = recp->getBank();
 			}
 			else
 			{
@@ -2419,161 +3222,782 @@ TraceLogDiskThread_t::TraceLogDiskThread_t( QObject *parent )
 TraceLogDiskThread_t::~TraceLogDiskThread_t(void)
 {
 	//printf("Disk Thread Cleanup\n");
-#ifdef WIN32
-	if (logFile != INVALID_HANDLE_VALUE)
+
+	logRing.close();
+	logRing.freeBuffer();
+}
+//----------------------------------------------------
+// BZK mode output, z%05d.log (or .bzk, .gz) files next to the selected log file.
+// A full file is renamed to z%05d_fceux.log and the next index is opened,
+// same naming as the Windows trace logger.
+// With segments, the files are memory mapped z%05d_fceux.log (or .bzk) of a fixed size
+// instead, listed in zsegments.idx (see TraceSegmentWriter), and never compressed.
+// Loop folding only applies to binary records, the text format has no repeat line.
+// ztrace.idx in the same folder records where every frame and NMI handler starts (see TraceIndexWriter).
+class bzkLogFiles_t
+{
+public:
+	bzkLogFiles_t(const std::string &logPath, bool binary, bool compress, bool fold, bool segments, bool edges)
+		: fileIdx(0), lineCount(0), isBinary(binary), isCompressed(compress && !segments),
+		  isFolded(binary && fold), isSegmented(segments), isEdges(edges), wasPaused(false)
 	{
-		CloseHandle( logFile );
-		logFile = INVALID_HANDLE_VALUE;
+		getDirFromFile( logPath.c_str(), dir );
+
+		if ( dir.size() > 0 )
+		{
+			dir.append("/");
+		}
+		if (isCompressed)
+		{
+			ext = isBinary ? "bzk.gz" : "log.gz";
+		}
+		else
+		{
+			ext = isBinary ? "bzk" : "log";
+		}
+
+		// Continue after the last completed file of a previous session,
+		// the segment index already knows the next number
+		for (int k = isSegmented ? -1 : 99999; k >= 0; k--)
+		{
+			if ( QFile::exists( QString::fromStdString( fileName(k, true) ) ) )
+			{
+				fileIdx = (k + 1) % 100000;
+				break;
+			}
+		}
 	}
-#else
-	if ( logFile != -1 )
+
+	// frame and instr are the counters of the first instruction, for the segment index
+	bool open(bool isPaused, uint32 frame, uint64 instr)
 	{
-		close(logFile); logFile = -1;
+		lineCount = 0;
+		wasPaused = isPaused;
+
+		if (isSegmented)
+		{
+			if ( !segments.open( dir, ext, isBinary, isPaused, frame, instr ) )
+			{
+				return false;
+			}
+			fileIdx = segments.getFileIdx();
+		}
+		else
+		{
+			std::string name = fileName(fileIdx, false);
+
+			if ( !(isCompressed ? zfile.open( name.c_str(), isPaused ) : file.open( name.c_str(), isPaused )) )
+			{
+				return false;
+			}
+		}
+		return beginFile();
+	}
+
+	// Once for the logging session, the files are still usable without the index
+	bool openIndex(bool isPaused)
+	{
+		unsigned int flags = (isBinary ? BZK_INDEX_BINARY : 0) | (isCompressed ? BZK_INDEX_COMPRESSED : 0) |
+				(isFolded ? BZK_INDEX_FOLDED : 0) | (isEdges ? BZK_INDEX_EDGES : 0);
+
+		return index.open( dir, flags, isPaused );
 	}
-#endif
 
-	if ( logBuf )
+	bool write(traceRecord_t &rec, bool isPaused)
 	{
-		free(logBuf);
-		logBuf = NULL;
+		uint64_t frameCount, cycleCount, instrCount;
+
+		rec.getCounters(frameCount, cycleCount, instrCount);
+
+		// S rides in the reserved byte while the record is buffered, the files keep it 0
+		bzkTraceRecord_t bzk = rec.bzk;
+
+		bzk.reserved = 0;
+
+		return write( bzk, (uint32)frameCount, instrCount, (rec.flags & TRACE_REC_NMI) ? true : false, isPaused );
 	}
+
+	// Same with the counters given, for the parts of a parallel capture (see traceLoggerBatchStitch)
+	bool write(const bzkTraceRecord_t &bzk, uint32 frame, uint64 instr, bool isNmi, bool isPaused)
+	{
+		bool success = true;
+
+		// Checked before writing, so the index gets the counters of the segment's first instruction
+		if ( isSegmented && segments.isFull() )
+		{
+			success = flushFolder();
+			success = segments.nextSegment( frame, instr ) && beginFile() && success;
+			fileIdx = segments.getFileIdx();
+		}
+
+		if ( index.isIndexPoint( frame, isNmi ) )
+		{
+			// The entry points at this record, so nothing before it may be held back or repeated after it
+			success = flushFolder() && success;
+			folder.reset();
+			index.add( fileIdx, offset(), frame, instr, isNmi );
+		}
+
+		if (isFolded)
+		{
+			bzkTraceRecord_t recs[BZK_TRACE_FOLD_MAX_OUT];
+
+			success = writeRecords( recs, folder.add( bzk, recs ) ) && success;
+		}
+		else if (isBinary)
+		{
+			success = writeRecords( &bzk, 1 ) && success;
+		}
+		else
+		{
+			char line[BZK_TRACE_TEXT_MAX_LEN];
+
+			// drop the '\n', write adds the line ending
+			int len = bzkTrace_FormatText( bzk, line ) - 1;
+
+			success = write( line, len, true ) && success;
+			lineCount++;
+		}
+
+		// Folding writes several records at once, so the count can step over the limit
+		if ( !isSegmented && (lineCount >= BZK_TRACE_LINES_PER_FILE) )
+		{
+			close();
+			fileIdx = (fileIdx + 1) % 100000;
+			success = open(isPaused, frame, instr) && success;
+		}
+		return success;
+	}
+
+	bool setPause(bool isPaused)
+	{
+		bool success = true;
+
+		// Games usually pause in a wait loop, end it so the repeat record makes it into the file
+		if (isPaused && !wasPaused)
+		{
+			success = flushFolder();
+		}
+		wasPaused = isPaused;
+
+		index.setPause(isPaused);
+
+		if (isSegmented)
+		{
+			return segments.setPause(isPaused) && success;
+		}
+		return (isCompressed ? zfile.setPause(isPaused) : file.setPause(isPaused)) && success;
+	}
+
+	void close(void)
+	{
+		std::string doneName = fileName(fileIdx, true);
+
+		flushFolder();
+
+		if (isSegmented)
+		{
+			// Segments have their final name from the start
+			segments.close();
+			return;
+		}
+		else if (isCompressed)
+		{
+			zfile.close();
+		}
+		else
+		{
+			file.close();
+		}
+
+		remove( doneName.c_str() );
+		rename( fileName(fileIdx, false).c_str(), doneName.c_str() );
+	}
+
+	std::string currentFileName(void)
+	{
+		return fileName(fileIdx, isSegmented);
+	}
+
+private:
+	// A new file or segment, the folder must not refer to records of the previous one
+	bool beginFile(void)
+	{
+		folder.reset();
+
+		if (isBinary)
+		{
+			bzkTraceHeader_t hdr;
+
+			bzkTrace_InitHeader(&hdr);
+
+			return write( &hdr, sizeof(hdr) );
+		}
+		return true;
+	}
+
+	std::string fileName(int idx, bool done)
+	{
+		char stmp[64];
+
+		snprintf( stmp, sizeof(stmp), done ? "z%05d_fceux.%s" : "z%05d.%s", idx, ext );
+
+		return dir + stmp;
+	}
+
+	bool write(const void *data, size_t size, bool addEol = false)
+	{
+		if (isSegmented)
+		{
+			return segments.write( data, size, addEol );
+		}
+		return isCompressed ? zfile.write( data, size, addEol ) : file.write( data, size, addEol );
+	}
+
+	// Bytes of the current file so far, before compression
+	uint64_t offset(void)
+	{
+		if (isSegmented)
+		{
+			return segments.getOffset();
+		}
+		return isCompressed ? zfile.getOffset() : file.getOffset();
+	}
+
+	bool writeRecords(const bzkTraceRecord_t *recs, int count)
+	{
+		bool success = true;
+
+		for (int i = 0; i < count; i++)
+		{
+			success = write( &recs[i], sizeof(recs[i]) ) && success;
+		}
+		lineCount += count;
+
+		return success;
+	}
+
+	bool flushFolder(void)
+	{
+		bzkTraceRecord_t recs[BZK_TRACE_FOLD_MAX_OUT];
+
+		return isFolded ? writeRecords( recs, folder.flush(recs) ) : true;
+	}
+
+	TraceFileWriter file;
+	TraceFileCompressor zfile;
+	TraceSegmentWriter segments;
+	TraceIndexWriter index;
+	bzkTraceFolder_t folder;
+	std::string dir;
+	const char *ext;
+	int fileIdx;
+	unsigned int lineCount;
+	bool isBinary;
+	bool isCompressed;
+	bool isFolded;
+	bool isSegmented;
+	bool isEdges;
+	bool wasPaused;
+};
+//----------------------------------------------------
+// Runs on the renderer threads, convToText only reads the record and the options
+static int formatTraceRecord(traceRecord_t &rec, char *line)
+{
+	int len = 0;
+
+	rec.convToText(line, &len);
+
+	return len;
+}
+//----------------------------------------------------
+// TraceFileWriter takes at most BlockSize bytes per write
+static bool writeTraceText(TraceFileWriter &tracer, const char *txt, size_t size)
+{
+	bool success = true;
+
+	while (size > 0)
+	{
+		size_t n = size < TraceFileWriter::BlockSize ? size : TraceFileWriter::BlockSize;
+
+		success = tracer.write(txt, n) && success;
+		txt += n;
+		size -= n;
+	}
+	return success;
 }
 //----------------------------------------------------
 void TraceLogDiskThread_t::run(void)
 {
-	char line[256];
-	const unsigned blockSize = 4 * 1024;
-	bool dataNeedsFlush = true;
+	const size_t chunkRecs = 4096;
 	bool isPaused = false;
+	traceRecord_t *recs;
+	size_t numRecs;
+	TraceFileWriter tracer;
+	TraceTextRenderer<traceRecord_t> renderer;
+	bzkLogFiles_t *bzkFiles = NULL;
+	TraceFileWriter memTracer;
+	traceMemAccess_t *accs;
+	size_t numAccs;
 
 	//printf("Trace Log Disk Start\n");
 
 	setPriority( QThread::HighestPriority );
 
-#ifdef WIN32
-	TraceFileWriter tracer;
-	if (!tracer.open(logFilePath.c_str(), (bool)FCEUI_EmulationPaused()))
+	isPaused = FCEUI_EmulationPaused() ? true : false;
+
+	if (bzkLogMode & LOG_BZK_FORMAT)
 	{
-		char stmp[1024];
-		snprintf( stmp, sizeof(stmp), "Error: Failed to open log file for writing: %s", logFilePath.c_str() );
-		consoleWindow->QueueErrorMsgWindow(stmp);
-		return;
-	}
-#else
-	const unsigned bufSize = blockSize * 2;
-	const unsigned flushSize = blockSize;
-	char buf[bufSize];
-	unsigned int i, idx=0;
+		bzkFiles = new bzkLogFiles_t( logFilePath, (bzkLogMode & LOG_BZK_BINARY) ? true : false,
+				(bzkLogMode & LOG_BZK_COMPRESS) ? true : false, (bzkLogMode & LOG_BZK_FOLD) ? true : false,
+				(bzkLogMode & LOG_BZK_SEGMENTS) ? true : false, (bzkLogMode & LOG_BZK_EDGES) ? true : false );
 
-	logFile = open( logFilePath.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 
-			S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH );
+		// Logging has just started, the next traced instruction is the current one
+		if ( !bzkFiles->open(isPaused, (uint32)currFrameCounter, total_instructions) )
+		{
+			char stmp[1024];
+			snprintf( stmp, sizeof(stmp), "Error: Failed to open log file for writing: %s", bzkFiles->currentFileName().c_str() );
+			queueErrorMsg(stmp);
+			delete bzkFiles;
+			logRing.close();
+			memRing.close();
+			return;
+		}
 
-	if ( logFile == -1 )
+		if ( !bzkFiles->openIndex(isPaused) )
+		{
+			printf("Failed to open %s, logging without an index\n", BZK_TRACE_INDEX_NAME);
+			bzkIndexFailed.store(true, std::memory_order_relaxed);
+		}
+	}
+	else if (!tracer.open(logFilePath.c_str(), isPaused))
 	{
 		char stmp[1024];
 		snprintf( stmp, sizeof(stmp), "Error: Failed to open log file for writing: %s", logFilePath.c_str() );
-		consoleWindow->QueueErrorMsgWindow(stmp);
+		queueErrorMsg(stmp);
+		logRing.close();
+		memRing.close();
 		return;
 	}
-#endif
-	if ( logBuf == NULL )
+	else
 	{
-		size_t size;
+		// Symbolic lines with every column are too slow to format on one thread
+		renderer.start( formatTraceRecord, chunkRecs );
+	}
 
-		size = logBufMax * sizeof(traceRecord_t);
+	if ( memRing.getOpen() )
+	{
+		std::string memPath = logFilePath + TRACE_MEM_EXT;
+		traceMemHeader_t hdr;
 
-		logBufHead = logBufTail = 0;
+		traceMem_InitHeader(&hdr);
 
-		logBuf = (traceRecord_t *)malloc(size);
+		if ( !memTracer.open(memPath.c_str(), isPaused) || !memTracer.write(&hdr, sizeof(hdr)) )
+		{
+			char stmp[1024];
+			snprintf( stmp, sizeof(stmp), "Error: Failed to open memory trace file for writing: %s", memPath.c_str() );
+			queueErrorMsg(stmp);
+			memRing.close();
+		}
 	}
 
-	while ( !isInterruptionRequested() )
+	// One more pass after the interruption request, for the records published before it
+	bool lastPass = false;
+	// The first failed write stops logging, like a file that couldn't be opened
+	std::string writeError;
+
+	while ( !lastPass && writeError.empty() )
 	{
+		lastPass = isInterruptionRequested();
+
 		isPaused = FCEUI_EmulationPaused() ? true : false;
 
-		while (logBufHead != logBufTail)
+		while ( (numRecs = logRing.peek(&recs)) > 0 )
 		{
-			logBuf[logBufTail].convToText(line);
-			logBufTail = (logBufTail + 1) % logBufMax;
-
-			#ifdef WIN32
-			bool success = tracer.writeLine(line);
-
-			/// TODO: Do something on error
-			#else
-			i=0;
-			while ( line[i] != 0 )
+			// Hand the slots back in chunks, so a waiting emulation thread can go on early
+			if (numRecs > chunkRecs)
 			{
-				buf[idx] = line[i]; i++; idx++;
+				numRecs = chunkRecs;
 			}
-			buf[idx] = '\n'; idx++;
 
-			if ( idx >= flushSize )
+			if (bzkFiles)
+			{
+				for (size_t i = 0; i < numRecs; i++)
+				{
+					// Messages have no place in the BZK columns
+					if ( (recs[i].flags & TRACE_REC_BZK) && !bzkFiles->write(recs[i], isPaused) )
+					{
+						writeError = bzkFiles->currentFileName();
+						break;
+					}
+				}
+			}
+			else
 			{
-				if ( write( logFile, buf, idx ) < 0 )
+				unsigned numSlices = renderer.render(recs, numRecs);
+
+				for (unsigned i = 0; i < numSlices; i++)
 				{
-					// HANDLE ERROR TODO
+					size_t size;
+					const char *txt = renderer.getSlice(i, &size);
+
+					if ( !writeTraceText(tracer, txt, size) )
+					{
+						writeError = logFilePath;
+						break;
+					}
 				}
-				idx = 0;
-				dataNeedsFlush = true;
 			}
-			#endif
+			logRing.release(numRecs);
+
+			if ( !writeError.empty() )
+			{
+				break;
+			}
 		}
 
-		#ifdef WIN32
-		bool success = tracer.setPause(isPaused);
+		while ( writeError.empty() && memTracer.getOpen() && ((numAccs = memRing.peek(&accs)) > 0) )
+		{
+			if ( !writeTraceText(memTracer, (const char*)accs, numAccs * sizeof(traceMemAccess_t)) )
+			{
+				writeError = logFilePath + TRACE_MEM_EXT;
+			}
+			memRing.release(numAccs);
+		}
+
+		if ( writeError.empty() && memTracer.getOpen() && !memTracer.setPause(isPaused) )
+		{
+			writeError = logFilePath + TRACE_MEM_EXT;
+		}
+
+		if ( writeError.empty() && !(bzkFiles ? bzkFiles->setPause(isPaused) : tracer.setPause(isPaused)) )
+		{
+			writeError = bzkFiles ? bzkFiles->currentFileName() : logFilePath;
+		}
+
+		if ( !writeError.empty() )
+		{
+			char stmp[1024];
+			snprintf( stmp, sizeof(stmp), "Error: Failed to write log file, logging stopped: %s", writeError.c_str() );
+			queueErrorMsg(stmp);
+		}
+		else if (!lastPass)
+		{
+			// Woken up by the emulation thread publishing records, or by the interruption request
+			logRing.waitForData(10);
+		}
+	}
+
+	logRing.close();
+	memRing.close();
+
+	if (bzkFiles)
+	{
+		bzkFiles->close();
+		delete bzkFiles;
+	}
+	else
+	{
+		tracer.close();
+	}
+	memTracer.close();
+
+	//printf("Trace Log Disk Exit\n");
+	emit finished();
+}
+//----------------------------------------------------
+//---  Parallel Capture (--tracejobs)
+//----------------------------------------------------
+int traceLoggerBatchPartFormat(int format)
+{
+	initBatchLogOptions(format);
+
+	// Joining needs one record per instruction, and the interrupt rules would lose
+	// the handlers running at a segment start, the checkpoints don't save the depth
+	initTraceFilter();
+
+	if (traceFilter.getActive())
+	{
+		return -1;
+	}
+	if (logging_options & LOG_BZK_FORMAT)
+	{
+		// Which edges are new depends on everything logged before
+		if (logging_options & LOG_BZK_EDGES)
+		{
+			return -1;
+		}
+		return TRACE_BATCH_BZK_PART;
+	}
+	// So does filtering on the Code/Data Logger
+	if (logging_options & (LOG_NEW_INSTRUCTIONS | LOG_NEW_DATA))
+	{
+		return -1;
+	}
+	return TRACE_BATCH_TEXT;
+}
+//----------------------------------------------------
+// Offset of the last line of fp, which is size bytes long and ends with a line ending
+static long findLastLine(FILE *fp, long size)
+{
+	char buf[4096];
+	long end = size - 1; // the last line's own '\n'
+
+	while (end > 0)
+	{
+		long start = end > (long)sizeof(buf) ? end - (long)sizeof(buf) : 0;
 
-		/// TODO: Do something on error
-		#else
-		if (isPaused)
+		if ( (fseek(fp, start, SEEK_SET) != 0) || (fread(buf, 1, end - start, fp) != (size_t)(end - start)) )
 		{
-			// If paused, the user might be at a breakpoint or doing some
-			// debugging. So make sure all data is flushed to disk for viewing.
-			// Only flush data when paused, to keep write efficiency up.
-			if ( idx > 0 )
+			return -1;
+		}
+		for (long i = end - start - 1; i >= 0; i--)
+		{
+			if (buf[i] == '\n')
 			{
-				if ( write( logFile, buf, idx ) < 0 )
-				{
-					// HANDLE ERROR TODO
-				}
-				idx = 0;
-				dataNeedsFlush = true;
+				return start + i + 1;
+			}
+		}
+		end = start;
+	}
+	return 0;
+}
+//----------------------------------------------------
+// Text lines carry their own counters, the parts only have to lose the
+// "Log Start" and "Logging Finished" lines one capture doesn't have
+static int stitchTextParts(const char *path, const std::vector<std::string> &partPaths)
+{
+	TraceFileWriter tracer;
+	std::vector<char> buf(TraceFileWriter::BlockSize);
+	bool success = true;
+
+	if ( !tracer.open(path) )
+	{
+		return -1;
+	}
+
+	for (size_t i = 0; success && (i < partPaths.size()); i++)
+	{
+		FILE *fp = fopen(partPaths[i].c_str(), "rb");
+
+		if (fp == NULL)
+		{
+			success = false;
+			break;
+		}
+		fseek(fp, 0, SEEK_END);
+
+		long start = 0, end = ftell(fp);
+
+		if ( (i + 1 < partPaths.size()) && (end > 0) )
+		{
+			end = findLastLine(fp, end);
+		}
+		fseek(fp, 0, SEEK_SET);
+
+		if (i > 0)
+		{
+			int c;
+
+			while ( ((c = fgetc(fp)) != EOF) && (c != '\n') )
+			{
+				start++;
+			}
+			start++;
+		}
+
+		while ( success && (start < end) )
+		{
+			size_t n = end - start < (long)buf.size() ? end - start : buf.size();
+
+			success = (fread(&buf[0], 1, n, fp) == n) && writeTraceText(tracer, &buf[0], n);
+			start += n;
+		}
+		success = (end >= 0) && success;
+
+		fclose(fp);
+	}
+	tracer.close();
+
+	return success ? 0 : -1;
+}
+//----------------------------------------------------
+// The parts are plain records with an index (TRACE_BATCH_BZK_PART), they go through the writer
+// of a normal capture again, with the counters from the index. Only the first record of a part
+// has the wrong previous address, the worker didn't run the instruction before it.
+static int stitchBzkParts(const char *path, const std::vector<std::string> &partPaths)
+{
+	bzkLogFiles_t out( path, (logging_options & LOG_BZK_BINARY) ? true : false,
+			(logging_options & LOG_BZK_COMPRESS) ? true : false, (logging_options & LOG_BZK_FOLD) ? true : false,
+			(logging_options & LOG_BZK_SEGMENTS) ? true : false, false );
+	bool isOpen = false;
+	bool success = true;
+	uint32 lastAddr = BZK_TRACE_NO_PREV_ADDR;
+
+	for (size_t i = 0; success && (i < partPaths.size()); i++)
+	{
+		std::string dir;
+		std::vector<bzkTraceIndexEntry_t> entries;
+
+		getDirFromFile( partPaths[i].c_str(), dir );
+
+		if ( dir.size() > 0 )
+		{
+			dir.append("/");
+		}
+
+		if ( bzkTrace_ReadIndex( (dir + BZK_TRACE_INDEX_NAME).c_str(), entries ) != 0 )
+		{
+			success = false;
+			break;
+		}
+		if ( entries.size() == 0 )
+		{
+			// Nothing was logged, unless the worker couldn't write its index
+			success = !QFile::exists( QString::fromStdString( dir + "z00000_fceux.bzk" ) );
+			continue;
+		}
+
+		bzkTraceIndexEntry_t fileEntry = entries[0];
+		size_t e = 0;
+		uint32 frame = 0;
+		uint64 instr = 0;
+		bool firstRec = true;
+
+		for (fileEntry.fileIdx = 0; success; fileEntry.fileIdx++)
+		{
+			FILE *fp = fopen( (dir + bzkTrace_IndexFileName(fileEntry)).c_str(), "rb" );
+
+			if (fp == NULL)
+			{
+				break;
+			}
+			if ( bzkTrace_ReadHeader(fp) != 0 )
+			{
+				fclose(fp);
+				success = false;
+				break;
 			}
-			if (dataNeedsFlush)
+
+			uint64 offset = sizeof(bzkTraceHeader_t);
+			bzkTraceRecord_t rec;
+
+			while ( fread(&rec, sizeof(rec), 1, fp) == 1 )
 			{
-				//printf("Flushing Trace Log Disk Buffers\n");
-				if ( fsync( logFile ) )
+				bool isNmi = false;
+
+				// Every frame starts with an entry, the first record of the part included
+				while ( (e < entries.size()) && (entries[e].fileIdx == fileEntry.fileIdx) && (entries[e].offset == offset) )
+				{
+					if (entries[e].kind == BZK_INDEX_FRAME)
+					{
+						frame = entries[e].frame;
+						instr = entries[e].instruction;
+					}
+					else if (entries[e].kind == BZK_INDEX_NMI)
+					{
+						isNmi = true;
+					}
+					e++;
+				}
+
+				if (firstRec)
 				{
-					printf("Trace Log fsync error\n");
+					if (i > 0)
+					{
+						rec.prevAddr = lastAddr;
+					}
+					firstRec = false;
 				}
-				dataNeedsFlush = false;
+
+				if (!isOpen)
+				{
+					success = out.open( false, frame, instr );
+					isOpen = true;
+
+					if (success && !out.openIndex(false))
+					{
+						printf("Failed to open %s, logging without an index\n", BZK_TRACE_INDEX_NAME);
+					}
+				}
+				success = success && out.write( rec, frame, instr, isNmi, false );
+
+				lastAddr = rec.romAddr;
+				instr++; // one record per instruction, parts are neither folded nor filtered
+				offset += sizeof(rec);
 			}
+			fclose(fp);
 		}
-		#endif
+	}
 
-		SDL_Delay(1);
+	if (!isOpen)
+	{
+		// One capture makes its first file even when nothing gets logged
+		success = out.open( false, 0, 0 ) && success;
 	}
-	
-	#ifdef WIN32
-	tracer.close();
-	#else
-	if ( idx > 0 )
+	out.close();
+
+	return success ? 0 : -1;
+}
+//----------------------------------------------------
+// Memory accesses don't depend on anything before them, the parts only lose their headers
+static int stitchMemParts(const char *path, const std::vector<std::string> &partPaths)
+{
+	TraceFileWriter tracer;
+	std::vector<char> buf(TraceFileWriter::BlockSize);
+	std::string outPath = std::string(path) + TRACE_MEM_EXT;
+	traceMemHeader_t hdr;
+	bool success = true;
+	size_t n;
+
+	traceMem_InitHeader(&hdr);
+
+	if ( !tracer.open(outPath.c_str()) || !tracer.write(&hdr, sizeof(hdr)) )
+	{
+		return -1;
+	}
+
+	for (size_t i = 0; success && (i < partPaths.size()); i++)
 	{
-		if ( write( logFile, buf, idx ) < 0 )
+		FILE *fp = fopen( (partPaths[i] + TRACE_MEM_EXT).c_str(), "rb" );
+
+		if (fp == NULL)
 		{
-			// HANDLE ERROR TODO
+			success = false;
+			break;
 		}
-		idx = 0;
+		success = fseek(fp, sizeof(hdr), SEEK_SET) == 0;
+
+		while ( success && ((n = fread(&buf[0], 1, buf.size(), fp)) > 0) )
+		{
+			success = tracer.write(&buf[0], n);
+		}
+		fclose(fp);
 	}
+	tracer.close();
+
+	return success ? 0 : -1;
+}
+//----------------------------------------------------
+int traceLoggerBatchStitch(const char *path, int format, const std::vector<std::string> &partPaths)
+{
+	int error;
+
+	initBatchLogOptions(format);
 
-	if ( logFile != -1 )
+	if (logging_options & LOG_BZK_FORMAT)
 	{
-		close(logFile); logFile = -1;
+		error = stitchBzkParts(path, partPaths);
 	}
-	#endif
-	
-	//printf("Trace Log Disk Exit\n");
-	emit finished();
+	else
+	{
+		error = stitchTextParts(path, partPaths);
+	}
+	if ( !error && (logging_options & LOG_MEM_ACCESSES) )
+	{
+		error = stitchMemParts(path, partPaths);
+	}
+	return error;
 }
 //----------------------------------------------------
 //---  Trace Logger BackUp (Undo) Instruction
@@ -2582,25 +4006,45 @@ static int undoInstruction( traceRecord_t &rec )
 {
 	// TODO Undo memory writes
 	//printf("BackUp (Undo) Instruction\n");
-	X.PC = rec.cpu.PC;
-	X.A  = rec.cpu.A;
-	X.X  = rec.cpu.X;
-	X.Y  = rec.cpu.Y;
-	X.S  = rec.cpu.S;
-	X.P  = rec.cpu.P;
+	uint8_t preWriteVal;
+	int writeAddr;
+
+	// Messages only take their line away
+	if ( rec.flags & TRACE_REC_MSG )
+	{
+		return 0;
+	}
+	X.PC = rec.PC;
+	X.S  = rec.getS();
+
+	if ( rec.flags & TRACE_REC_BZK )
+	{
+		X.A = rec.bzk.A;
+		X.X = rec.bzk.X;
+		X.Y = rec.bzk.Y;
+		X.P = rec.bzk.P;
+	}
+	else
+	{
+		X.A = rec.ins.A;
+		X.X = rec.ins.X;
+		X.Y = rec.ins.Y;
+		X.P = rec.ins.P;
+	}
+
+	writeAddr = rec.getWriteAddr( &preWriteVal );
 
-	if ( rec.writeAddr >= 0 )
+	if ( writeAddr >= 0 )
 	{
-		if ( rec.writeAddr < 0x8000 )
+		if ( writeAddr < 0x8000 )
 		{
 			writefunc wfunc;
         
-			wfunc = GetWriteHandler (rec.writeAddr);
+			wfunc = GetWriteHandler (writeAddr);
         
 			if (wfunc)
 			{
-				wfunc ((uint32) rec.writeAddr,
-				       (uint8) (rec.preWriteVal & 0x000000ff));
+				wfunc ((uint32) writeAddr, preWriteVal);
 			}
 		}
 	}
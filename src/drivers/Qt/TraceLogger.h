@@ -3,12 +3,16 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include <QWidget>
 #include <QDialog>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QComboBox>
 #include <QCheckBox>
+#include <QLineEdit>
 #include <QPushButton>
 #include <QRadioButton>
 #include <QLabel>
@@ -23,40 +27,69 @@
 #include "Qt/SymbolicDebug.h"
 #include "Qt/ConsoleDebugger.h"
 #include "../../debug.h"
+#include "../../bzktrace.h"
 
-struct traceRecord_t
+// Counters of the first record logged in a frame, records keep theirs as deltas against it
+struct traceKeyframe_t
 {
-	struct
-	{
-		uint16_t PC;
-		uint8_t A;
-		uint8_t X;
-		uint8_t Y;
-		uint8_t S;
-		uint8_t P;
-	} cpu;
-
-	uint8_t opCode[3];
-	uint8_t opSize;
-	uint8_t asmTxtSize;
-	uint8_t preWriteVal;
-	char asmTxt[64];
-
 	uint64_t frameCount;
 	uint64_t cycleCount;
 	uint64_t instrCount;
-	uint64_t flags;
-
-	int32_t callAddr;
-	int32_t romAddr;
-	int32_t bank;
-	int32_t skippedLines;
+};
 
-	int32_t writeAddr;
+// One line of the trace log in 32 bytes, so millions of them fit in the history and the disk ring.
+// The text is made by convToText when it is shown or written.
+struct traceRecord_t
+{
+	union
+	{
+		struct // TRACE_REC_BZK and TRACE_REC_MSG clear
+		{
+			uint8_t  A;
+			uint8_t  X;
+			uint8_t  Y;
+			uint8_t  P;
+			uint8_t  opCode[3];
+			uint8_t  opSize;
+			uint8_t  opValue;      // byte at opAddr before the instruction ran
+			uint8_t  S;
+			uint16_t opAddr;       // effective address, destination of JMP (), subroutine of RTS (TRACE_REC_CALL)
+			int16_t  bank;         // getBank(PC)
+			int16_t  opBank;       // asmTraceValues_t::bank, saved whatever the log options
+			uint16_t cycleDelta;
+			int16_t  opBank2;      // asmTraceValues_t::bank2
+			uint32_t skippedLines;
+		} ins;
+
+		bzkTraceRecord_t bzk; // TRACE_REC_BZK set, has its own registers, S is kept in bzk.reserved
+
+		char msg[24]; // TRACE_REC_MSG set
+	};
+
+	uint16_t PC;
+	uint8_t  flags;
+	uint8_t  keyHi;      // bits 16-23 of the key
+	uint16_t keyLo;      // traceKeyframe_t of the frame, 24 bit sequence number
+	uint16_t instrDelta;
 
 	traceRecord_t(void);
 
-	int appendAsmText(const char *txt);
+	void init(void);
+
+	uint32_t getKey(void) const { return keyLo | ((uint32_t)keyHi << 16); }
+	void setKey(uint32_t key) { keyLo = (uint16_t)key; keyHi = (uint8_t)(key >> 16); }
+
+	uint8_t getS(void) const;
+	void setS(uint8_t S);
+
+	// False when the keyframe was recycled since the record was made, the counters are then 0
+	bool getCounters(uint64_t &frameCount, uint64_t &cycleCount, uint64_t &instrCount) const;
+
+	// getBank(PC), -1 if not known
+	int getBank(void) const;
+
+	// Address the instruction writes to and the byte that was there, -1 if none
+	int getWriteAddr(uint8_t *preWriteVal = NULL) const;
 
 	int convToText(char *line, int *len = 0);
 };
@@ -183,6 +216,19 @@ protected:
 	QCheckBox *symTraceEnaCbox;
 	QCheckBox *logNewMapCodeCbox;
 	QCheckBox *logNewMapDataCbox;
+	QCheckBox *bzkFormatCbox;
+	QCheckBox *bzkBinaryCbox;
+	QCheckBox *bzkCompressCbox;
+	QCheckBox *bzkFoldCbox;
+	QCheckBox *bzkEdgesCbox;
+	QCheckBox *bzkSegmentsCbox;
+	QLineEdit *filterPcEdit;
+	QLineEdit *filterBanksEdit;
+	QCheckBox *filterRamCbox;
+	QCheckBox *filterNmiCbox;
+	QCheckBox *filterIrqCbox;
+	QCheckBox *memAccessCbox;
+	QLineEdit *memRangesEdit;
 
 	QPushButton *selLogFileButton;
 	QPushButton *startStopButton;
@@ -218,6 +264,19 @@ private slots:
 	void logBankNumStateChanged(int state);
 	void logNewMapCodeChanged(int state);
 	void logNewMapDataChanged(int state);
+	void bzkFormatStateChanged(int state);
+	void bzkBinaryStateChanged(int state);
+	void bzkCompressStateChanged(int state);
+	void bzkFoldStateChanged(int state);
+	void bzkEdgesStateChanged(int state);
+	void bzkSegmentsStateChanged(int state);
+	void filterPcChanged(const QString &txt);
+	void filterBanksChanged(const QString &txt);
+	void filterRamStateChanged(int state);
+	void filterNmiStateChanged(int state);
+	void filterIrqStateChanged(int state);
+	void memAccessStateChanged(int state);
+	void memRangesChanged(const QString &txt);
 	void logMaxLinesChanged(int index);
 	void hbarChanged(int value);
 	void vbarChanged(int value);
@@ -236,3 +295,20 @@ int FCEUD_TraceLoggerStop(void);
 int FCEUD_TraceLoggerStart(void);
 int FCEUD_TraceLoggerRunning(void);
 int FCEUD_TraceLoggerBackUpInstruction(void);
+
+// traceLoggerBatchStart formats
+#define TRACE_BATCH_CONFIG     -1 // as set in the Trace Logger window
+#define TRACE_BATCH_TEXT        0
+#define TRACE_BATCH_BZK         1
+#define TRACE_BATCH_BZK_BINARY  2
+#define TRACE_BATCH_BZK_PART    3 // plain BZK binary files with an index, what traceLoggerBatchStitch reads
+
+// Headless capture (--tracelog) to path, with the trace logger settings from the config
+int traceLoggerBatchStart(const char *path, int format);
+// Ends the capture once the disk thread wrote every record, non-zero if it couldn't
+int traceLoggerBatchStop(void);
+// Format the workers of a parallel capture (--tracejobs) log in, or -1 if format can't be split
+// into segments that stitch into the same trace as one capture
+int traceLoggerBatchPartFormat(int format);
+// Joins the parts the workers logged to partPaths, in order, into what one capture to path would have written
+int traceLoggerBatchStitch(const char *path, int format, const std::vector<std::string> &partPaths);
@@ -751,6 +751,30 @@ InitConfig()
 	config->addOption("SDL.TraceLogSymbolic", 0);
 	config->addOption("SDL.TraceLogStackTabbing", 1);
 	config->addOption("SDL.TraceLogLeftDisassembly", 1);
+	config->addOption("SDL.TraceLogBzkFormat", 0);
+	config->addOption("SDL.TraceLogBzkBinary", 0);
+	config->addOption("SDL.TraceLogBzkCompress", 0);
+	config->addOption("SDL.TraceLogBzkFold", 0);
+	config->addOption("SDL.TraceLogBzkEdges", 0);
+	config->addOption("SDL.TraceLogBzkSegments", 0);
+	config->addOption("SDL.TraceLogFilterPC", "");
+	config->addOption("SDL.TraceLogFilterBanks", "");
+	config->addOption("SDL.TraceLogFilterRamOnly", 0);
+	config->addOption("SDL.TraceLogFilterNmi", 0);
+	config->addOption("SDL.TraceLogFilterIrq", 0);
+	config->addOption("SDL.TraceLogMemAccesses", 0);
+	config->addOption("SDL.TraceLogMemRanges", "");
+	config->addOption("tracelog", "SDL.TraceLogBatchFile", "");
+	config->addOption("traceformat", "SDL.TraceLogBatchFormat", "");
+	config->addOption("tracejobs", "SDL.TraceLogBatchJobs", 1);
+	config->addOption("tracesegment", "SDL.TraceLogBatchSegment", 0);
+	config->addOption("traceresume", "SDL.TraceLogBatchResume", "");
+	config->addOption("benchmark", "SDL.BenchmarkFrames", 0);
+	config->addOption("benchconfigs", "SDL.BenchmarkConfigs", "");
+	config->addOption("benchruns", "SDL.BenchmarkRuns", 3);
+	config->addOption("benchsave", "SDL.BenchmarkSave", "");
+	config->addOption("benchbaseline", "SDL.BenchmarkBaseline", "");
+	config->addOption("benchtolerance", "SDL.BenchmarkTolerance", 10.0);
 	
 	// overwrite the config file?
 	config->addOption("no-config", "SDL.NoConfig", 0);
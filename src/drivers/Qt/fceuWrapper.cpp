@@ -25,7 +25,10 @@
 #include <limits.h>
 #include <unzip.h>
 
+#include <QCoreApplication>
+#include <QDir>
 #include <QFileInfo>
+#include <QProcess>
 #include <QStyleFactory>
 #include "Qt/main.h"
 #include "Qt/throttle.h"
@@ -47,6 +50,8 @@
 #include "Qt/ConsoleDebugger.h"
 #include "Qt/ConsoleWindow.h"
 #include "Qt/ConsoleUtilities.h"
+#include "Qt/TraceLogger.h"
+#include "Qt/CpuBenchmark.h"
 #include "Qt/TasEditor/TasEditorWindow.h"
 #include "Qt/fceux_git_info.h"
 
@@ -55,6 +60,7 @@
 #include "../../cheat.h"
 #include "../../movie.h"
 #include "../../state.h"
+#include "../../emufile.h"
 #include "../../profiler.h"
 #include "../../version.h"
 
@@ -109,6 +115,17 @@ static int periodic_saves = 0;
 static int   mutexLocks = 0;
 static int   mutexPending = 0;
 static bool  emulatorHasMutex = 0;
+// --tracelog and --benchmark, see fceuWrapperRunBatch
+static bool  batchMode = false;
+static std::string batchTraceFile;
+static int   batchTraceFormat = TRACE_BATCH_CONFIG;
+static int   batchStopFrame = 0;
+static int   batchJobs = 1;
+static int   batchSegmentFrames = 0;
+static std::string batchResumeFile;
+static std::string batchRomFile;
+static std::vector<std::string> batchWorkerArgs; // command line options the workers get too
+static cpuBenchmarkOptions_t batchBenchmark;
 unsigned int emulatorCycleCount = 0;
 static int archiveFileLoadIndex = -1;
 
@@ -243,7 +260,8 @@ DriverInitialize(FCEUGI *gi)
 	}
 	inited|=4;
 
-	if (InitSound())
+	// A headless capture has nothing to play the sound on
+	if (!batchMode && InitSound())
 	{
 		inited|=1;
 	}
@@ -377,7 +395,7 @@ int LoadGame(const char *path, bool silent, bool netPlayRequested)
 
 	g_config->getOption( "SDL.AutoOpenDebugger", &autoOpenDebugger );
 
-	if ( autoOpenDebugger && !debuggerWindowIsOpen() )
+	if ( autoOpenDebugger && consoleWindow && !debuggerWindowIsOpen() )
 	{
 		consoleWindow->openDebugWindow();
 	}
@@ -688,7 +706,36 @@ static const char *DriverUsage =
 "                         to not save/load automatically provide a number\n"
 "                         greater than 9\n"
 "--periodicsaves {0|1}  enable automatic periodic saving.  This will save to\n"
-"                         the state passed to --savestate\n";
+"                         the state passed to --savestate\n"
+"--tracelog     f       Play the --playmov movie without a window, sound or\n"
+"                         throttling, trace every instruction to file f with\n"
+"                         the Trace Logger settings and exit when it ends.\n"
+"                         --pauseframe and --movielength end it earlier.\n"
+"--traceformat  s       Trace format for --tracelog: text, bzk (z00000.log\n"
+"                         files in the folder of f) or bzkbin (*.bzk files).\n"
+"--tracejobs    x       Trace with x processes in parallel: play the movie\n"
+"                         once to save checkpoints, trace the segments between\n"
+"                         them at the same time and join them into the trace\n"
+"                         one process would have written. Not for BZK edge\n"
+"                         coverage or capture filters, or new code/data only\n"
+"                         logging.\n"
+"--tracesegment x       Frames between the --tracejobs checkpoints, the\n"
+"                         default splits the movie into one segment per job.\n"
+"--traceresume  f       (--tracejobs workers) Start from checkpoint f.\n"
+"--benchmark    x       Emulate the game for x frames without a window,\n"
+"                         sound or throttling in each benchmark configuration\n"
+"                         and print frames/s, instructions/s and ns per\n"
+"                         instruction.\n"
+"--benchconfigs s       Benchmark configurations separated by commas: plain,\n"
+"                         cdl, trace-text, trace-bzk, trace-bzkbin,\n"
+"                         breakpoints, lua, and cond-tree and cond-compiled\n"
+"                         (ns per breakpoint condition check). All of them\n"
+"                         by default.\n"
+"--benchruns    x       Runs per configuration, the fastest counts (3).\n"
+"--benchsave    f       Write the results to f, to compare later runs with.\n"
+"--benchbaseline f      Compare with the results in f and exit with 1 if a\n"
+"                         configuration got slower than --benchtolerance.\n"
+"--benchtolerance x     Percent ns/instruction may grow over the baseline (10).\n";
 
 static void ShowUsage(const char *prog)
 {
@@ -753,6 +800,16 @@ int  fceuWrapperPreInit( int argc, char *argv[] )
 			printf("%i.%i.%i\n", FCEU_VERSION_MAJOR, FCEU_VERSION_MINOR, FCEU_VERSION_PATCH);
 			exit(0);
 		}
+		else if ( (strcmp(argv[i], "--tracelog") == 0) || (strcmp(argv[i], "--benchmark") == 0) )
+		{
+			batchMode = true;
+		}
+	}
+
+	// No window is ever shown, so build servers don't need a display
+	if ( batchMode && qgetenv("QT_QPA_PLATFORM").isEmpty() )
+	{
+		qputenv("QT_QPA_PLATFORM", "offscreen");
 	}
 	return 0;
 }
@@ -764,6 +821,11 @@ int  fceuWrapperInit( int argc, char *argv[] )
 
 	FCEUD_Message("Starting " FCEU_NAME_AND_VERSION "...\n");
 
+	if ( batchMode )
+	{
+		SDL_SetHint( SDL_HINT_VIDEODRIVER, "dummy" );
+	}
+
 	/* SDL_INIT_VIDEO Needed for (joystick config) event processing? */
 	if (SDL_Init(SDL_INIT_VIDEO)) 
 	{
@@ -797,6 +859,38 @@ int  fceuWrapperInit( int argc, char *argv[] )
 
 	int romIndex = g_config->parse(argc, argv);
 
+	if ( batchMode )
+	{
+		// The workers of a parallel capture get the same options, except the ones that say what to trace
+		static const char *workerSkipArgs[] = { "--tracelog", "--traceformat", "--tracejobs", "--tracesegment",
+			"--traceresume", "--movielength", "--pauseframe", "--no-config", NULL };
+
+		batchWorkerArgs.clear();
+
+		for (int i=1; i<argc; i++)
+		{
+			bool skip = false;
+
+			if ( argv[i][0] != '-' )
+			{
+				continue;
+			}
+			for (int j=0; workerSkipArgs[j] != NULL; j++)
+			{
+				if ( strcmp(argv[i], workerSkipArgs[j]) == 0 )
+				{
+					skip = true;
+				}
+			}
+			if ( !skip && (i + 1 < argc) )
+			{
+				batchWorkerArgs.push_back( argv[i] );
+				batchWorkerArgs.push_back( argv[i+1] );
+			}
+			i++;
+		}
+	}
+
 	// This is here so that a default fceux.cfg will be created on first
 	// run, even without a valid ROM to play.
 	// Unless, of course, there's actually --no-config given
@@ -886,6 +980,11 @@ int  fceuWrapperInit( int argc, char *argv[] )
 
 	g_config->getOption("SDL.SuggestReadOnlyReplay"  , &suggestReadOnlyReplay);
 	g_config->getOption("SDL.PauseAfterMoviePlayback", &pauseAfterPlayback);
+	if ( batchMode )
+	{
+		// The capture ends with the movie, it must not wait on a pause
+		pauseAfterPlayback = false;
+	}
 	g_config->getOption("SDL.CloseFinishedMovie"     , &closeFinishedMovie);
 	g_config->getOption("SDL.MovieBindSavestate"     , &bindSavestate);
 	g_config->getOption("SDL.SubtitlesOnAVI"         , &subtitlesOnAVI);
@@ -1075,8 +1174,12 @@ int  fceuWrapperInit( int argc, char *argv[] )
 				SDL_Quit();
 				return -1;
 			}
+			batchRomFile = fullpath;
 			g_config->setOption("SDL.LastOpenFile", fullpath.c_str() );
-			g_config->save();
+			if (!noconfig)
+			{
+				g_config->save();
+			}
 		}
 		else
 		{
@@ -1099,7 +1202,8 @@ int  fceuWrapperInit( int argc, char *argv[] )
 			g_config->getOption("SDL.PauseFrame", &pauseframe);
 			g_config->setOption("SDL.PauseFrame", 0);
 
-			if (suggestReadOnlyReplay)
+			// Savestates of a parallel capture must not branch off the movie
+			if (suggestReadOnlyReplay || batchMode)
 			{
 				replayReadOnlySetting = true;
 			}
@@ -1117,6 +1221,63 @@ int  fceuWrapperInit( int argc, char *argv[] )
 		g_config->getOption("SDL.MovieLength",&KillFCEUXonFrame);
 		printf("KillFCEUXonFrame %d\n",KillFCEUXonFrame);
 	}
+
+	// headless trace capture
+	g_config->getOption("SDL.TraceLogBatchFile", &batchTraceFile);
+	g_config->setOption("SDL.TraceLogBatchFile", "");
+	g_config->getOption("SDL.TraceLogBatchFormat", &s);
+	g_config->setOption("SDL.TraceLogBatchFormat", "");
+	if ( batchMode )
+	{
+		if (s == "")
+		{
+			batchTraceFormat = TRACE_BATCH_CONFIG;
+		}
+		else if (s == "text")
+		{
+			batchTraceFormat = TRACE_BATCH_TEXT;
+		}
+		else if (s == "bzk")
+		{
+			batchTraceFormat = TRACE_BATCH_BZK;
+		}
+		else if (s == "bzkbin")
+		{
+			batchTraceFormat = TRACE_BATCH_BZK_BINARY;
+		}
+		else if (s == "bzkparts")
+		{
+			batchTraceFormat = TRACE_BATCH_BZK_PART;
+		}
+		else
+		{
+			printf("Error: Unknown trace format '%s'\n", s.c_str());
+			return -1;
+		}
+		// The core would exit() at that frame, before the trace is written out
+		batchStopFrame = KillFCEUXonFrame;
+		KillFCEUXonFrame = 0;
+	}
+	g_config->getOption("SDL.TraceLogBatchJobs", &batchJobs);
+	g_config->setOption("SDL.TraceLogBatchJobs", 1);
+	g_config->getOption("SDL.TraceLogBatchSegment", &batchSegmentFrames);
+	g_config->setOption("SDL.TraceLogBatchSegment", 0);
+	g_config->getOption("SDL.TraceLogBatchResume", &batchResumeFile);
+	g_config->setOption("SDL.TraceLogBatchResume", "");
+
+	// headless benchmark
+	g_config->getOption("SDL.BenchmarkFrames", &batchBenchmark.frames);
+	g_config->setOption("SDL.BenchmarkFrames", 0);
+	g_config->getOption("SDL.BenchmarkConfigs", &batchBenchmark.configs);
+	g_config->setOption("SDL.BenchmarkConfigs", "");
+	g_config->getOption("SDL.BenchmarkRuns", &batchBenchmark.runs);
+	g_config->setOption("SDL.BenchmarkRuns", 3);
+	g_config->getOption("SDL.BenchmarkSave", &batchBenchmark.saveFile);
+	g_config->setOption("SDL.BenchmarkSave", "");
+	g_config->getOption("SDL.BenchmarkBaseline", &batchBenchmark.baseline);
+	g_config->setOption("SDL.BenchmarkBaseline", "");
+	g_config->getOption("SDL.BenchmarkTolerance", &batchBenchmark.tolerance);
+	g_config->setOption("SDL.BenchmarkTolerance", 10.0);
 	
     int save_state;
     g_config->getOption("SDL.PeriodicSaves", &periodic_saves);
@@ -1162,6 +1323,304 @@ int  fceuWrapperInit( int argc, char *argv[] )
 	return 0;
 }
 
+bool fceuWrapperBatchMode(void)
+{
+	return batchMode;
+}
+
+// Checkpoints of a parallel capture are a savestate and a .cnt file with the
+// debugger counters, which savestates don't hold but the trace prints
+static bool saveBatchCheckpoint( const std::string &path )
+{
+	EMUFILE_FILE em( path.c_str(), "wb" );
+
+	if ( !em.is_open() || !FCEUSS_SaveMS( &em, Z_BEST_SPEED ) )
+	{
+		return false;
+	}
+	FILE *fp = fopen( (path + ".cnt").c_str(), "w" );
+
+	if ( fp == NULL )
+	{
+		return false;
+	}
+	fprintf( fp, "%llu %llu\n", (unsigned long long)total_instructions, (unsigned long long)total_cycles_base );
+
+	return fclose(fp) == 0;
+}
+
+static bool loadBatchCheckpoint( const std::string &path )
+{
+	unsigned long long instr, cyclesBase;
+	EMUFILE_FILE em( path.c_str(), "rb" );
+
+	if ( !em.is_open() || !FCEUSS_LoadFP( &em, SSLOADPARAM_NOBACKUP ) )
+	{
+		return false;
+	}
+	FILE *fp = fopen( (path + ".cnt").c_str(), "r" );
+
+	if ( fp == NULL )
+	{
+		return false;
+	}
+	bool success = fscanf( fp, "%llu %llu", &instr, &cyclesBase ) == 2;
+
+	fclose(fp);
+
+	if ( success )
+	{
+		total_instructions = instr;
+		total_cycles_base  = cyclesBase;
+	}
+	return success;
+}
+
+// --tracejobs: Plays the movie once without tracing to save a checkpoint every segment,
+// then traces the segments in worker processes (the emulator is one global state per
+// process) and joins their output into the file one process would have written.
+static int runParallelBatch( void )
+{
+	uint8 *gfx = 0;
+	int32 *sound = 0;
+	int32 ssize = 0;
+	int partFormat, endFrame, segFrames;
+	std::vector <int> segStart;
+	std::vector <std::string> partPaths;
+	FCEU::timeStampRecord tsStart, tsCkptDone, tsTraceDone, tsStitchDone;
+	char stmp[64];
+
+	partFormat = traceLoggerBatchPartFormat( batchTraceFormat );
+
+	if ( partFormat < 0 )
+	{
+		printf("Error: --tracejobs can't split traces with BZK edge coverage or capture filters, or new code/data only logging\n");
+		return -1;
+	}
+	std::string workDir = batchTraceFile + ".parts";
+
+	if ( !QDir().mkpath( QString::fromStdString(workDir) ) )
+	{
+		printf("Error: Failed to create %s\n", workDir.c_str());
+		return -1;
+	}
+	workDir += "/";
+
+	segFrames = batchSegmentFrames;
+
+	if ( segFrames <= 0 )
+	{
+		int lastFrame = batchStopFrame ? batchStopFrame : FCEUI_GetMovieLength();
+
+		segFrames = (lastFrame - currFrameCounter + batchJobs - 1) / batchJobs;
+
+		if ( segFrames < 1 )
+		{
+			segFrames = 1;
+		}
+	}
+	FCEUI_SetEmulationPaused(0);
+
+	tsStart.readNew();
+
+	segStart.push_back( currFrameCounter );
+
+	// Same loop as the capture below, so the segments end where it would
+	while ( FCEUMOV_Mode(MOVIEMODE_PLAY) && !FCEUI_EmulationPaused() )
+	{
+		if ( batchStopFrame && (currFrameCounter >= batchStopFrame) )
+		{
+			break;
+		}
+		if ( currFrameCounter - segStart.back() >= segFrames )
+		{
+			snprintf( stmp, sizeof(stmp), "ckpt%03zu.fcs", segStart.size() );
+
+			if ( !saveBatchCheckpoint( workDir + stmp ) )
+			{
+				printf("Error: Failed to save checkpoint %s%s\n", workDir.c_str(), stmp);
+				return -1;
+			}
+			segStart.push_back( currFrameCounter );
+		}
+		FCEUI_Emulate(&gfx, &sound, &ssize, 2);
+
+		emulatorCycleCount++;
+	}
+	endFrame = currFrameCounter;
+
+	tsCkptDone.readNew();
+
+	// Run the workers, at most batchJobs at a time
+	std::vector <QProcess*> running;
+	size_t next = 0;
+	int error = 0;
+
+	while ( (next < segStart.size()) || (running.size() > 0) )
+	{
+		while ( !error && (next < segStart.size()) && ((int)running.size() < batchJobs) )
+		{
+			QStringList args;
+			QProcess *proc = new QProcess();
+
+			snprintf( stmp, sizeof(stmp), "part%03zu", next );
+
+			std::string partDir = workDir + stmp;
+
+			QDir().mkpath( QString::fromStdString(partDir) );
+
+			partPaths.push_back( partDir + "/trace.log" );
+
+			for (size_t i=0; i<batchWorkerArgs.size(); i++)
+			{
+				args << QString::fromStdString( batchWorkerArgs[i] );
+			}
+			args << "--no-config" << "1";
+			args << "--tracelog" << QString::fromStdString( partPaths.back() );
+			args << "--traceformat" << (partFormat == TRACE_BATCH_BZK_PART ? "bzkparts" : "text");
+			args << "--movielength" << QString::number( (next + 1 < segStart.size()) ? segStart[next+1] : endFrame );
+
+			if ( next > 0 )
+			{
+				snprintf( stmp, sizeof(stmp), "ckpt%03zu.fcs", next );
+
+				args << "--traceresume" << QString::fromStdString( workDir + stmp );
+			}
+			args << QString::fromStdString( batchRomFile );
+
+			proc->setStandardOutputFile( QString::fromStdString( partDir + "/worker.log" ) );
+			proc->setProcessChannelMode( QProcess::ForwardedErrorChannel );
+			proc->start( QCoreApplication::applicationFilePath(), args );
+
+			if ( !proc->waitForStarted(-1) )
+			{
+				printf("Error: Failed to start the worker for segment %zu\n", next);
+				delete proc;
+				error = -1;
+				break;
+			}
+			running.push_back( proc );
+			next++;
+		}
+		if ( error && (running.size() == 0) )
+		{
+			break;
+		}
+		// They all take about as long, waiting on the oldest is good enough
+		QProcess *proc = running.front();
+
+		running.erase( running.begin() );
+
+		proc->waitForFinished(-1);
+
+		if ( (proc->exitStatus() != QProcess::NormalExit) || (proc->exitCode() != 0) )
+		{
+			printf("Error: A trace worker failed, see the worker.log files in %s\n", workDir.c_str());
+			error = -1;
+		}
+		delete proc;
+	}
+	tsTraceDone.readNew();
+
+	if ( !error && traceLoggerBatchStitch( batchTraceFile.c_str(), batchTraceFormat, partPaths ) )
+	{
+		printf("Error: The trace could not be written to %s\n", batchTraceFile.c_str());
+		error = -1;
+	}
+	tsStitchDone.readNew();
+
+	if ( !error )
+	{
+		QDir( QString::fromStdString(workDir) ).removeRecursively();
+	}
+	printf("Traced %i frames in %zu segments with %i jobs in %.3f s (checkpoints %.3f s, tracing %.3f s, joining %.3f s)\n",
+			endFrame - segStart.front(), segStart.size(), batchJobs,
+			(tsStitchDone - tsStart).toSeconds(), (tsCkptDone - tsStart).toSeconds(),
+			(tsTraceDone - tsCkptDone).toSeconds(), (tsStitchDone - tsTraceDone).toSeconds() );
+
+	return error;
+}
+
+// Emulates as fast as the CPU allows, on the calling thread, until the movie ends
+int  fceuWrapperRunBatch( void )
+{
+	uint8 *gfx = 0;
+	int32 *sound = 0;
+	int32 ssize = 0;
+	int startFrame;
+	uint64 startInstructions;
+	FCEU::timeStampRecord tsStart, tsEmuDone, tsWriteDone;
+
+	if ( batchBenchmark.frames > 0 )
+	{
+		return cpuBenchmarkRun( batchBenchmark );
+	}
+	if ( GameInfo == NULL )
+	{
+		printf("Error: --tracelog needs a ROM\n");
+		return -1;
+	}
+	if ( batchTraceFile.size() == 0 || !FCEUMOV_Mode(MOVIEMODE_PLAY) )
+	{
+		printf("Error: --tracelog needs a log file and a movie to play (--playmov)\n");
+		return -1;
+	}
+	if ( batchResumeFile.size() && !loadBatchCheckpoint( batchResumeFile ) )
+	{
+		printf("Error: Failed to load checkpoint %s\n", batchResumeFile.c_str());
+		return -1;
+	}
+	if ( batchJobs > 1 )
+	{
+		return runParallelBatch();
+	}
+	if ( traceLoggerBatchStart( batchTraceFile.c_str(), batchTraceFormat ) )
+	{
+		printf("Error: Failed to start trace logging to %s\n", batchTraceFile.c_str());
+		return -1;
+	}
+
+	FCEUI_SetEmulationPaused(0);
+
+	startFrame = currFrameCounter;
+	startInstructions = total_instructions;
+	tsStart.readNew();
+
+	// A pause can only come from --pauseframe, that ends the capture too
+	while ( FCEUMOV_Mode(MOVIEMODE_PLAY) && !FCEUI_EmulationPaused() )
+	{
+		if ( batchStopFrame && (currFrameCounter >= batchStopFrame) )
+		{
+			break;
+		}
+		// Skip rendering and sound, nothing shows them
+		FCEUI_Emulate(&gfx, &sound, &ssize, 2);
+
+		emulatorCycleCount++;
+	}
+	tsEmuDone.readNew();
+
+	int error = traceLoggerBatchStop();
+
+	tsWriteDone.readNew();
+
+	double emuSec   = (tsEmuDone - tsStart).toSeconds();
+	double totalSec = (tsWriteDone - tsStart).toSeconds();
+	int frames = currFrameCounter - startFrame;
+	uint64 instructions = total_instructions - startInstructions;
+
+	printf("Traced %i frames, %llu instructions in %.3f s (emulation %.3f s, %.1f fps, %.2f M instructions/s)\n",
+			frames, (unsigned long long)instructions, totalSec, emuSec,
+			emuSec > 0.0 ? frames / emuSec : 0.0,
+			emuSec > 0.0 ? instructions / emuSec * 1.0e-6 : 0.0 );
+
+	if ( error )
+	{
+		printf("Error: The trace could not be written to %s\n", batchTraceFile.c_str());
+	}
+	return error;
+}
+
 int  fceuWrapperClose( void )
 {
 	CloseGame();
@@ -37,6 +37,8 @@ int  fceuWrapperInit( int argc, char *argv[] );
 int  fceuWrapperMemoryCleanup( void );
 int  fceuWrapperClose( void );
 int  fceuWrapperUpdate( void );
+int  fceuWrapperRunBatch( void );
+bool fceuWrapperBatchMode(void);
 void fceuWrapperLock(void);
 void fceuWrapperLock(const char *filename, int line, const char *func);
 bool fceuWrapperTryLock(int timeout = 1000);
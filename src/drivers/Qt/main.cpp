@@ -117,7 +117,7 @@ int main( int argc, char *argv[] )
 
 	fceuSplashScreen *splash = NULL;
 	
-	if ( showSplashScreen() )
+	if ( !fceuWrapperBatchMode() && showSplashScreen() )
 	{
 		splash = new fceuSplashScreen();
 		splash->show();
@@ -153,6 +153,21 @@ int main( int argc, char *argv[] )
 	//   }
 	//}
 
+	if ( fceuWrapperBatchMode() )
+	{
+		// Headless trace capture, the emulation runs right here and no window is made
+		retval = fceuWrapperInit( argc, argv );
+
+		if ( retval == 0 )
+		{
+			retval = fceuWrapperRunBatch();
+		}
+		fceuWrapperClose();
+		fceuWrapperMemoryCleanup();
+
+		return retval ? 1 : 0;
+	}
+
 	fceuWrapperInit( argc, argv );
 
 	consoleWindow = new consoleWin_t();
@@ -0,0 +1,440 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <zlib.h>
+
+#include "TraceFileWriter.h"
+
+// Optional compression stage in front of TraceFileWriter, with the same API.
+// The stream is cut into FrameSize pieces that a worker thread deflates into independent
+// gzip members, so the output is a plain .gz file (zcat/gunzip read it whole).
+// Only the raw deflate API is used, the internal zlib of the Windows build is 1.1.4.
+//
+// The last member is empty and carries the frame index in its FEXTRA field, readers can
+// seek to any frame start and inflate from there (see readFrameIndex):
+//   frames... | 1f 8b 08 04 ... XLEN 'B' 'Z' LEN | entries[count] | count | "BZKI" | 03 00 | 0 (crc) | 0 (size)
+class TraceFileCompressor
+{
+public:
+	static const size_t FrameSize = 1 << 20; // Uncompressed bytes per gzip member
+	static const unsigned NumFrames = 4; // Frames being filled, queued or compressed
+	static const int Level = 1; // Trace text compresses well even at the fastest level
+
+	// Index entry, stored little endian
+	struct FrameIndexEntry
+	{
+		uint64_t fileOffset; // Start of the gzip member in the file
+		uint64_t rawOffset; // Uncompressed stream offset of its first byte
+	};
+
+	inline TraceFileCompressor()
+	{
+		initialize();
+	}
+
+	inline ~TraceFileCompressor()
+	{
+		if (isOpen)
+			close();
+	}
+
+	inline bool getOpen() const
+	{
+		return isOpen;
+	}
+
+	// Uncompressed bytes written so far
+	inline uint64_t getOffset() const
+	{
+		return streamOffs;
+	}
+
+	// Open the file and start the worker thread
+	bool open(const char *fileName, bool isPaused = false)
+	{
+		if (isOpen || !writer.open(fileName, isPaused))
+			return false;
+
+		initialize(isPaused);
+
+		for (unsigned i = 0; i < NumFrames; i++)
+		{
+			frames[i].raw.resize(size_t(FrameSize));
+			// Stored blocks add 5 bytes per 16K, plus the gzip header and trailer
+			frames[i].comp.resize(size_t(FrameSize + (FrameSize >> 8) + 64));
+			freeQueue.push_back(i);
+		}
+
+		isOpen = true;
+		worker = std::thread(&TraceFileCompressor::workerProc, this);
+
+		return true;
+	}
+
+	// Compress what is left, write the frame index and close the file
+	void close()
+	{
+		if (!isOpen)
+			return;
+
+		drain();
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			quit = true;
+		}
+		cond.notify_all();
+		worker.join();
+
+		writeIndex();
+		writer.close();
+
+		for (unsigned i = 0; i < NumFrames; i++)
+		{
+			std::vector<char>().swap(frames[i].raw);
+			std::vector<Bytef>().swap(frames[i].comp);
+		}
+		isOpen = false;
+	}
+
+	// When going from unpaused to paused, compress and flush everything so the file can be read externally.
+	// The worker writes through the same writer, so it is toggled only while the worker is idle.
+	bool setPause(bool isPaused)
+	{
+		if (isPaused == this->isPaused)
+			return true;
+
+		if (isPaused ? !drain() : !waitIdle())
+			return false;
+
+		this->isPaused = isPaused;
+
+		return writer.setPause(isPaused);
+	}
+
+	inline bool writeLine(const char *line, bool addEol = true)
+	{
+		return write(line, strlen(line), addEol);
+	}
+
+	// Add data to the current frame, handing it to the worker when full
+	// A single call must not add more than FrameSize bytes
+	bool write(const void *data, size_t size, bool addEol = false)
+	{
+#ifdef WIN32
+		static const char eol[] = "\r\n";
+#else
+		static const char eol[] = "\n";
+#endif
+		size_t eolSize = addEol ? sizeof(eol) - 1 : 0;
+
+		if (!isOpen)
+			return false;
+
+		if (frameIdx < 0 && !acquireFrame())
+			return false;
+
+		if (frames[frameIdx].rawSize + size + eolSize > FrameSize)
+		{
+			submitFrame();
+
+			if (!acquireFrame())
+				return false;
+		}
+
+		Frame &frame = frames[frameIdx];
+		memcpy(&frame.raw[frame.rawSize], data, size);
+		memcpy(&frame.raw[frame.rawSize + size], eol, eolSize);
+		frame.rawSize += size + eolSize;
+		streamOffs += size + eolSize;
+
+		return true;
+	}
+
+	// Read the frame index of a complete file. Returns false if the file has none (e.g. still being written).
+	static bool readFrameIndex(FILE *fp, std::vector<FrameIndexEntry> &index)
+	{
+		static const unsigned char tail[10] = { 0x03, 0x00, 0, 0, 0, 0, 0, 0, 0, 0 };
+		unsigned char buf[18];
+
+		index.clear();
+
+		if (fseek(fp, -(long)sizeof(buf), SEEK_END) != 0 || fread(buf, 1, sizeof(buf), fp) != sizeof(buf))
+			return false;
+		if (memcmp(buf + 4, indexMagic(), 4) != 0 || memcmp(buf + 8, tail, sizeof(tail)) != 0)
+			return false;
+
+		uint32_t count = (uint32_t)getLE(buf, 4);
+		long indexSize = (long)(count * sizeof(FrameIndexEntry) + sizeof(buf));
+
+		if (count > MaxIndexEntries || fseek(fp, -indexSize, SEEK_END) != 0)
+			return false;
+
+		index.resize(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			unsigned char entry[16];
+
+			if (fread(entry, 1, sizeof(entry), fp) != sizeof(entry))
+			{
+				index.clear();
+				return false;
+			}
+			index[i].fileOffset = getLE(entry, 8);
+			index[i].rawOffset = getLE(entry + 8, 8);
+		}
+		return true;
+	}
+
+protected:
+	static const char *indexMagic()
+	{
+		return "BZKI";
+	}
+
+	// The index must fit in one FEXTRA subfield
+	static const size_t MaxIndexEntries = (0xFFFF - 4 - 8) / sizeof(FrameIndexEntry);
+
+	struct Frame
+	{
+		std::vector<char> raw;
+		size_t rawSize;
+		std::vector<Bytef> comp;
+	};
+
+	TraceFileWriter writer;
+
+	bool isOpen;
+	bool isPaused;
+
+	// Shared with the worker, protected by mtx
+	std::thread worker;
+	std::mutex mtx;
+	std::condition_variable cond;
+	std::deque<unsigned> freeQueue;
+	std::deque<unsigned> fullQueue;
+	unsigned busyFrames;
+	bool quit;
+	bool failed;
+
+	Frame frames[NumFrames];
+	int frameIdx; // Frame being filled, -1 if none
+	uint64_t streamOffs; // Uncompressed bytes taken by write
+
+	// Only touched by the worker while it runs
+	std::vector<FrameIndexEntry> index;
+	uint64_t fileOffs;
+	uint64_t rawOffs;
+
+	void initialize(bool isPaused = false)
+	{
+		isOpen = false;
+		this->isPaused = isPaused;
+
+		freeQueue.clear();
+		fullQueue.clear();
+		busyFrames = 0;
+		quit = false;
+		failed = false;
+
+		for (unsigned i = 0; i < NumFrames; i++)
+			frames[i].rawSize = 0;
+		frameIdx = -1;
+		streamOffs = 0;
+
+		index.clear();
+		fileOffs = 0;
+		rawOffs = 0;
+	}
+
+	static void putLE(unsigned char *buf, uint64_t val, unsigned size)
+	{
+		for (unsigned i = 0; i < size; i++)
+			buf[i] = (unsigned char)(val >> (i * 8));
+	}
+
+	static uint64_t getLE(const unsigned char *buf, unsigned size)
+	{
+		uint64_t val = 0;
+
+		for (unsigned i = 0; i < size; i++)
+			val |= (uint64_t)buf[i] << (i * 8);
+
+		return val;
+	}
+
+	// Wait for a free frame to fill, this is where a slow worker throttles the caller
+	bool acquireFrame()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+
+		cond.wait(lock, [this] { return !freeQueue.empty() || failed; });
+		if (failed)
+			return false;
+
+		frameIdx = freeQueue.front();
+		freeQueue.pop_front();
+		frames[frameIdx].rawSize = 0;
+
+		return true;
+	}
+
+	void submitFrame()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			fullQueue.push_back(frameIdx);
+		}
+		cond.notify_all();
+
+		frameIdx = -1;
+	}
+
+	// Hand over the partial frame and wait until everything is compressed and written
+	bool drain()
+	{
+		if (frameIdx >= 0 && frames[frameIdx].rawSize > 0)
+			submitFrame();
+
+		return waitIdle();
+	}
+
+	// Wait until the frames handed over are compressed and written, the partial one stays
+	bool waitIdle()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+
+		cond.wait(lock, [this] { return (fullQueue.empty() && busyFrames == 0) || failed; });
+
+		return !failed;
+	}
+
+	void workerProc()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+
+		while (true)
+		{
+			cond.wait(lock, [this] { return !fullQueue.empty() || quit; });
+			if (fullQueue.empty())
+				break;
+
+			unsigned idx = fullQueue.front();
+			fullQueue.pop_front();
+			busyFrames++;
+
+			lock.unlock();
+			bool success = compressFrame(frames[idx]);
+			lock.lock();
+
+			busyFrames--;
+			if (!success)
+				failed = true;
+			freeQueue.push_back(idx);
+
+			cond.notify_all();
+		}
+	}
+
+	// Deflate one frame into a complete gzip member and write it out
+	bool compressFrame(Frame &frame)
+	{
+		static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+		Bytef *comp = frame.comp.data();
+		z_stream zs;
+
+		memset(&zs, 0, sizeof(zs));
+		if (deflateInit2(&zs, Level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return false;
+
+		memcpy(comp, header, sizeof(header));
+
+		zs.next_in = (Bytef *)frame.raw.data();
+		zs.avail_in = (uInt)frame.rawSize;
+		zs.next_out = comp + sizeof(header);
+		zs.avail_out = (uInt)(frame.comp.size() - sizeof(header) - 8);
+
+		int res = deflate(&zs, Z_FINISH);
+		size_t compSize = sizeof(header) + zs.total_out;
+		deflateEnd(&zs);
+
+		if (res != Z_STREAM_END)
+			return false;
+
+		putLE(comp + compSize, crc32(crc32(0, Z_NULL, 0), (const Bytef *)frame.raw.data(), (uInt)frame.rawSize), 4);
+		putLE(comp + compSize + 4, frame.rawSize, 4);
+		compSize += 8;
+
+		FrameIndexEntry entry;
+		entry.fileOffset = fileOffs;
+		entry.rawOffset = rawOffs;
+		index.push_back(entry);
+
+		fileOffs += compSize;
+		rawOffs += frame.rawSize;
+
+		return writeOut(comp, compSize);
+	}
+
+	// TraceFileWriter takes at most a block per call
+	bool writeOut(const void *data, size_t size)
+	{
+		const char *ptr = (const char *)data;
+
+		while (size > 0)
+		{
+			size_t chunk = size;
+			if (chunk > TraceFileWriter::BlockSize)
+				chunk = TraceFileWriter::BlockSize;
+
+			if (!writer.write(ptr, chunk))
+				return false;
+
+			ptr += chunk;
+			size -= chunk;
+		}
+		return true;
+	}
+
+	// Append the empty gzip member holding the frame index
+	bool writeIndex()
+	{
+		// Thin out a very long index rather than drop it, seeking just gets coarser
+		while (index.size() > MaxIndexEntries)
+		{
+			for (size_t i = 0; i < index.size() / 2; i++)
+				index[i] = index[i * 2];
+			index.resize(index.size() / 2);
+		}
+
+		size_t dataSize = index.size() * sizeof(FrameIndexEntry) + 8;
+		std::vector<unsigned char> member(10 + 2 + 4 + dataSize + 2 + 8, 0);
+		unsigned char *ptr = member.data();
+
+		static const unsigned char header[10] = { 0x1f, 0x8b, 8, 4 /* FEXTRA */, 0, 0, 0, 0, 0, 0xff };
+		memcpy(ptr, header, sizeof(header)); ptr += sizeof(header);
+		putLE(ptr, 4 + dataSize, 2); ptr += 2;
+		ptr[0] = 'B'; ptr[1] = 'Z'; ptr += 2;
+		putLE(ptr, dataSize, 2); ptr += 2;
+
+		for (size_t i = 0; i < index.size(); i++)
+		{
+			putLE(ptr, index[i].fileOffset, 8); ptr += 8;
+			putLE(ptr, index[i].rawOffset, 8); ptr += 8;
+		}
+		putLE(ptr, index.size(), 4); ptr += 4;
+		memcpy(ptr, indexMagic(), 4); ptr += 4;
+
+		// Empty final block, crc and size stay 0
+		ptr[0] = 0x03;
+
+		return writeOut(member.data(), member.size());
+	}
+};
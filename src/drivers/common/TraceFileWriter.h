@@ -0,0 +1,447 @@
+#pragma once
+
+#ifdef WIN32
+
+#include "../win/TraceFileWriter.h"
+
+#else
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <aio.h>
+
+// POSIX version of drivers/win/TraceFileWriter.h, same API for the trace loggers.
+// Blocks are written with direct I/O (O_DIRECT, or F_NOCACHE on macOS) through POSIX aio,
+// with up to NumBuffers - 1 writes in flight while the next buffer is being filled.
+// getLastError returns an errno value instead of a Windows error code.
+class TraceFileWriter
+{
+public:
+	static const size_t BlockSize = 4 << 10;
+	static const size_t BuffSize = BlockSize * 257;
+	static const size_t FlushSize = BlockSize * 256;
+	static const unsigned NumBuffers = 4;
+
+	inline TraceFileWriter()
+	{
+		initialize();
+	}
+
+	inline ~TraceFileWriter()
+	{
+		if (isOpen)
+			close();
+	}
+
+	inline bool getOpen() const
+	{
+		return isOpen;
+	}
+
+	// Bytes written so far, including what is still buffered
+	inline uint64_t getOffset() const
+	{
+		return fileOffs + buffOffs;
+	}
+
+	// 0 if no error, otherwise the errno of the last failure
+	inline int getLastError() const
+	{
+		return lastErr;
+	}
+
+	// Open the file and allocate all necessary resources
+	bool open(const char *fileName, bool isPaused = false)
+	{
+		int file = openFile(fileName);
+		if (file == -1)
+		{
+			lastErr = errno;
+			return false;
+		}
+
+		initialize(false, isPaused, fileName, file);
+
+		// Allocate resources, direct I/O needs block aligned buffers
+		for (unsigned i = 0; i < NumBuffers; i++)
+		{
+			void *buff = nullptr;
+
+			lastErr = posix_memalign(&buff, BlockSize, BuffSize);
+			if (lastErr)
+				break;
+
+			buffers[i] = (char *)buff;
+		}
+
+		if (!lastErr)
+			isOpen = true;
+		else
+			// Free resources on failure
+			cleanup();
+
+		return isOpen;
+	}
+
+	// Close the file and free resources
+	void close()
+	{
+		if (!isOpen)
+		{
+			lastErr = EBADF;
+			return;
+		}
+
+		for (unsigned i = 0; i < NumBuffers; i++)
+			waitForBuffer(i);
+
+		writeTail();
+
+		cleanup();
+	}
+
+	// When going from unpaused to paused, flush file and set end of file so it can be accessed externally
+	bool setPause(bool isPaused)
+	{
+		if (isPaused && !this->isPaused)
+		{
+			// Wait for any outstanding writes to complete
+			for (unsigned i = 0; i < NumBuffers; i++)
+			{
+				if (!waitForBuffer(i))
+					return false;
+			}
+
+			// Write out anything still in the buffer
+			if (!writeTail())
+				return false;
+		}
+
+		this->isPaused = isPaused;
+		lastErr = 0;
+
+		return true;
+	}
+
+	// Add a line to the buffer and write it out when the buffer is filled
+	// Under most failure cirumstances the line is added to the buffer
+	inline bool writeLine(const char *line, bool addEol = true)
+	{
+		return write(line, strlen(line), addEol);
+	}
+
+	// Add raw data (e.g. binary trace records) to the buffer and write it out when the buffer is filled
+	// A single call must not add more than BlockSize bytes
+	bool write(const void *data, size_t size, bool addEol = false)
+	{
+		if (!isOpen)
+		{
+			lastErr = EBADF;
+			return false;
+		}
+
+		// Add to buffer
+		size_t eolSize = addEol ? 1 : 0;
+		char *buff = buffers[buffIdx];
+		if (buffOffs + size + eolSize > BuffSize)
+		{
+			// Buffer is full. This shouldn't ever happen.
+			lastErr = ENOBUFS;
+			return false;
+		}
+
+		memcpy(buff + buffOffs, data, size);
+		if (addEol)
+			buff[buffOffs + size] = '\n';
+		buffOffs += size + eolSize;
+
+		// Check if the previous write is done, to detect it as early as possible
+		unsigned prevBuff = (buffIdx + NumBuffers - 1) % NumBuffers;
+		if (!waitForBuffer(prevBuff, false) && lastErr != EINPROGRESS)
+			return false;
+
+		lastErr = 0;
+
+		if (buffOffs < FlushSize)
+			return true;
+
+		return writeBlocks();
+	}
+
+	// Flush buffer contents. Writes partial blocks, but does NOT set end of file
+	// Do NOT call frequently, as writes may be significantly undersized and cause poor performance
+	bool flush()
+	{
+		if (!isOpen)
+		{
+			lastErr = EBADF;
+			return false;
+		}
+
+		// Write full blocks, if any
+		if (!writeBlocks())
+			return false;
+
+		char *buff = buffers[buffIdx];
+		if (buffOffs != 0)
+		{
+			// Write out partial block at the tail
+			size_t writeSize = (buffOffs + BlockSize - 1) & ~(BlockSize - 1);
+			memset(buff + buffOffs, ' ', writeSize - buffOffs);
+
+			if (!writeSync(buff, writeSize, fileOffs))
+				return false;
+
+			// Do NOT update buffIdx, buffOffs, or fileOffs, as the partial block must be overwritten later
+		}
+
+		// Wait for all writes to complete
+		for (unsigned i = 0; i < NumBuffers; i++)
+		{
+			if (!waitForBuffer(i))
+				return false;
+		}
+
+		lastErr = 0;
+		return true;
+	}
+
+protected:
+	const size_t NO_WRITE = size_t(-1);
+
+	int lastErr;
+
+	bool isOpen;
+	bool isPaused;
+
+	std::string fileName;
+	int file;
+
+	// Ring of buffers, each with its own aio control block
+	char *buffers[NumBuffers];
+	struct aiocb cbs[NumBuffers];
+	size_t bytesToWrite[NumBuffers]; // Write in progress size or size_t(-1) if none
+
+	unsigned buffIdx;
+	size_t buffOffs;
+	uint64_t fileOffs;
+
+	// Open for writing, bypassing the page cache where the file system allows it
+	static int openFile(const char *fileName)
+	{
+		const int flags = O_CREAT | O_WRONLY | O_TRUNC;
+		const mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+		int file;
+
+#ifdef O_DIRECT
+		file = ::open(fileName, flags | O_DIRECT, mode);
+
+		// Some file systems (e.g. tmpfs) refuse direct I/O, use the page cache there
+		if (file != -1 || errno != EINVAL)
+			return file;
+#endif
+		file = ::open(fileName, flags, mode);
+
+#ifdef F_NOCACHE
+		if (file != -1)
+			fcntl(file, F_NOCACHE, 1);
+#endif
+		return file;
+	}
+
+	// Put the class into a defined state, but does NOT allocate resources
+	void initialize(bool isOpen = false, bool isPaused = false, const char *fileName = "", int file = -1)
+	{
+		lastErr = 0;
+
+		this->isOpen = isOpen;
+		this->isPaused = isPaused;
+
+		this->fileName = fileName;
+		this->file = file;
+
+		for (unsigned i = 0; i < NumBuffers; i++)
+		{
+			buffers[i] = nullptr;
+			bytesToWrite[i] = NO_WRITE;
+		}
+
+		memset(cbs, 0, sizeof(cbs));
+
+		buffIdx = 0;
+		buffOffs = 0;
+		fileOffs = 0;
+	}
+
+	// Close file and release resources. Does NOT wait for writes to complete.
+	void cleanup()
+	{
+		isOpen = false;
+
+		if (file != -1)
+		{
+			::close(file);
+			file = -1;
+		}
+
+		for (unsigned i = 0; i < NumBuffers; i++)
+		{
+			if (buffers[i] != nullptr)
+				free(buffers[i]);
+
+			buffers[i] = nullptr;
+		}
+	}
+
+	// Write out as many blocks as present in the buffer
+	bool writeBlocks()
+	{
+		if (buffOffs < BlockSize)
+			return true;
+
+		char *buff = buffers[buffIdx];
+		unsigned nextBuff = (buffIdx + 1) % NumBuffers;
+
+		// The next buffer may still be in flight from NumBuffers writes ago
+		if (!waitForBuffer(nextBuff))
+			return false; // Catastrophic failure case
+
+		size_t writeSize = buffOffs - (buffOffs % BlockSize);
+		if (!beginWrite(writeSize))
+			return false;
+
+		// Switch to next buffer
+
+		memcpy(buffers[nextBuff], buff + writeSize, buffOffs - writeSize);
+		buffOffs -= writeSize;
+
+		fileOffs += writeSize;
+
+		buffIdx = nextBuff;
+
+		return true;
+	}
+
+	// Begin a write and handle errors without updating class state
+	bool beginWrite(size_t writeSize)
+	{
+		bytesToWrite[buffIdx] = NO_WRITE;
+
+		if (writeSize % BlockSize != 0)
+		{
+			lastErr = EINVAL;
+			return false;
+		}
+
+		struct aiocb *cb = &cbs[buffIdx];
+		memset(cb, 0, sizeof(*cb));
+		cb->aio_fildes = file;
+		cb->aio_buf = buffers[buffIdx];
+		cb->aio_nbytes = writeSize;
+		cb->aio_offset = (off_t)fileOffs;
+		cb->aio_sigevent.sigev_notify = SIGEV_NONE;
+
+		if (aio_write(cb) == 0)
+		{
+			bytesToWrite[buffIdx] = writeSize;
+			lastErr = 0;
+			return true;
+		}
+
+		// Request queue full or no aio support, complete the write synchronously
+		return writeSync(buffers[buffIdx], writeSize, fileOffs);
+	}
+
+	// Blocking write of whole blocks at the given file offset
+	bool writeSync(const char *buff, size_t writeSize, uint64_t offs)
+	{
+		while (writeSize > 0)
+		{
+			ssize_t written = pwrite(file, buff, writeSize, (off_t)offs);
+			if (written < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				lastErr = errno;
+				return false;
+			}
+
+			buff += written;
+			writeSize -= written;
+			offs += written;
+		}
+
+		lastErr = 0;
+		return true;
+	}
+
+	// Set the end of file so it can be accessed
+	bool setEndOfFile()
+	{
+		if (ftruncate(file, (off_t)(fileOffs + buffOffs)) != 0
+			|| fsync(file) != 0)
+		{
+			lastErr = errno;
+			return false;
+		}
+
+		lastErr = 0;
+		return true;
+	}
+
+	// Write out everything in the buffer and set the file end for pausing
+	inline bool writeTail()
+	{
+		return flush() && setEndOfFile();
+	}
+
+	// Wait for an a buffer to become available, waiting for write completion if requested
+	bool waitForBuffer(unsigned buffIdx, bool wait = true)
+	{
+		if (buffIdx >= NumBuffers)
+			lastErr = EINVAL;
+		else if (bytesToWrite[buffIdx] == NO_WRITE)
+			// No write in progress
+			lastErr = 0;
+		else
+		{
+			struct aiocb *cb = &cbs[buffIdx];
+			int err;
+
+			// Wait for the operation to complete
+			while ((err = aio_error(cb)) == EINPROGRESS)
+			{
+				if (!wait)
+				{
+					lastErr = EINPROGRESS;
+					return false;
+				}
+
+				const struct aiocb *list[1] = { cb };
+				aio_suspend(list, 1, nullptr);
+			}
+
+			// Verify it succeeded
+			ssize_t prevBytesWritten = aio_return(cb);
+			if (err != 0)
+				lastErr = err;
+			else if (prevBytesWritten != (ssize_t)bytesToWrite[buffIdx])
+				lastErr = EIO;
+			else
+				lastErr = 0;
+
+			bytesToWrite[buffIdx] = NO_WRITE;
+		}
+
+		return !lastErr;
+	}
+};
+
+#endif
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "../../types.h"
+#include "../../x6502.h"
+#include "../../debug.h"
+
+struct traceFilterRange_t
+{
+	unsigned long first;
+	unsigned long last;
+};
+
+// Reads "first-last" ranges and single values separated by commas or spaces, in the given base.
+// Returns false, with ranges empty, if the text is something else or a value is above max.
+inline bool traceFilter_ParseRanges(const char *txt, int base, unsigned long max, std::vector<traceFilterRange_t> &ranges)
+{
+	ranges.clear();
+
+	while (*txt != 0)
+	{
+		traceFilterRange_t range;
+		char *end;
+
+		if (*txt == ',' || *txt == ' ')
+		{
+			txt++;
+			continue;
+		}
+		range.first = strtoul(txt, &end, base);
+		range.last = range.first;
+
+		if (end == txt)
+			break;
+
+		txt = end;
+		if (*txt == '-')
+		{
+			txt++;
+			range.last = strtoul(txt, &end, base);
+			if (end == txt)
+				break;
+			txt = end;
+		}
+		if (range.first > max || range.last > max || range.last < range.first)
+			break;
+
+		ranges.push_back(range);
+	}
+
+	if (*txt != 0)
+	{
+		ranges.clear();
+		return false;
+	}
+	return true;
+}
+
+// Capture-time filter of the trace loggers, checked before anything of an instruction is captured,
+// formatted or buffered. compile turns the rules into a verdict byte per CPU address, so where the
+// address alone decides, a filtered out instruction costs one load and one branch. Only the bytes
+// for $6000-$FFFF of bank and RAM rules (the mapper decides what is there) and every byte of the
+// interrupt rules ask for more.
+class TraceFilter
+{
+public:
+	// Interrupt rules, log only instructions inside these handlers (see X6502_IntDepth)
+	static const unsigned int IntNmi = 0x01;
+	static const unsigned int IntIrq = 0x02; // BRK included
+
+	inline TraceFilter()
+		: ramOnly(false), intMask(0), hasBanks(false), isActive(false)
+	{
+		memset(table, 0, sizeof(table));
+	}
+
+	// "8000-9FFF, E000-FFFF", empty for every address
+	inline bool setPcRanges(const char *txt)
+	{
+		return traceFilter_ParseRanges(txt, 16, 0xFFFF, pcRanges);
+	}
+
+	// Banks as the BZK trace numbers them, bzk_getBank of the ROM file address: "0-3, 62"
+	inline bool setBanks(const char *txt)
+	{
+		return traceFilter_ParseRanges(txt, 10, MaxBank, banks);
+	}
+
+	// Code run from RAM (and SRAM) only
+	inline void setRamOnly(bool ramOnly)
+	{
+		this->ramOnly = ramOnly;
+	}
+
+	// IntNmi and/or IntIrq, 0 for no interrupt rule
+	inline void setInterrupts(unsigned int mask)
+	{
+		intMask = mask;
+	}
+
+	// Build the table from the rules, must not run while an instruction is checked
+	void compile()
+	{
+		hasBanks = banks.size() > 0;
+		memset(bankAllowed, 0, sizeof(bankAllowed));
+
+		for (size_t i = 0; i < banks.size(); i++)
+		{
+			for (unsigned long b = banks[i].first; b <= banks[i].last; b++)
+				bankAllowed[b] = 1;
+		}
+
+		isActive = pcRanges.size() || hasBanks || ramOnly || intMask;
+
+		for (unsigned int pc = 0; pc < 0x10000; pc++)
+		{
+			uint8 v = 0;
+
+			if (!inRanges(pc))
+			{
+				v = Drop;
+			}
+			else if (pc < 0x6000)
+			{
+				// RAM and registers, bzk_GetNesFileAddress doesn't depend on the mapper here
+				if (hasBanks && !bankAllowed[bzk_getBank(pc + 0x100000)])
+					v = Drop;
+			}
+			else if (hasBanks || (ramOnly && pc < 0x8000))
+			{
+				v = CheckPrg;
+			}
+			else if (ramOnly)
+			{
+				v = Drop;
+			}
+
+			if (v != Drop && intMask)
+				v |= CheckInt;
+
+			table[pc] = v;
+		}
+	}
+
+	inline bool getActive() const
+	{
+		return isActive;
+	}
+
+	// True if the instruction at pc is to be logged
+	inline bool pass(unsigned int pc) const
+	{
+		uint8 v = table[pc];
+
+		if (v & Drop)
+			return false;
+		if (v == 0)
+			return true;
+
+		return passSlow(pc, v);
+	}
+
+protected:
+	static const unsigned long MaxBank = 1023;
+
+	// table bytes
+	static const uint8 Drop = 0x01;
+	static const uint8 CheckPrg = 0x02; // bank or RAM rule on what the mapper put there
+	static const uint8 CheckInt = 0x04;
+
+	uint8 table[0x10000];
+	uint8 bankAllowed[MaxBank + 1];
+	std::vector<traceFilterRange_t> pcRanges;
+	std::vector<traceFilterRange_t> banks;
+	bool ramOnly;
+	unsigned int intMask;
+	bool hasBanks;
+	bool isActive;
+
+	bool inRanges(unsigned int pc) const
+	{
+		if (pcRanges.size() == 0)
+			return true;
+
+		for (size_t i = 0; i < pcRanges.size(); i++)
+		{
+			if (pc >= pcRanges[i].first && pc <= pcRanges[i].last)
+				return true;
+		}
+		return false;
+	}
+
+	bool passSlow(unsigned int pc, uint8 v) const
+	{
+		if (v & CheckPrg)
+		{
+			int addr = bzk_GetNesFileAddress(pc);
+
+			// SRAM at $6000-$7FFF comes back as a RAM address, like in the BZK trace
+			if (ramOnly && addr < 0x100000)
+				return false;
+
+			if (hasBanks)
+			{
+				int bank = bzk_getBank(addr);
+
+				if (bank < 0 || bank > (int)MaxBank || !bankAllowed[bank])
+					return false;
+			}
+		}
+
+		if (v & CheckInt)
+		{
+			if (X6502_IntDepth == 0)
+				return false;
+
+			return (X6502_IntKinds & 1) ? (intMask & IntNmi) != 0 : (intMask & IntIrq) != 0;
+		}
+		return true;
+	}
+};
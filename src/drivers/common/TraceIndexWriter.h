@@ -0,0 +1,166 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "../../bzktrace.h"
+
+// Writes BZK_TRACE_INDEX_NAME (see bzktrace.h) for the BZK trace loggers. The client passes every
+// record it is about to write to isIndexPoint, and when that says so, ends its loop folding and
+// calls add with the file number and the byte offset the record goes to.
+// Entries are rare (a few per frame), so plain buffered stdio is enough. The buffer is flushed
+// when emulation pauses, so external tools see the index up to there while a capture goes on.
+class TraceIndexWriter
+{
+public:
+	inline TraceIndexWriter()
+		: fp(nullptr), flags(0), lastFrame(0), hasFrame(false), isPaused(false)
+	{
+	}
+
+	inline ~TraceIndexWriter()
+	{
+		close();
+	}
+
+	inline bool getOpen() const
+	{
+		return fp != nullptr;
+	}
+
+	// Continue the index in dir ("" or a path ending in a separator), or start one.
+	// flags are the BZK_INDEX_ flags of the files of this session.
+	bool open(const std::string &dir, unsigned int flags, bool isPaused)
+	{
+		if (fp != nullptr)
+			return false;
+
+		std::string path = dir + BZK_TRACE_INDEX_NAME;
+		bzkTraceIndexHeader_t hdr;
+
+		fp = fopen(path.c_str(), "r+b");
+		if (fp != nullptr)
+		{
+			if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || bzkTrace_CheckIndexHeader(&hdr) != 0)
+			{
+				// Not an index this version understands, start over
+				fclose(fp);
+				fp = nullptr;
+			}
+			else if (!appendAfterLastEntry())
+			{
+				fclose(fp);
+				fp = nullptr;
+				return false;
+			}
+		}
+
+		if (fp == nullptr)
+		{
+			fp = fopen(path.c_str(), "w+b");
+			if (fp == nullptr)
+				return false;
+
+			bzkTrace_InitIndexHeader(&hdr);
+			if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+			{
+				fclose(fp);
+				fp = nullptr;
+				return false;
+			}
+		}
+
+		this->flags = (unsigned char)flags;
+		this->isPaused = isPaused;
+		hasFrame = false;
+
+		return true;
+	}
+
+	void close()
+	{
+		if (fp == nullptr)
+			return;
+
+		fclose(fp);
+		fp = nullptr;
+	}
+
+	// True when the record of this instruction starts a frame or an NMI handler
+	inline bool isIndexPoint(uint32 frame, bool isNmi) const
+	{
+		return fp != nullptr && (isNmi || !hasFrame || frame != lastFrame);
+	}
+
+	// Add the entries for the record about to be written at offset in file fileIdx
+	bool add(uint32 fileIdx, uint64 offset, uint32 frame, uint64 instr, bool isNmi)
+	{
+		bool success = true;
+
+		if (fp == nullptr)
+			return false;
+
+		if (!hasFrame || frame != lastFrame)
+		{
+			success = writeEntry(BZK_INDEX_FRAME, fileIdx, offset, frame, instr);
+			lastFrame = frame;
+			hasFrame = true;
+		}
+		if (isNmi)
+		{
+			success = writeEntry(BZK_INDEX_NMI, fileIdx, offset, frame, instr) && success;
+		}
+		return success;
+	}
+
+	// When going from unpaused to paused, write the buffered entries out
+	bool setPause(bool isPaused)
+	{
+		bool success = true;
+
+		if (isPaused && !this->isPaused && fp != nullptr)
+			success = fflush(fp) == 0;
+
+		this->isPaused = isPaused;
+
+		return success;
+	}
+
+protected:
+	FILE *fp;
+	unsigned char flags;
+	uint32 lastFrame;
+	bool hasFrame;
+	bool isPaused;
+
+	// Skip a partial entry left by a session that crashed, so the new ones stay aligned
+	bool appendAfterLastEntry()
+	{
+		if (fseek(fp, 0, SEEK_END) != 0)
+			return false;
+
+		long size = ftell(fp);
+		if (size < (long)sizeof(bzkTraceIndexHeader_t))
+			return false;
+
+		long entries = (size - (long)sizeof(bzkTraceIndexHeader_t)) / (long)sizeof(bzkTraceIndexEntry_t);
+
+		return fseek(fp, (long)sizeof(bzkTraceIndexHeader_t) + entries * (long)sizeof(bzkTraceIndexEntry_t), SEEK_SET) == 0;
+	}
+
+	bool writeEntry(unsigned char kind, uint32 fileIdx, uint64 offset, uint32 frame, uint64 instr)
+	{
+		bzkTraceIndexEntry_t entry;
+
+		memset(&entry, 0, sizeof(entry));
+		entry.fileIdx = fileIdx;
+		entry.kind = kind;
+		entry.flags = flags;
+		entry.frame = frame;
+		entry.instruction = instr;
+		entry.offset = offset;
+
+		return fwrite(&entry, sizeof(entry), 1, fp) == 1;
+	}
+};
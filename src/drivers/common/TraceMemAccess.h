@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "../../types.h"
+#include "TraceFilter.h"
+
+// Memory access trace of the trace loggers: every CPU bus access (reads, writes and opcode
+// fetches, dummy reads, read-modify-write double writes, sprite DMA and interrupt vector fetches
+// included) in the order the core makes them. A file is a traceMemHeader_t followed by
+// traceMemAccess_t records back to back.
+#define TRACE_MEM_MAGIC      "FCEUMEMT"
+#define TRACE_MEM_VERSION    1
+#define TRACE_MEM_BYTE_ORDER 0x0102
+#define TRACE_MEM_EXT        ".mem"
+
+// traceMemAccess_t::kind
+#define TRACE_MEM_READ  0
+#define TRACE_MEM_WRITE 1
+#define TRACE_MEM_EXEC  2 // read that fetched an opcode
+
+struct traceMemAccess_t
+{
+	uint64 cycle; // CPU cycle counter, which the core advances by a whole instruction right after its opcode fetch
+	uint16 addr;
+	uint16 pc;    // address of the instruction making the access, the last one executed for interrupt entry
+	uint8  value;
+	uint8  kind;
+	uint8  reserved[2];
+};
+
+struct traceMemHeader_t
+{
+	char   magic[8];
+	uint16 version;
+	uint16 byteOrder;
+	uint16 recordSize;
+	uint16 reserved;
+};
+
+inline void traceMem_InitHeader(traceMemHeader_t *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, TRACE_MEM_MAGIC, sizeof(hdr->magic));
+	hdr->version = TRACE_MEM_VERSION;
+	hdr->byteOrder = TRACE_MEM_BYTE_ORDER;
+	hdr->recordSize = sizeof(traceMemAccess_t);
+}
+
+// Address ranges a memory access trace is limited to, set from text like "0000-07FF, 4016".
+// No ranges lets every address through. Like TraceFilter, a byte per address decides.
+class TraceMemFilter
+{
+public:
+	inline TraceMemFilter()
+	{
+		memset(table, 1, sizeof(table));
+	}
+
+	// Returns false, and lets every address through, if the text isn't a list of
+	// hex addresses and ranges separated by commas or spaces
+	bool parse(const char *txt)
+	{
+		std::vector<traceFilterRange_t> ranges;
+
+		bool success = traceFilter_ParseRanges(txt, 16, 0xFFFF, ranges);
+
+		memset(table, ranges.size() ? 0 : 1, sizeof(table));
+
+		for (size_t i = 0; i < ranges.size(); i++)
+		{
+			memset(&table[ranges[i].first], 1, ranges[i].last - ranges[i].first + 1);
+		}
+		return success;
+	}
+
+	inline bool match(unsigned int addr) const
+	{
+		return table[addr] != 0;
+	}
+
+protected:
+	uint8 table[0x10000];
+};
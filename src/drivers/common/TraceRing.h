@@ -0,0 +1,185 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+// Single producer, single consumer ring between the emulation thread and a trace disk thread.
+// The producer fills a slot in place (claim, commit) and makes committed slots visible in batches
+// of PublishBatch, or when it calls publish (once a frame and when emulation pauses).
+// The consumer takes every published slot that is contiguous in memory at once (peek) and hands
+// them back (release). Head and tail are stored with release and loaded with acquire semantics,
+// so slot contents are visible to the other thread on weakly ordered CPUs too.
+// Neither side polls, a side that has to wait sleeps on the condition variable and the other
+// side only takes the mutex to wake it when it said it is waiting.
+template <typename T>
+class TraceRing
+{
+public:
+	static const size_t PublishBatch = 256;
+
+	inline TraceRing()
+		: buf(nullptr), capacity(0), head(0), tail(0), claimHead(0), pending(0),
+		  isOpen(false), consumerWaiting(false), producerWaiting(false), woken(false)
+	{
+	}
+
+	inline ~TraceRing()
+	{
+		free(buf);
+	}
+
+	// Allocate room for capacity - 1 records, if not done already, and start with an empty ring.
+	// Must not be called while the producer may use the ring.
+	bool open(size_t capacity)
+	{
+		if (buf == nullptr || this->capacity != capacity)
+		{
+			free(buf);
+			buf = (T *)malloc(capacity * sizeof(T));
+			this->capacity = buf ? capacity : 0;
+		}
+		if (buf == nullptr)
+			return false;
+
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+		claimHead = 0;
+		pending = 0;
+
+		isOpen.store(true, std::memory_order_release);
+		return true;
+	}
+
+	// The producer stops adding records, what is left in the ring is lost
+	inline void close()
+	{
+		isOpen.store(false, std::memory_order_release);
+		wakeAll();
+	}
+
+	// Give the memory back, the ring must be closed
+	void freeBuffer()
+	{
+		free(buf);
+		buf = nullptr;
+		capacity = 0;
+	}
+
+	inline bool getOpen() const
+	{
+		return isOpen.load(std::memory_order_acquire);
+	}
+
+	// Producer: the next free slot, or nullptr if the consumer didn't free one within timeoutMs
+	T *claim(unsigned int timeoutMs)
+	{
+		size_t next = advance(claimHead, 1);
+
+		if (next == tail.load(std::memory_order_acquire))
+		{
+			// Full, the consumer can't have seen the pending batch yet either
+			publish();
+
+			std::unique_lock<std::mutex> lock(mtx);
+			producerWaiting.store(true);
+			cond.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+				[this, next] { return next != tail.load() || !getOpen(); });
+			producerWaiting.store(false);
+
+			if (next == tail.load(std::memory_order_acquire))
+				return nullptr;
+		}
+		return &buf[claimHead];
+	}
+
+	// Producer: add the claimed slot to the batch, publishing it when it is large enough
+	inline void commit()
+	{
+		claimHead = advance(claimHead, 1);
+
+		if (++pending >= PublishBatch)
+			publish();
+	}
+
+	// Producer: make every committed slot visible to the consumer
+	void publish()
+	{
+		if (pending == 0)
+			return;
+
+		pending = 0;
+		head.store(claimHead);
+
+		if (consumerWaiting.load())
+			wakeAll();
+	}
+
+	// Consumer: number of published records starting at *first, that are contiguous in memory
+	size_t peek(T **first)
+	{
+		size_t h = head.load(std::memory_order_acquire);
+		size_t t = tail.load(std::memory_order_relaxed);
+
+		*first = &buf[t];
+
+		return h >= t ? h - t : capacity - t;
+	}
+
+	// Consumer: hand back the first n records returned by peek
+	void release(size_t n)
+	{
+		tail.store(advance(tail.load(std::memory_order_relaxed), n));
+
+		if (producerWaiting.load())
+			wakeAll();
+	}
+
+	// Consumer: sleep until records are published, the ring is woken up or timeoutMs passed
+	void waitForData(unsigned int timeoutMs)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+
+		consumerWaiting.store(true);
+		cond.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+			[this] { return woken || head.load() != tail.load(std::memory_order_relaxed); });
+		consumerWaiting.store(false);
+		woken = false;
+	}
+
+	// Wake whichever side is sleeping, e.g. so the consumer sees an interruption request
+	inline void wakeAll()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			woken = true;
+		}
+		cond.notify_all();
+	}
+
+protected:
+	T *buf;
+	size_t capacity;
+
+	std::atomic<size_t> head; // published by the producer
+	std::atomic<size_t> tail; // released by the consumer
+	size_t claimHead;         // producer only, head plus the unpublished batch
+	size_t pending;
+
+	std::atomic<bool> isOpen;
+	std::atomic<bool> consumerWaiting;
+	std::atomic<bool> producerWaiting;
+
+	std::mutex mtx;
+	std::condition_variable cond;
+	bool woken; // guarded by mtx, set by wakeAll
+
+	inline size_t advance(size_t idx, size_t n) const
+	{
+		idx += n;
+		return idx >= capacity ? idx - capacity : idx;
+	}
+};
@@ -0,0 +1,403 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "../../bzktrace.h"
+
+// Memory mapped alternative to TraceFileWriter for the BZK trace loggers, with a similar API.
+// Every segment is a z%05d_fceux.* file preallocated to SegmentSize bytes and mapped into memory,
+// so a write is a memcpy and the OS writes the pages back on its own time. The file gets its
+// final name right away and is only trimmed to its real length when the next segment is mapped.
+//
+// The segments are listed in BZK_SEGMENT_INDEX_NAME (see bzktrace.h) next to them, with the
+// first frame, first instruction count and length of each. The index also holds the next file
+// number, so starting a session doesn't have to look for the files of earlier ones. The entry of
+// the open segment is refreshed every IndexUpdateSize bytes and when emulation pauses, external
+// tools can read that many bytes of it while the capture goes on.
+class TraceSegmentWriter
+{
+public:
+	static const size_t SegmentSize = 128 << 20;
+	// The client moves on to the next segment once less than this is left (see isFull),
+	// enough for whatever it writes between two checks
+	static const size_t SegmentSlack = 64 << 10;
+	static const size_t IndexUpdateSize = 4 << 20;
+
+	inline TraceSegmentWriter()
+	{
+		initialize();
+	}
+
+	inline ~TraceSegmentWriter()
+	{
+		if (isOpen)
+			close();
+	}
+
+	inline bool getOpen() const
+	{
+		return isOpen;
+	}
+
+	// z%05d number of the segment being written
+	inline int getFileIdx() const
+	{
+		return (int)entry.fileIdx;
+	}
+
+	inline std::string currentFileName() const
+	{
+		return fileName(entry.fileIdx);
+	}
+
+	// Bytes written into the current segment
+	inline uint64 getOffset() const
+	{
+		return used;
+	}
+
+	// True when the client should call nextSegment before its next records
+	inline bool isFull() const
+	{
+		return used + SegmentSlack > SegmentSize;
+	}
+
+	// Read or create the index in dir ("" or a path ending in a separator) and map the first segment,
+	// frame and instr are the counters of the first instruction that goes into it
+	bool open(const std::string &dir, const char *ext, bool isBinary, bool isPaused, uint32 frame, uint64 instr)
+	{
+		if (isOpen)
+			return false;
+
+		initialize();
+
+		this->dir = dir;
+		this->ext = ext;
+		this->isBinary = isBinary;
+		this->isPaused = isPaused;
+
+		if (!openIndex())
+			return false;
+
+		if (!mapSegment(frame, instr))
+		{
+			fclose(index);
+			index = nullptr;
+			return false;
+		}
+
+		isOpen = true;
+		return true;
+	}
+
+	// Trim the current segment to its length and map the next one
+	bool nextSegment(uint32 frame, uint64 instr)
+	{
+		if (!isOpen)
+			return false;
+
+		bool success = unmapSegment();
+
+		return mapSegment(frame, instr) && success;
+	}
+
+	// Trim the current segment and close the index
+	void close()
+	{
+		if (!isOpen)
+			return;
+
+		unmapSegment();
+
+		fclose(index);
+		index = nullptr;
+		isOpen = false;
+	}
+
+	// When going from unpaused to paused, start writing the pages back and publish the length in the index
+	bool setPause(bool isPaused)
+	{
+		bool success = true;
+
+		if (isPaused && !this->isPaused && base != nullptr)
+		{
+#ifdef WIN32
+			FlushViewOfFile(base, used);
+#else
+			msync(base, (used + pageSize - 1) & ~(size_t)(pageSize - 1), MS_ASYNC);
+#endif
+			success = writeEntry();
+		}
+
+		this->isPaused = isPaused;
+
+		return success;
+	}
+
+	inline bool writeLine(const char *line, bool addEol = true)
+	{
+		return write(line, strlen(line), addEol);
+	}
+
+	// Copy data into the mapped segment. Fails without writing anything if the segment is full,
+	// which doesn't happen while the client checks isFull between records.
+	bool write(const void *data, size_t size, bool addEol = false)
+	{
+#ifdef WIN32
+		static const char eol[] = "\r\n";
+#else
+		static const char eol[] = "\n";
+#endif
+		size_t eolSize = addEol ? sizeof(eol) - 1 : 0;
+
+		if (base == nullptr || used + size + eolSize > SegmentSize)
+			return false;
+
+		memcpy(base + used, data, size);
+		if (addEol)
+			memcpy(base + used + size, eol, eolSize);
+		used += size + eolSize;
+
+		if (used - entry.length >= IndexUpdateSize)
+			return writeEntry();
+
+		return true;
+	}
+
+protected:
+	bool isOpen;
+	bool isPaused;
+	bool isBinary;
+
+	std::string dir;
+	const char *ext;
+
+	FILE *index;
+	bzkSegmentIndexHeader_t indexHdr;
+	bzkSegmentIndexEntry_t entry; // entry of the mapped segment, length is what the index says
+	uint32 entryPos;
+
+	char *base; // mapped segment or nullptr
+	size_t used;
+#ifdef WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int file;
+	long pageSize;
+#endif
+
+	// Put the class into a defined state, but does NOT allocate resources
+	void initialize()
+	{
+		isOpen = false;
+		isPaused = false;
+		isBinary = false;
+
+		dir.clear();
+		ext = "";
+
+		index = nullptr;
+		memset(&indexHdr, 0, sizeof(indexHdr));
+		memset(&entry, 0, sizeof(entry));
+		entryPos = 0;
+
+		base = nullptr;
+		used = 0;
+#ifdef WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = nullptr;
+#else
+		file = -1;
+		pageSize = sysconf(_SC_PAGESIZE);
+#endif
+	}
+
+	std::string fileName(uint32 idx) const
+	{
+		char stmp[64];
+
+		snprintf(stmp, sizeof(stmp), "z%05u_fceux.%s", idx, ext);
+
+		return dir + stmp;
+	}
+
+	static bool fileExists(const std::string &name)
+	{
+		FILE *fp = fopen(name.c_str(), "rb");
+
+		if (fp == nullptr)
+			return false;
+
+		fclose(fp);
+		return true;
+	}
+
+	// Continue an existing index, or start one after the files of earlier (unindexed) sessions
+	bool openIndex()
+	{
+		std::string path = dir + BZK_SEGMENT_INDEX_NAME;
+
+		index = fopen(path.c_str(), "r+b");
+		if (index != nullptr)
+		{
+			if (fread(&indexHdr, sizeof(indexHdr), 1, index) == 1 && bzkTrace_CheckSegmentIndexHeader(&indexHdr) == 0)
+				return true;
+
+			// Not an index this version understands, start over
+			fclose(index);
+		}
+
+		bzkTrace_InitSegmentIndexHeader(&indexHdr, SegmentSize);
+
+		for (int k = 99999; k >= 0; k--)
+		{
+			if (fileExists(fileName(k)))
+			{
+				indexHdr.nextFile = (k + 1) % 100000;
+				break;
+			}
+		}
+
+		index = fopen(path.c_str(), "w+b");
+		if (index == nullptr)
+			return false;
+
+		if (!writeIndexHeader())
+		{
+			fclose(index);
+			index = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	bool writeIndexHeader()
+	{
+		return fseek(index, 0, SEEK_SET) == 0
+			&& fwrite(&indexHdr, sizeof(indexHdr), 1, index) == 1
+			&& fflush(index) == 0;
+	}
+
+	// Store the entry of the current segment with its length so far
+	bool writeEntry()
+	{
+		entry.length = used;
+
+		return fseek(index, (long)(sizeof(indexHdr) + (size_t)entryPos * sizeof(entry)), SEEK_SET) == 0
+			&& fwrite(&entry, sizeof(entry), 1, index) == 1
+			&& fflush(index) == 0;
+	}
+
+	// Create, preallocate and map the next segment, then add it to the index
+	bool mapSegment(uint32 frame, uint64 instr)
+	{
+		uint32 idx = indexHdr.nextFile;
+		std::string name = fileName(idx);
+
+#ifdef WIN32
+		file = CreateFileA(name.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		// A mapping larger than the file extends it, that is the preallocation
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)SegmentSize >> 32), (DWORD)SegmentSize, nullptr);
+		if (mapping != nullptr)
+			base = (char *)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, SegmentSize);
+
+		if (base == nullptr)
+		{
+			if (mapping != nullptr)
+				CloseHandle(mapping);
+			CloseHandle(file);
+			mapping = nullptr;
+			file = INVALID_HANDLE_VALUE;
+			return false;
+		}
+#else
+		const mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+
+		file = ::open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, mode);
+		if (file == -1)
+			return false;
+
+		// Allocate the blocks up front so page faults don't wait for the file system,
+		// where that isn't supported the file is only extended
+		bool sized;
+#ifdef __linux__
+		sized = posix_fallocate(file, 0, (off_t)SegmentSize) == 0 || ftruncate(file, (off_t)SegmentSize) == 0;
+#else
+		sized = ftruncate(file, (off_t)SegmentSize) == 0;
+#endif
+		void *map = sized ? mmap(nullptr, SegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+		if (map == MAP_FAILED)
+		{
+			::close(file);
+			file = -1;
+			return false;
+		}
+#ifdef MADV_SEQUENTIAL
+		madvise(map, SegmentSize, MADV_SEQUENTIAL);
+#endif
+		base = (char *)map;
+#endif
+		used = 0;
+
+		memset(&entry, 0, sizeof(entry));
+		entry.fileIdx = idx;
+		entry.flags = BZK_SEGMENT_OPEN | (isBinary ? BZK_SEGMENT_BINARY : 0);
+		entry.firstFrame = frame;
+		entry.firstInstruction = instr;
+
+		entryPos = indexHdr.count++;
+		indexHdr.nextFile = (idx + 1) % 100000;
+
+		return writeEntry() && writeIndexHeader();
+	}
+
+	// Unmap the segment, trim the file to the data and mark its entry complete
+	bool unmapSegment()
+	{
+		if (base == nullptr)
+			return false;
+
+		bool success;
+#ifdef WIN32
+		LARGE_INTEGER size;
+
+		UnmapViewOfFile(base);
+		CloseHandle(mapping);
+		size.QuadPart = (LONGLONG)used;
+		success = SetFilePointerEx(file, size, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+		CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		munmap(base, SegmentSize);
+		success = ftruncate(file, (off_t)used) == 0;
+		::close(file);
+		file = -1;
+#endif
+		base = nullptr;
+
+		entry.flags &= ~BZK_SEGMENT_OPEN;
+		success = writeEntry() && success;
+
+		// Writes fail until a segment is mapped again, isFull must not keep asking for one
+		used = 0;
+
+		return success;
+	}
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Formats batches of trace records into text on a pool of threads, for the trace disk threads.
+// render cuts a batch into one slice per thread, the calling thread formats the first slice and
+// the workers the others, each straight into its own part of one output buffer. The caller then
+// writes the slices in order (getSlice), so the text comes out as if formatted one by one.
+// The format function runs on several threads at once, it may only read shared state.
+template <typename T>
+class TraceTextRenderer
+{
+public:
+	// Longest line the format function makes, without the terminating 0
+	static const size_t MaxLineLen = 255;
+	// Smaller batches use fewer threads, waking one up costs more than formatting that much
+	static const size_t MinSliceRecs = 256;
+	static const unsigned MaxThreads = 8;
+
+	// Writes the line for rec to line and returns its length
+	typedef int (*FormatFunc)(T &rec, char *line);
+
+	inline TraceTextRenderer()
+		: format(nullptr), maxRecs(0), numThreads(0), recs(nullptr), count(0), sliceRecs(0),
+		  numSlices(0), pending(0), generation(0), quit(false)
+	{
+	}
+
+	inline ~TraceTextRenderer()
+	{
+		stop();
+	}
+
+	// Start the workers. numThreads counts the calling thread, 0 leaves one core to the emulation thread.
+	bool start(FormatFunc format, size_t maxRecs, unsigned numThreads = 0)
+	{
+		if (this->numThreads)
+			return false;
+
+		if (numThreads == 0)
+		{
+			numThreads = std::thread::hardware_concurrency();
+			numThreads = numThreads > 1 ? numThreads - 1 : 1;
+		}
+		if (numThreads > MaxThreads)
+			numThreads = MaxThreads;
+
+		this->format = format;
+		this->maxRecs = maxRecs;
+		this->numThreads = numThreads;
+
+		text.resize(maxRecs * LineSpace);
+		sliceSizes.resize(numThreads);
+
+		quit = false;
+		for (unsigned i = 1; i < numThreads; i++)
+			workers.push_back(std::thread(&TraceTextRenderer::workerProc, this, i, generation));
+
+		return true;
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			quit = true;
+		}
+		startCond.notify_all();
+
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+
+		workers.clear();
+		numThreads = 0;
+	}
+
+	// Format the first count records (at most maxRecs) and return the number of slices they are in
+	unsigned render(T *recs, size_t count)
+	{
+		if (count > maxRecs)
+			count = maxRecs;
+
+		unsigned n = (unsigned)(count / MinSliceRecs);
+		if (n > numThreads)
+			n = numThreads;
+		if (n < 1)
+			n = 1;
+
+		this->recs = recs;
+		this->count = count;
+		sliceRecs = (count + n - 1) / n;
+
+		if (n > 1)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				numSlices = n;
+				pending = n - 1;
+				generation++;
+			}
+			startCond.notify_all();
+		}
+
+		renderSlice(0);
+
+		if (n > 1)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			doneCond.wait(lock, [this] { return pending == 0; });
+		}
+		return n;
+	}
+
+	// Text of a slice from the last render, with line endings
+	inline const char *getSlice(unsigned idx, size_t *size) const
+	{
+		*size = sliceSizes[idx];
+
+		return &text[idx * sliceRecs * LineSpace];
+	}
+
+protected:
+#ifdef WIN32
+	static const size_t EolLen = 2;
+#else
+	static const size_t EolLen = 1;
+#endif
+	// Room for a line, its terminating 0 and a line ending that replaces the 0
+	static const size_t LineSpace = MaxLineLen + EolLen;
+
+	FormatFunc format;
+	size_t maxRecs;
+	unsigned numThreads;
+
+	std::vector<char> text;
+	std::vector<size_t> sliceSizes;
+
+	// Batch being rendered, only changed while no worker formats
+	T *recs;
+	size_t count;
+	size_t sliceRecs;
+
+	std::vector<std::thread> workers;
+	std::mutex mtx;
+	std::condition_variable startCond;
+	std::condition_variable doneCond;
+	unsigned numSlices; // guarded by mtx
+	unsigned pending;   // slices of workers not done yet
+	unsigned long long generation; // counts batches, wakes the workers
+	bool quit;
+
+	void renderSlice(unsigned idx)
+	{
+#ifdef WIN32
+		static const char eol[] = "\r\n";
+#else
+		static const char eol[] = "\n";
+#endif
+		size_t first = idx * sliceRecs;
+		size_t last = first + sliceRecs < count ? first + sliceRecs : count;
+		char *start = &text[first * LineSpace];
+		char *out = start;
+
+		for (size_t i = first; i < last; i++)
+		{
+			int len = format(recs[i], out);
+
+			memcpy(out + len, eol, EolLen);
+			out += len + EolLen;
+		}
+		sliceSizes[idx] = out - start;
+	}
+
+	// seen is the batch count when the worker was started, it only takes part in later ones
+	void workerProc(unsigned idx, unsigned long long seen)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+
+		for (;;)
+		{
+			startCond.wait(lock, [this, &seen] { return quit || generation != seen; });
+			if (quit)
+				return;
+
+			seen = generation;
+			if (idx >= numSlices)
+				continue;
+
+			lock.unlock();
+			renderSlice(idx);
+			lock.lock();
+
+			if (--pending == 0)
+				doneCond.notify_one();
+		}
+	}
+};
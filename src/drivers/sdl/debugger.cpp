@@ -1232,11 +1232,13 @@ static void enableBreakpointCB (GtkCellRendererToggle * renderer,
 		{
 			//printf("Toggle: %i On\n", indexArray[0] );
 		   watchpoint[indexArray[0]].flags |=  WP_E;
+		   WatchpointsChanged();
 		}
 		else
 		{
 			//printf("Toggle: %i Off\n", indexArray[0] );
 		   watchpoint[indexArray[0]].flags &= ~WP_E;
+		   WatchpointsChanged();
 		}
 	}
 
@@ -1281,6 +1283,7 @@ static void DeleteBreak(int sel)
 	watchpoint[numWPs].condText = 0;
 	watchpoint[numWPs].desc = 0;
 	numWPs--;
+	WatchpointsChanged();
 }
 
 static void deleteBreakpointCB (GtkButton * button, debuggerWin_t * dw)
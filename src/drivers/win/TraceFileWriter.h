@@ -7,6 +7,7 @@
 // High-performance class for writing a series of text lines to a file, using overlapped, unbuffered I/O
 // Works on Windows builds both SDL/Qt and non-SQL/Qt
 // Apart from getLastError, the entire API can be adapted to other OS with no client changes
+// The POSIX version is in drivers/common/TraceFileWriter.h, include that header from portable code
 class TraceFileWriter
 {
 public:
@@ -34,6 +35,12 @@ public:
 		return isOpen;
 	}
 
+	// Bytes written so far, including what is still buffered
+	inline uint64_t getOffset() const
+	{
+		return fileOffs + buffOffs;
+	}
+
 	// SUPPOSED to always be valid (ERROR_SUCCESS if no error), but bugs may make it only valid after a failure
 	inline DWORD getLastError() const
 	{
@@ -125,7 +132,14 @@ public:
 
 	// Add a line to the buffer and write it out when the buffer is filled
 	// Under most failure cirumstances the line is added to the buffer
-	bool writeLine(const char *line, bool addEol = true)
+	inline bool writeLine(const char *line, bool addEol = true)
+	{
+		return write(line, strlen(line), addEol);
+	}
+
+	// Add raw data (e.g. binary trace records) to the buffer and write it out when the buffer is filled
+	// A single call must not add more than BlockSize bytes
+	bool write(const void *data, size_t size, bool addEol = false)
 	{
 		if (!isOpen)
 		{
@@ -135,21 +149,19 @@ public:
 
 		// Add to buffer
 		static const char eol[] = "\r\n";
-		size_t eolSize = strlen(eol);
+		size_t eolSize = addEol ? strlen(eol) : 0;
 		char *buff = buffers[buffIdx];
-		size_t lineLen = strlen(line);
-		size_t copyLen = lineLen + (addEol ? eolSize : 0);
-		if (buffOffs + lineLen + eolSize > BuffSize)
+		if (buffOffs + size + eolSize > BuffSize)
 		{
 			// Buffer is full. This shouldn't ever happen.
 			lastErr = ERROR_INTERNAL_ERROR;
 			return false;
 		}
 
-		memcpy(buff + buffOffs, line, lineLen);
+		memcpy(buff + buffOffs, data, size);
 		if (addEol)
-			memcpy(buff + buffOffs + lineLen, eol, eolSize);
-		buffOffs += lineLen + eolSize;
+			memcpy(buff + buffOffs + size, eol, eolSize);
+		buffOffs += size + eolSize;
 
 		// Check if the previous write is done, to detect it as early as possible
 		unsigned prevBuff = (buffIdx + 1) % 2;
@@ -104,6 +104,8 @@ extern int MainWindow_wndx, MainWindow_wndy;
 extern int MemWatch_wndx, MemWatch_wndy;
 extern int Monitor_wndx, Monitor_wndy;
 extern int logging_options;
+extern char *tracer_filter_pc;
+extern char *tracer_filter_banks;
 extern int log_lines_option;
 extern int Tracer_wndx, Tracer_wndy;
 extern int Tracer_wndWidth, Tracer_wndHeight;
@@ -331,6 +333,8 @@ static CFGSTRUCT fceuconfig[] =
 	AC(Monitor_wndx),
 	AC(Monitor_wndy),
 	AC(logging_options),
+	ACS(tracer_filter_pc),
+	ACS(tracer_filter_banks),
 	AC(log_lines_option),
 	AC(Tracer_wndx),
 	AC(Tracer_wndy),
@@ -1224,6 +1224,7 @@ void EnableBreak(int sel)
 	if(sel<0) return;
 	if(sel>=numWPs) return;
 	watchpoint[sel].flags^=WP_E;
+	WatchpointsChanged();
 	SendDlgItemMessage(hDebug,IDC_DEBUGGER_BP_LIST,LB_DELETESTRING,sel,0);
 	SendDlgItemMessage(hDebug,IDC_DEBUGGER_BP_LIST,LB_INSERTSTRING,sel,(LPARAM)(LPSTR)BreakToText(sel));
 	SendDlgItemMessage(hDebug,IDC_DEBUGGER_BP_LIST,LB_SETCURSEL,sel,0);
@@ -1259,6 +1260,7 @@ void DeleteBreak(int sel)
 	watchpoint[numWPs].condText = 0;
 	watchpoint[numWPs].desc = 0;
 	numWPs--;
+	WatchpointsChanged();
 // ################################## Start of SP CODE ###########################
 	myNumWPs--;
 // ################################## End of SP CODE ###########################
@@ -1682,6 +1684,7 @@ void LoadGameDebuggerData(HWND hwndDlg = hDebug)
 		return;
 
 	numWPs = myNumWPs;
+	WatchpointsChanged();
 	FillDebuggerBookmarkListbox(hwndDlg);
 	FillBreakList(hwndDlg);
 }
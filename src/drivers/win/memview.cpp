@@ -1922,6 +1922,7 @@ LRESULT CALLBACK MemViewCallB(HWND hwnd, UINT message, WPARAM wParam, LPARAM lPa
 					checkCondition(condition, numWPs);
 
 					numWPs++;
+					WatchpointsChanged();
 					{
 						extern int myNumWPs;
 						myNumWPs++;
@@ -1959,6 +1960,7 @@ LRESULT CALLBACK MemViewCallB(HWND hwnd, UINT message, WPARAM wParam, LPARAM lPa
 					checkCondition(condition, numWPs);
 
 					numWPs++;
+					WatchpointsChanged();
 					{ extern int myNumWPs;
 					myNumWPs++; }
 					if (hDebug)
@@ -1992,6 +1994,7 @@ LRESULT CALLBACK MemViewCallB(HWND hwnd, UINT message, WPARAM wParam, LPARAM lPa
 					checkCondition(condition, numWPs);
 
 					numWPs++;
+					WatchpointsChanged();
 					{ extern int myNumWPs;
 					myNumWPs++; }
 					if (hDebug)
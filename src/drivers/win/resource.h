@@ -786,6 +786,7 @@
 #define CB_OVERCLOCKING                 1203
 #define CHECK_DEEMPH_SWAP               1203
 #define IDC_CHECK_LOG_BANK_NUMBER       1203
+#define IDC_CHECK_LOG_BZK_BINARY        1204
 #define IDC_VOLUMEGROUP                 1204
 #define IDC_CHECK_MARKERS               1204
 #define IDC_RECORDING                   1204
@@ -793,6 +794,10 @@
 #define IDC_AUTOSAVECDL                 1204
 #define IDC_INVERT_THE_MASK             1204
 #define IDC_DEBUGGER_PREDEFINED_REGS    1204
+#define IDC_CHECK_LOG_BZK_COMPRESS      1205
+#define IDC_CHECK_LOG_BZK_FOLD          1206
+#define IDC_CHECK_LOG_BZK_EDGES         1207
+#define IDC_CHECK_LOG_BZK_SEGMENTS      1208
 #define IDC_RAMLIST                     1205
 #define IDC_CHECK_BOOKMARKS             1205
 #define IDC_RUN_AUTO                    1205
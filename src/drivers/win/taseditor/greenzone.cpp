@@ -23,6 +23,7 @@ Greenzone - Access zone
 #include "taseditor_project.h"
 #include "state.h"
 #include "zlib.h"
+#include "utils/compressPool.h"
 
 extern TASEDITOR_CONFIG taseditorConfig;
 extern TASEDITOR_PROJECT project;
@@ -49,6 +50,7 @@ void GREENZONE::init()
 }
 void GREENZONE::free()
 {
+	pendingSavestates.clear();
 	savestates.resize(0);
 	greenzoneSize = 0;
 	lagLog.reset();
@@ -59,6 +61,8 @@ void GREENZONE::reset()
 }
 void GREENZONE::update()
 {
+	collectCompressedStates(false);
+
 	// keep collecting savestates, this code must be executed at the end of every frame
 	if (taseditorConfig.enableGreenzoning)
 	{
@@ -116,13 +120,46 @@ void GREENZONE::collectCurrentState()
 	if (!savestates[currFrameCounter].size())
 	{
 		EMUFILE_MEMORY ms(&savestates[currFrameCounter]);
-		FCEUSS_SaveMS(&ms, Z_DEFAULT_COMPRESSION);
+		FCEUSS_SaveMS(&ms, Z_NO_COMPRESSION);
 		ms.trim();
+		// compress a copy on a worker thread, so that the compression doesn't eat into the frame time
+		FCEU::compressPool& pool = FCEU::compressPool::get();
+		std::vector<uint8> raw = pool.getBuffer();
+		raw.assign(savestates[currFrameCounter].begin(), savestates[currFrameCounter].end());
+		PENDING_SAVESTATE pending;
+		pending.frame = currFrameCounter;
+		pending.job = pool.submit(raw, Z_DEFAULT_COMPRESSION, FCEUSS_CompressMS);
+		pendingSavestates.push_back(pending);
 	}
 	if (greenzoneSize <= currFrameCounter)
 		greenzoneSize = currFrameCounter + 1;
 }
 
+// swaps finished compressions in, waiting for all of them if wait is set
+void GREENZONE::collectCompressedStates(bool wait)
+{
+	FCEU::compressPool& pool = FCEU::compressPool::get();
+	while (pendingSavestates.size())
+	{
+		PENDING_SAVESTATE& pending = pendingSavestates.front();
+		if (wait)
+			pool.wait(pending.job);
+		else if (!pool.isDone(pending.job))
+			break;
+		swapInCompressedState(pending);
+		pendingSavestates.pop_front();
+	}
+}
+// the job must be done
+void GREENZONE::swapInCompressedState(PENDING_SAVESTATE& pending)
+{
+	FCEU::compressJob& job = *pending.job;
+	// the frame may have been cleared or saved again since
+	if (job.ok && pending.frame < savestates.size() && savestates[pending.frame] == job.in)
+		std::vector<uint8>(job.out).swap(savestates[pending.frame]);
+	FCEU::compressPool::get().recycle(job);
+}
+
 bool GREENZONE::loadSavestateOfFrame(unsigned int frame)
 {
 	if (frame >= savestates.size() || !savestates[frame].size())
@@ -235,6 +272,7 @@ void GREENZONE::save(EMUFILE *os, int save_type)
 	if (save_type != GREENZONE_SAVING_MODE_NO)
 	{
 		collectCurrentState();		// in case the project is being saved before the greenzone.update() was called within current frame
+		collectCompressedStates(true);
 		runGreenzoneCleaning();
 		if (greenzoneSize > (int)savestates.size())
 			greenzoneSize = savestates.size();
@@ -642,6 +680,17 @@ int GREENZONE::getSize()
 // this should only be used by Bookmark Set procedure
 std::vector<uint8>& GREENZONE::getSavestateOfFrame(int frame)
 {
+	// wait only if this frame is still being compressed
+	for (std::deque<PENDING_SAVESTATE>::iterator it(pendingSavestates.begin()); it != pendingSavestates.end(); it++)
+	{
+		if (it->frame == (unsigned int)frame)
+		{
+			FCEU::compressPool::get().wait(it->job);
+			swapInCompressedState(*it);
+			pendingSavestates.erase(it);
+			break;
+		}
+	}
 	return savestates[frame];
 }
 // this function should only be used by Bookmark Deploy procedure
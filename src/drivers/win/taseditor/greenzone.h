@@ -1,5 +1,8 @@
 // Specification file for Greenzone class
 
+#include <deque>
+#include <memory>
+
 #include "laglog.h"
 
 #define GREENZONE_ID_LEN 10
@@ -13,6 +16,8 @@
 
 #define PROGRESSBAR_UPDATE_RATE 1000	// progressbar is updated after every 1000 savestates loaded from FM3 file
 
+namespace FCEU { struct compressJob; }
+
 class GREENZONE
 {
 public:
@@ -46,6 +51,7 @@ public:
 
 private:
 	void collectCurrentState();
+	void collectCompressedStates(bool wait);
 	bool clearSavestateOfFrame(unsigned int frame);
 	bool clearSavestateAndFreeMemory(unsigned int frame);
 
@@ -58,5 +64,14 @@ private:
 
 	// not saved data
 	int nextCleaningTime;
+
+	// savestates being compressed in the background, oldest first. Until its job is done a frame holds its uncompressed savestate
+	struct PENDING_SAVESTATE
+	{
+		unsigned int frame;
+		std::shared_ptr<FCEU::compressJob> job;
+	};
+	std::deque<PENDING_SAVESTATE> pendingSavestates;
+	void swapInCompressedState(PENDING_SAVESTATE& pending);
 	
 };
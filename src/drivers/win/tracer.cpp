@@ -28,10 +28,15 @@
 #include "../../file.h"
 #include "../../debug.h"
 #include "../../asm.h"
+#include "../../bzktrace.h"
 #include "../../version.h"
 #include "cdlogger.h"
 #include "tracer.h"
 #include "memview.h"
+#include "../common/TraceFileCompressor.h"
+#include "../common/TraceSegmentWriter.h"
+#include "../common/TraceIndexWriter.h"
+#include "../common/TraceFilter.h"
 #include "main.h" //for GetRomName()
 #include "utils/xstring.h"
 
@@ -125,9 +130,15 @@ char str_tabs[LOG_TABS_MASK+1] = {0}, str_address[LOG_ADDRESS_MAX_LEN] = {0}, st
 char str_result[LOG_LINE_MAX_LEN] = {0};
 char bzk_string[200] = {0};
 int bzk_writes_counter = 0;
-int bzk_previous_address = 0x200000;
+int bzk_previous_address = BZK_TRACE_NO_PREV_ADDR;
 int bzk_files_counter = 0;
 int bzk_log_files_counter = 0;
+bool bzk_binary = false;	// packed bzkTraceRecord_t output, fixed for the whole logging session
+bool bzk_compress = false;	// gzip frames through bzk_compressor, fixed for the whole logging session
+bool bzk_fold = false;	// loop folding through bzk_folder (binary records only), fixed for the whole logging session
+bool bzk_edges = false;	// only log the first record of every (previous address -> address, bank) edge, fixed for the whole logging session
+bool bzk_segments = false;	// memory mapped segments through bzk_segmenter instead of files cut every BZK_TRACE_LINES_PER_FILE lines, fixed for the whole logging session
+bool bzk_write_failed = false;	// set by the first failed write, logging stops after the current instruction
 char str_temp[LOG_LINE_MAX_LEN] = {0};
 char str_decoration[NL_MAX_MULTILINE_COMMENT_LEN + 10] = {0};
 char str_decoration_comment[NL_MAX_MULTILINE_COMMENT_LEN + 10] = {0};
@@ -139,7 +150,15 @@ bool log_old_emu_paused = true;		// thanks to this flag the window only updates
 extern bool JustFrameAdvanced;
 extern int currFrameCounter;
 
-FILE *LOG_FP;
+static TraceFileWriter bzk_writer;	// overlapped unbuffered writes, flushed when emulation pauses
+static TraceFileCompressor bzk_compressor;	// compresses on its own thread, then writes the same way
+static bzkTraceFolder_t bzk_folder;	// holds back repeated loop iterations, reset for every file
+static bzkTraceEdgeSet_t bzk_edgeSet;	// edges logged so far, kept in <rom>.bzkedges next to the .cdl file
+static TraceSegmentWriter bzk_segmenter;	// preallocated mapped z%05d_fceux files listed in zsegments.idx
+static TraceIndexWriter bzk_indexer;	// ztrace.idx, where every frame and NMI handler starts in the files
+static TraceFilter tracer_filter;	// checked before anything is captured, compiled when logging starts
+char *tracer_filter_pc = 0;	// "8000-9FFF, E000-FFFF", empty or unset for every address
+char *tracer_filter_banks = 0;	// BZK bank numbers, "0-3, 62"
 
 char trace_str[35000] = {0};
 WNDPROC IDC_TRACER_LOG_oldWndProc = 0;
@@ -154,6 +173,164 @@ void UpdateLogText(void);
 void EnableTracerMenuItems(void);
 int PromptForCDLogger(void);
 
+static const char *bzk_GetFileExt(void)
+{
+	if (bzk_compress)
+		return bzk_binary ? "bzk.gz" : "log.gz";
+	return bzk_binary ? "bzk" : "log";
+}
+
+static bool bzk_Write(const void *data, size_t size, bool addEol = false)
+{
+	bool ok;
+
+	if (bzk_segments)
+		ok = bzk_segmenter.write(data, size, addEol);
+	else if (bzk_compress)
+		ok = bzk_compressor.write(data, size, addEol);
+	else
+		ok = bzk_writer.write(data, size, addEol);
+
+	if (!ok)
+		bzk_write_failed = true;
+	return ok;
+}
+
+// bytes of the current file so far, before compression, for the trace index
+static uint64 bzk_GetOffset(void)
+{
+	if (bzk_segments)
+		return bzk_segmenter.getOffset();
+	if (bzk_compress)
+		return bzk_compressor.getOffset();
+	return bzk_writer.getOffset();
+}
+
+static unsigned int bzk_GetIndexFlags(void)
+{
+	return (bzk_binary ? BZK_INDEX_BINARY : 0) | (bzk_compress ? BZK_INDEX_COMPRESSED : 0) |
+		(bzk_fold ? BZK_INDEX_FOLDED : 0) | (bzk_edges ? BZK_INDEX_EDGES : 0);
+}
+
+// same place and naming as the auto-resumed .cdl file
+static std::string bzk_GetEdgesFileName(void)
+{
+	return GetRomPath() + mass_replace(GetRomName(), "|", ".") + BZK_EDGES_EXT;
+}
+
+// writes the records the loop folder let through, they count towards BZK_TRACE_LINES_PER_FILE
+static void bzk_WriteRecords(const bzkTraceRecord_t *recs, int count)
+{
+	for (int i = 0; i < count; i++)
+		bzk_Write(&recs[i], sizeof(recs[i]));
+
+	bzk_writes_counter += count;
+}
+
+// writes out the loop being folded, so the file is complete up to the last instruction
+static void bzk_FlushFolder(void)
+{
+	bzkTraceRecord_t recs[BZK_TRACE_FOLD_MAX_OUT];
+
+	if (bzk_fold)
+		bzk_WriteRecords(recs, bzk_folder.flush(recs));
+}
+
+static void bzk_CloseWriter(void)
+{
+	if (bzk_segments)
+		bzk_segmenter.close();
+	else if (bzk_compress)
+		bzk_compressor.close();
+	else
+		bzk_writer.close();
+}
+
+// starts a new file or segment, the folder must not refer to records of the previous one
+static bool bzk_BeginFile(void)
+{
+	bzk_folder.reset();
+
+	if (bzk_binary)
+	{
+		bzkTraceHeader_t hdr;
+		bzkTrace_InitHeader(&hdr);
+		return bzk_Write(&hdr, sizeof(hdr));
+	}
+	return true;
+}
+
+// opens z%05d.log (or .bzk, .gz) for bzk_files_counter, or the first segment after the ones in the index
+static bool bzk_OpenLogFile(void)
+{
+	bool isPaused = FCEUI_EmulationPaused() != 0;
+
+	if (bzk_segments)
+	{
+		if (!bzk_segmenter.open("", bzk_GetFileExt(), bzk_binary, isPaused, currFrameCounter, total_instructions))
+		{
+			sprintf(bzk_filename, "%s", BZK_SEGMENT_INDEX_NAME);
+			return false;
+		}
+		bzk_files_counter = bzk_segmenter.getFileIdx();
+		strcpy(bzk_filename, bzk_segmenter.currentFileName().c_str());
+	}
+	else
+	{
+		sprintf(bzk_filename, "z%05d.%s", bzk_files_counter, bzk_GetFileExt());
+		if (!(bzk_compress ? bzk_compressor.open(bzk_filename, isPaused) : bzk_writer.open(bzk_filename, isPaused)))
+			return false;
+	}
+
+	if (!bzk_BeginFile())
+	{
+		bzk_CloseWriter();
+		return false;
+	}
+	return true;
+}
+
+// trims the full segment and maps the next one, nothing is closed, renamed or reopened
+static bool bzk_NextSegment(void)
+{
+	bzk_FlushFolder();
+
+	if (!bzk_segmenter.nextSegment(currFrameCounter, total_instructions) || !bzk_BeginFile())
+	{
+		bzk_write_failed = true;
+		return false;
+	}
+	bzk_files_counter = bzk_segmenter.getFileIdx();
+	strcpy(bzk_filename, bzk_segmenter.currentFileName().c_str());
+	return true;
+}
+
+// closes the current file and renames it to z%05d_fceux.log (or .bzk, .gz)
+static void bzk_CloseLogFile(void)
+{
+	bzk_FlushFolder();
+	bzk_CloseWriter();
+
+	// segments have their final name from the start
+	if (bzk_segments)
+		return;
+
+	sprintf(bzk_newfilename, "z%05d_fceux.%s", bzk_files_counter, bzk_GetFileExt());
+	remove(bzk_newfilename); //delete file if exists
+	rename(bzk_filename, bzk_newfilename);
+}
+
+// like a file that can't be opened, the first failed write (disk full, segment not mapped) ends logging
+static void bzk_StopOnWriteError(void)
+{
+	char msg[2200];
+
+	sprintf(msg, "Error Writing File %s, logging stopped", bzk_filename);
+	OutputLogLine(msg);
+	EndLoggingSequence();
+	MessageBox(hTracer, msg, "File Error", MB_OK);
+}
+
 // returns the address, or EOF if selection cursor points to something else
 int Tracer_CheckClickingOnAnAddressOrSymbolicName(unsigned int lineNumber, bool onlyCheckWhenNothingSelected)
 {
@@ -443,6 +620,11 @@ INT_PTR CALLBACK TracerCallB(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM lPar
 			CheckDlgButton(hwndDlg, IDC_CHECK_SYMBOLIC_TRACING, (logging_options & LOG_SYMBOLIC) ? BST_CHECKED : BST_UNCHECKED);
 			CheckDlgButton(hwndDlg, IDC_CHECK_CODE_TABBING, (logging_options & LOG_CODE_TABBING) ? BST_CHECKED : BST_UNCHECKED);
 			CheckDlgButton(hwndDlg, IDC_CHECK_LOG_BANK_NUMBER, (logging_options & LOG_BANK_NUMBER) ? BST_CHECKED : BST_UNCHECKED);
+			CheckDlgButton(hwndDlg, IDC_CHECK_LOG_BZK_BINARY, (logging_options & LOG_BZK_BINARY) ? BST_CHECKED : BST_UNCHECKED);
+			CheckDlgButton(hwndDlg, IDC_CHECK_LOG_BZK_COMPRESS, (logging_options & LOG_BZK_COMPRESS) ? BST_CHECKED : BST_UNCHECKED);
+			CheckDlgButton(hwndDlg, IDC_CHECK_LOG_BZK_FOLD, (logging_options & LOG_BZK_FOLD) ? BST_CHECKED : BST_UNCHECKED);
+			CheckDlgButton(hwndDlg, IDC_CHECK_LOG_BZK_EDGES, (logging_options & LOG_BZK_EDGES) ? BST_CHECKED : BST_UNCHECKED);
+			CheckDlgButton(hwndDlg, IDC_CHECK_LOG_BZK_SEGMENTS, (logging_options & LOG_BZK_SEGMENTS) ? BST_CHECKED : BST_UNCHECKED);
 			CheckDlgButton(hwndDlg, IDC_CHECK_LOG_UPDATE_WINDOW, log_update_window ? BST_CHECKED : BST_UNCHECKED);
 			
 			EnableWindow(GetDlgItem(hwndDlg, IDC_TRACER_LOG_SIZE), FALSE);
@@ -615,6 +797,31 @@ INT_PTR CALLBACK TracerCallB(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM lPar
 							logging_options ^= LOG_BANK_NUMBER;
 							CheckDlgButton(hwndDlg, IDC_CHECK_LOG_BANK_NUMBER, (logging_options & LOG_BANK_NUMBER) ? BST_CHECKED : BST_UNCHECKED);
 							break;
+						case IDC_CHECK_LOG_BZK_BINARY:
+							// takes effect on the next Start Logging, the current files keep their format
+							logging_options ^= LOG_BZK_BINARY;
+							CheckDlgButton(hwndDlg, IDC_CHECK_LOG_BZK_BINARY, (logging_options & LOG_BZK_BINARY) ? BST_CHECKED : BST_UNCHECKED);
+							break;
+						case IDC_CHECK_LOG_BZK_COMPRESS:
+							// takes effect on the next Start Logging as well
+							logging_options ^= LOG_BZK_COMPRESS;
+							CheckDlgButton(hwndDlg, IDC_CHECK_LOG_BZK_COMPRESS, (logging_options & LOG_BZK_COMPRESS) ? BST_CHECKED : BST_UNCHECKED);
+							break;
+						case IDC_CHECK_LOG_BZK_EDGES:
+							// takes effect on the next Start Logging as well
+							logging_options ^= LOG_BZK_EDGES;
+							CheckDlgButton(hwndDlg, IDC_CHECK_LOG_BZK_EDGES, (logging_options & LOG_BZK_EDGES) ? BST_CHECKED : BST_UNCHECKED);
+							break;
+						case IDC_CHECK_LOG_BZK_FOLD:
+							// takes effect on the next Start Logging as well
+							logging_options ^= LOG_BZK_FOLD;
+							CheckDlgButton(hwndDlg, IDC_CHECK_LOG_BZK_FOLD, (logging_options & LOG_BZK_FOLD) ? BST_CHECKED : BST_UNCHECKED);
+							break;
+						case IDC_CHECK_LOG_BZK_SEGMENTS:
+							// takes effect on the next Start Logging as well
+							logging_options ^= LOG_BZK_SEGMENTS;
+							CheckDlgButton(hwndDlg, IDC_CHECK_LOG_BZK_SEGMENTS, (logging_options & LOG_BZK_SEGMENTS) ? BST_CHECKED : BST_UNCHECKED);
+							break;
 						case IDC_CHECK_LOG_NEW_INSTRUCTIONS:
 							logging_options ^= LOG_NEW_INSTRUCTIONS;
 							if(logging && (!PromptForCDLogger()))
@@ -714,6 +921,13 @@ void BeginLoggingSequence(void)
 	if (!PromptForCDLogger())
 		return; //do nothing if user selected no and CD Logger is needed
 
+	bool filterFailed = !tracer_filter.setPcRanges(tracer_filter_pc ? tracer_filter_pc : "");
+	filterFailed = !tracer_filter.setBanks(tracer_filter_banks ? tracer_filter_banks : "") || filterFailed;
+	tracer_filter.setRamOnly((logging_options & LOG_FILTER_RAM) != 0);
+	tracer_filter.setInterrupts(((logging_options & LOG_FILTER_NMI) ? TraceFilter::IntNmi : 0) |
+		((logging_options & LOG_FILTER_IRQ) ? TraceFilter::IntIrq : 0));
+	tracer_filter.compile();
+
 	if (logtofile)
 	{
 		if(logfilename == NULL) ShowLogDirDialog();
@@ -731,32 +945,46 @@ void BeginLoggingSequence(void)
         //}
         
         //so fuck it, I'm sticking with what's actually working
-        int k = 99999;
-        while (true) {
-            sprintf(bzk_filename, "z%05d_fceux.log", k);
-            LOG_FP = fopen(bzk_filename, "r");
-            if (LOG_FP != NULL) {
-                fclose(LOG_FP);
+        bzk_binary = (logging_options & LOG_BZK_BINARY) != 0;
+        bzk_compress = (logging_options & LOG_BZK_COMPRESS) != 0;
+        bzk_fold = bzk_binary && (logging_options & LOG_BZK_FOLD) != 0; // the text format has no repeat line
+        bzk_edges = (logging_options & LOG_BZK_EDGES) != 0;
+        bzk_segments = (logging_options & LOG_BZK_SEGMENTS) != 0;
+        if (bzk_segments)
+            bzk_compress = false; // gzip frames have no fixed size to map
+        if (bzk_edges)
+        {
+            // coverage accumulates over sessions, a missing file just starts from scratch
+            bzk_edgeSet.clear();
+            bzk_edgeSet.load(bzk_GetEdgesFileName().c_str());
+        }
+        // the segment index knows the next number, no need to look
+        int k = bzk_segments ? -1 : 99999;
+        while (k >= 0) {
+            sprintf(bzk_filename, "z%05d_fceux.%s", k, bzk_GetFileExt());
+            FILE *fp = fopen(bzk_filename, "r");
+            if (fp != NULL) {
+                fclose(fp);
                 bzk_files_counter = k + 1;
                 break;
             }
             k--;
-            if (k == -1) {
-                bzk_files_counter = 0;
-                break;
-            }
         }
+        if (k == -1)
+            bzk_files_counter = 0;
         
         if (bzk_files_counter >= 100000) bzk_files_counter = 0;
-        sprintf(bzk_filename, "z%05d.log", bzk_files_counter);
-        LOG_FP = fopen(bzk_filename, "w");
         
-		if (LOG_FP == NULL)
+		bzk_write_failed = false;
+		if (!bzk_OpenLogFile())
 		{
 			sprintf(trace_str, "Error Opening File %s", bzk_filename);
 			MessageBox(hTracer, trace_str, "File Error", MB_OK);
 			return;
 		}
+
+		// the files are still usable without it
+		bool indexFailed = !bzk_indexer.open("", bzk_GetIndexFlags(), FCEUI_EmulationPaused() != 0);
         
         
 		ClearTraceLogBuf();
@@ -778,8 +1006,28 @@ void BeginLoggingSequence(void)
         
         bzk_log_files_counter++;
         
-		sprintf(str_result, "z%05d.log (%d)", bzk_files_counter, bzk_log_files_counter);
+		sprintf(str_result, bzk_segments ? "z%05d_fceux.%s (%d)" : "z%05d.%s (%d)", bzk_files_counter, bzk_GetFileExt(), bzk_log_files_counter);
 		OutputLogLine(str_result);
+		if (bzk_edges)
+		{
+			sprintf(str_result, "Only new edges, %u already known", (unsigned int)bzk_edgeSet.size());
+			OutputLogLine(str_result);
+		}
+		if (indexFailed)
+		{
+			sprintf(str_result, "Error opening %s, logging without an index", BZK_TRACE_INDEX_NAME);
+			OutputLogLine(str_result);
+		}
+		if (filterFailed)
+		{
+			strcpy(str_result, "Invalid capture filter ranges in the config file, ignored");
+			OutputLogLine(str_result);
+		}
+		else if (tracer_filter.getActive())
+		{
+			strcpy(str_result, "Capture filter on, only matching instructions are logged");
+			OutputLogLine(str_result);
+		}
 		ScrollLogWindowToLastLine();
 		UpdateLogText();
         
@@ -825,17 +1073,45 @@ void BeginLoggingSequence(void)
 
 void FCEUD_FlushTrace()
 {
-	if(LOG_FP)
-		fflush(LOG_FP);
+	// only writes out the partial buffer when going to paused, keeping the writes large while running
+	bool isPaused = FCEUI_EmulationPaused() != 0;
+
+	// games usually pause in a wait loop, end it so the repeat record makes it into the file
+	if (isPaused && (bzk_writer.getOpen() || bzk_compressor.getOpen() || bzk_segmenter.getOpen()))
+		bzk_FlushFolder();
+
+	if (bzk_writer.getOpen())
+		bzk_write_failed = !bzk_writer.setPause(isPaused) || bzk_write_failed;
+	if (bzk_compressor.getOpen())
+		bzk_write_failed = !bzk_compressor.setPause(isPaused) || bzk_write_failed;
+	if (bzk_segmenter.getOpen())
+		bzk_write_failed = !bzk_segmenter.setPause(isPaused) || bzk_write_failed;
+	if (bzk_indexer.getOpen())
+		bzk_indexer.setPause(isPaused);
+
+	if (logging && logtofile && bzk_write_failed)
+		bzk_StopOnWriteError();
 }
 
 //todo: really speed this up
+bool FCEUD_TraceInstructionActive()
+{
+	return logging != 0;
+}
+
 void FCEUD_TraceInstruction(uint8 *opcode, int size)
 {
 	if (!logging)
 		return;
 
 	unsigned int addr = X.PC;
+
+	if (!tracer_filter.pass(addr))
+	{
+		// the next logged instruction doesn't follow the last one
+		bzk_previous_address = BZK_TRACE_NO_PREV_ADDR;
+		return;
+	}
 //	uint8 tmp;
 //	static int unloggedlines;
 
@@ -1068,35 +1344,81 @@ void FCEUD_TraceInstruction(uint8 *opcode, int size)
     //sprintf(bzk_string, "%X %X %X %X %X %X %X %X %X %X \n", addr, bzk_GetNesFileAddress(addr), bzk_getBank(0x8000), bzk_getBank(0xA000), bzk_getBank(0xC000), bzk_getBank(0xE000), X.A, X.X, X.Y, X.P);
     //sprintf(bzk_string, "%u|%u|%u|%u|%u|%u|%u|%u|%s|\n", bzk_GetNesFileAddress(addr), bzk_getBank(0x8000), bzk_getBank(0xA000), bzk_getBank(0xC000), bzk_getBank(0xE000), X.A, X.X, X.Y, bzk_Disassemble(opcode));
     //sprintf(bzk_string, "%u|%u|%u|%u|%u|%s|\n", bzk_GetNesFileAddress(addr), bzk_getBank(addr), X.A, X.X, X.Y, bzk_Disassemble(addr, opcode));
-    sprintf(bzk_string, "%u|%u|%u|%u|%u|%u|%u|%s|%s|\n", bzk_previous_address, bzk_GetNesFileAddress(addr), bzk_getBank(addr), X.A, X.X, X.Y, X.P, bzk_Disassemble(addr, opcode), bzk_GetRAMopcodes(addr, opcode));
+    //sprintf(bzk_string, "%u|%u|%u|%u|%u|%u|%u|%s|%s|\n", bzk_previous_address, bzk_GetNesFileAddress(addr), bzk_getBank(addr), X.A, X.X, X.Y, X.P, bzk_Disassemble(addr, opcode), bzk_GetRAMopcodes(addr, opcode));
+    bzkTraceRecord_t rec;
+    bzk_CaptureRecord(&rec, bzk_previous_address, &debugInstruction);
     
-    bzk_previous_address = bzk_GetNesFileAddress(addr);
+    bzk_previous_address = rec.romAddr;
+
+	if (bzk_edges && !bzk_edgeSet.insert(rec))
+		return;
 
-	fputs(bzk_string, LOG_FP);
-	bzk_writes_counter++;
+	// checked before writing, so the index gets the counters of the segment's first instruction
+	if (bzk_segments && bzk_segmenter.isFull())
+	{
+		if (!bzk_NextSegment())
+		{
+			bzk_StopOnWriteError();
+			return;
+		}
+		bzk_log_files_counter++;
 
-	if (bzk_writes_counter == 4999999)
+		sprintf(str_result, "z%05d_fceux.%s (%d)", bzk_files_counter, bzk_GetFileExt(), bzk_log_files_counter);
+		OutputLogLine(str_result);
+		ScrollLogWindowToLastLine();
+		UpdateLogText();
+	}
+
+	bool isNmi = bzk_indexer.getOpen() && bzk_IsNmiEntry();
+	if (bzk_indexer.isIndexPoint(currFrameCounter, isNmi))
 	{
-		bzk_writes_counter = 0;
-		fflush(LOG_FP);
-		fclose(LOG_FP);
+		// the entry points at this record, so nothing before it may be held back or repeated after it
+		bzk_FlushFolder();
+		bzk_folder.reset();
+		bzk_indexer.add(bzk_files_counter, bzk_GetOffset(), currFrameCounter, total_instructions, isNmi);
+	}
 
-		sprintf(bzk_newfilename, "z%05d_fceux.log", bzk_files_counter);
-        remove(bzk_newfilename); //delete file if exists
-		rename(bzk_filename, bzk_newfilename);
+	if (bzk_fold)
+	{
+		bzkTraceRecord_t recs[BZK_TRACE_FOLD_MAX_OUT];
+		bzk_WriteRecords(recs, bzk_folder.add(rec, recs));
+	}
+	else if (bzk_binary)
+	{
+		bzk_WriteRecords(&rec, 1);
+	}
+	else
+	{
+		// the writer adds the "\r\n" the text mode FILE used to
+		int len = bzkTrace_FormatText(rec, bzk_string);
+		bzk_Write(bzk_string, len - 1, true);
+		bzk_writes_counter++;
+	}
+
+	// folding writes several records at once, so the count can step over the limit
+	if (!bzk_segments && bzk_writes_counter >= BZK_TRACE_LINES_PER_FILE)
+	{
+		bzk_CloseLogFile();
+		bzk_writes_counter = 0;
 
 		bzk_files_counter++;
         if (bzk_files_counter >= 100000) bzk_files_counter = 0;
-		sprintf(bzk_filename, "z%05d.log", bzk_files_counter);
-		LOG_FP = fopen(bzk_filename, "w");
+		if (!bzk_OpenLogFile())
+		{
+			bzk_StopOnWriteError();
+			return;
+		}
         
         bzk_log_files_counter++;
         
-		sprintf(str_result, "z%05d.log (%d)", bzk_files_counter, bzk_log_files_counter);
+		sprintf(str_result, "z%05d.%s (%d)", bzk_files_counter, bzk_GetFileExt(), bzk_log_files_counter);
 		OutputLogLine(str_result);
 		ScrollLogWindowToLastLine();
 		UpdateLogText();
 	}
+
+	if (bzk_write_failed)
+		bzk_StopOnWriteError();
     
 	return;
 }
@@ -1152,17 +1474,19 @@ void EndLoggingSequence()
 {
 	if (logtofile)
 	{
-		fflush(LOG_FP);
-		fclose(LOG_FP);
-
-		sprintf(bzk_newfilename, "z%05d", bzk_files_counter);
-		strcat(bzk_newfilename, "_fceux.log");
-		rename(bzk_filename, bzk_newfilename);
+		bzk_CloseLogFile();
+		bzk_indexer.close();
 
 		bzk_files_counter++;
         bzk_writes_counter = 0;
-        bzk_previous_address = 0x200000;
+        bzk_previous_address = BZK_TRACE_NO_PREV_ADDR;
         bzk_log_files_counter = 0;
+
+		if (bzk_edges && !bzk_edgeSet.save(bzk_GetEdgesFileName().c_str()))
+		{
+			strcpy(str_result, "Error saving the edge coverage file.");
+			OutputLogLine(str_result);
+		}
         
 		strcpy(str_result, "Logging finished.");
 		OutputLogLine(str_result);
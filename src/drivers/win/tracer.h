@@ -13,6 +13,15 @@
 #define LOG_CYCLES_COUNT       1024
 #define LOG_INSTRUCTIONS_COUNT 2048
 #define LOG_BANK_NUMBER        4096
+#define LOG_BZK_BINARY         8192
+#define LOG_BZK_COMPRESS      16384
+#define LOG_BZK_FOLD          32768
+#define LOG_BZK_EDGES         65536
+#define LOG_BZK_SEGMENTS     131072
+// capture filter, with tracer_filter_pc and tracer_filter_banks (set in the config file)
+#define LOG_FILTER_RAM       262144
+#define LOG_FILTER_NMI       524288
+#define LOG_FILTER_IRQ      1048576
 
 #define LOG_LINE_MAX_LEN 160
 // Frames count - 1+6+1 symbols
@@ -38,6 +47,8 @@ extern HWND hTracer;
 extern int log_update_window;
 extern volatile int logtofile, logging;
 extern int logging_options;
+extern char *tracer_filter_pc;
+extern char *tracer_filter_banks;
 extern bool log_old_emu_paused;
 
 void EnableTracerMenuItems(void);
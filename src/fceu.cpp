@@ -315,6 +315,7 @@ void FlushGenieRW(void) {
 		AReadG = nullptr;
 		BWriteG = nullptr;
 		RWWrap = 0;
+		UpdateReadDirect(0x8000, 0xFFFF);
 	}
 }
 
@@ -325,6 +326,8 @@ readfunc GetReadHandler(int32 a) {
 		return ARead[a];
 }
 
+static void ScanReadDirect(int32 start, int32 end, bool uniform);
+
 void SetReadHandler(int32 start, int32 end, readfunc func) {
 	int32 x;
 
@@ -341,6 +344,11 @@ void SetReadHandler(int32 start, int32 end, readfunc func) {
 	else
 		for (x = end; x >= start; x--)
 			ARead[x] = func;
+
+	if (!RWWrap)
+		ScanReadDirect(start, end, true);
+	else if (start < 0x8000)
+		ScanReadDirect(start, end < 0x8000 ? end : 0x7FFF, true);
 }
 
 writefunc GetWriteHandler(int32 a) {
@@ -401,6 +409,44 @@ static DECLFR(ARAMH) {
 	return RAM[A & 0x7FF];
 }
 
+uint8 *AReadDirect[32];
+static bool AReadDirectPRG[32]; //page read through CartBR only, its pointer follows Page[]
+
+//uniform: the whole page was just set to one handler, no need to look at every address
+static void ScanReadDirect(int32 start, int32 end, bool uniform) {
+	for (int page = start >> 11; page <= (end >> 11); page++) {
+		int32 first = page << 11;
+		readfunc func = ARead[first];
+
+		AReadDirect[page] = nullptr;
+		AReadDirectPRG[page] = false;
+
+		if (!uniform || start > first || end < first + 0x7FF) {
+			int32 x;
+
+			for (x = first + 1; x <= first + 0x7FF && ARead[x] == func; x++);
+			if (x <= first + 0x7FF)
+				continue;
+		}
+
+		if ((func == ARAMH || (func == ARAML && page == 0)) && RAM)
+			AReadDirect[page] = RAM - first;
+		else if (func == CartBR) {
+			AReadDirect[page] = Page[page];
+			AReadDirectPRG[page] = true;
+		}
+	}
+}
+
+void UpdateReadDirect(int32 start, int32 end) {
+	ScanReadDirect(start, end, false);
+}
+
+void UpdateReadDirectPRG(int page) {
+	if (AReadDirectPRG[page])
+		AReadDirect[page] = Page[page];
+}
+
 
 void ResetGameLoaded(void) {
 	if (GameInfo) FCEU_CloseGame();
@@ -32,6 +32,15 @@ readfunc GetReadHandler(int32 a);
 int AllocGenieRW(void);
 void FlushGenieRW(void);
 
+//Direct read pointers, one per 2K page of the CPU address space. Non-null when the whole page
+//reads plain memory (internal RAM, or PRG through CartBR), so the CPU core can load
+//AReadDirect[A >> 11][A] instead of calling ARead[A]. Null when a handler has to run.
+extern uint8 *AReadDirect[32];
+//Rechecks the pages of start-end after their ARead entries changed outside SetReadHandler
+void UpdateReadDirect(int32 start, int32 end);
+//Called by the cart code after Page[page] changed
+void UpdateReadDirectPRG(int page);
+
 void FCEU_ResetVidSys(void);
 
 void ResetMapping(void);
@@ -1765,6 +1765,7 @@ void FCEUPPU_Power(void) {
 		ARead[x + 7] = A2007;
 		BWrite[x + 7] = B2007;
 	}
+	UpdateReadDirect(0x2000, 0x3FFF);
 	BWrite[0x4014] = B4014;
 }
 
@@ -28,6 +28,7 @@
 #include "utils/endian.h"
 #include "utils/memory.h"
 #include "utils/xstring.h"
+#include "utils/compressPool.h"
 #include "file.h"
 #include "fds.h"
 #include "state.h"
@@ -57,6 +58,8 @@
 //#include <unistd.h> //mbg merge 7/17/06 removed
 
 #include <vector>
+#include <deque>
+#include <memory>
 #include <fstream>
 
 using namespace std;
@@ -463,6 +466,27 @@ bool FCEUSS_SaveMS(EMUFILE* outstream, int compressionLevel)
 	return error == Z_OK;
 }
 
+//compresses a state saved by FCEUSS_SaveMS with Z_NO_COMPRESSION, leaving the header as FCEUSS_SaveMS would write it.
+//touches no globals, so it can run on a compressPool worker
+bool FCEUSS_CompressMS(const std::vector<uint8> &in, std::vector<uint8> &out, int compressionLevel)
+{
+	if(in.size() < 16 || memcmp(&in[0], "FCSX", 4) || memcmp(&in[12], "\xff\xff\xff\xff", 4))
+		return false;
+
+	uLong len = (uLong)(in.size() - 16);
+	uLongf comprlen = compressBound(len);
+
+	out.resize(16 + comprlen);
+
+	if(compress2(&out[16], &comprlen, &in[16], len, compressionLevel) != Z_OK)
+		return false;
+
+	memcpy(&out[0], &in[0], 12);
+	FCEU_en32lsb(&out[12], comprlen);
+	out.resize(16 + comprlen);
+	return true;
+}
+
 
 void FCEUSS_Save(const char *fname, bool display_message)
 {
@@ -1211,6 +1235,156 @@ void RedoLoadState()
 //-----------------------------------------------------------------------------------------------------
 static StateRecorderConfigData stateRecorderConfig;
 
+// The recorder keeps a full state (a key frame) every so many snapshots and stores the snapshots
+// in between as the runs of bytes that differ from that key frame. A delta is a list of records:
+// skip count and run length as little endian uint32, then the run's bytes.
+//
+// States are compared chunk by chunk, each chunk with the key frame's chunk of the same ID, so
+// that a chunk changing size (the movie input log grows every frame) doesn't shift the chunks
+// after it. The key frame's chunks are first laid out like the snapshot's (stateBaseBuild),
+// the part past the end of a key frame chunk, or a chunk it doesn't have, reads as zeros.
+
+// Equal bytes needed to end a run, fewer are copied along to save a record header
+static const size_t stateDeltaMinGap = 16;
+
+static void stateDeltaPut32(std::vector<uint8> &out, uint32 v)
+{
+	out.push_back(v & 0xff);
+	out.push_back((v >> 8) & 0xff);
+	out.push_back((v >> 16) & 0xff);
+	out.push_back((v >> 24) & 0xff);
+}
+
+static uint32 stateDeltaGet32(const uint8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+// A chunk of an uncompressed FCEUSS_SaveMS state, ID byte and size included. The 16 byte
+// header is a chunk of its own.
+struct stateChunk_t
+{
+	int    id;
+	uint32 offset;
+	uint32 size;
+};
+
+static const int stateHeaderChunkId = 0x100;
+static const int stateTailChunkId   = 0x101; // whatever follows a chunk cut short
+
+static void stateChunkScan(const uint8 *state, size_t len, std::vector<stateChunk_t> &chunks)
+{
+	size_t pos = std::min<size_t>(16, len);
+	stateChunk_t chunk;
+
+	chunks.clear();
+
+	chunk.id = stateHeaderChunkId;
+	chunk.offset = 0;
+	chunk.size = static_cast<uint32>(pos);
+	chunks.push_back(chunk);
+
+	while (pos + 5 <= len)
+	{
+		size_t size = 5 + (size_t)stateDeltaGet32(state + pos + 1);
+
+		if (size > len - pos)
+		{
+			break;
+		}
+		chunk.id = state[pos];
+		chunk.offset = static_cast<uint32>(pos);
+		chunk.size = static_cast<uint32>(size);
+		chunks.push_back(chunk);
+
+		pos += size;
+	}
+	if (pos < len)
+	{
+		chunk.id = stateTailChunkId;
+		chunk.offset = static_cast<uint32>(pos);
+		chunk.size = static_cast<uint32>(len - pos);
+		chunks.push_back(chunk);
+	}
+}
+
+// Lays the chunks of key out as in a state made of the chunks of layout
+static void stateBaseBuild(const uint8 *key, const std::vector<stateChunk_t> &keyChunks, const std::vector<stateChunk_t> &layout, uint8 *base)
+{
+	for (size_t i = 0; i < layout.size(); i++)
+	{
+		const stateChunk_t &c = layout[i];
+		size_t n = 0;
+
+		for (size_t j = 0; j < keyChunks.size(); j++)
+		{
+			if (keyChunks[j].id == c.id)
+			{
+				n = std::min(keyChunks[j].size, c.size);
+				memcpy(base + c.offset, key + keyChunks[j].offset, n);
+				break;
+			}
+		}
+		memset(base + c.offset + n, 0, c.size - n);
+	}
+}
+
+static void stateDeltaMake(const uint8 *base, const uint8 *cur, size_t len, std::vector<uint8> &out)
+{
+	size_t runEnd = 0;
+	size_t i = 0;
+
+	out.clear();
+
+	while (i < len)
+	{
+		if (cur[i] == base[i])
+		{
+			i++;
+			continue;
+		}
+		size_t start = i;
+		size_t gap = 0;
+
+		for (i++; i < len && gap < stateDeltaMinGap; i++)
+		{
+			if (cur[i] == base[i])
+			{
+				gap++;
+			}
+			else
+			{
+				gap = 0;
+			}
+		}
+		size_t end = i - gap;
+
+		stateDeltaPut32(out, static_cast<uint32>(start - runEnd));
+		stateDeltaPut32(out, static_cast<uint32>(end - start));
+		out.insert(out.end(), cur + start, cur + end);
+
+		runEnd = end;
+	}
+}
+
+static void stateDeltaApply(const uint8 *delta, size_t deltaLen, uint8 *state)
+{
+	const uint8 *p = delta;
+	const uint8 *end = delta + deltaLen;
+
+	while (p + 8 <= end)
+	{
+		uint32 skip = stateDeltaGet32(p);
+		uint32 run  = stateDeltaGet32(p + 4);
+
+		p += 8;
+		state += skip;
+		memcpy(state, p, run);
+		state += run;
+		p += run;
+	}
+}
+
 class StateRecorder
 {
 	public:
@@ -1218,12 +1392,9 @@ class StateRecorder
 		{
 			loadConfig( stateRecorderConfig );
 
-			for (int i=0; i<ringBufSize; i++)
-			{
-				EMUFILE_MEMORY *em = new EMUFILE_MEMORY( 0x1000 );
+			ringBuf.resize(ringBufSize);
 
-				ringBuf.push_back(em);
-			}
+			snapsSinceKeyFrame = 0;
 			ringStart = ringHead = ringTail = 0;
 			frameCounter = 0;
 			lastState = ringHead;
@@ -1233,10 +1404,6 @@ class StateRecorder
 
 		~StateRecorder(void)
 		{
-			for (size_t i=0; i<ringBuf.size(); i++)
-			{
-				delete ringBuf[i];
-			}
 			ringBuf.clear();
 		}
 
@@ -1297,6 +1464,8 @@ class StateRecorder
 
 			unsigned int curFrame = static_cast<unsigned int>(currFrameCounter);
 
+			collectPendingSnaps();
+
 			if (!isPaused && loadIndexReset)
 			{
 				ringHead = (lastState + 1) % ringBufSize;
@@ -1312,13 +1481,9 @@ class StateRecorder
 
 				if ( (frameCounter % framesPerSnap) == 0 )
 				{
-					EMUFILE_MEMORY *em = ringBuf[ ringHead ];
+					doSnap( ringHead );
 
-					em->set_len(0);
-
-					FCEUSS_SaveMS( em, compressionLevel );
-
-					//printf("Frame:%u  Save:%i  Size:%zu  Total:%zukB \n", frameCounter, ringHead, em->size(), dataSize() / 1024 );
+					//printf("Frame:%u  Save:%i  Size:%zu  Total:%zukB \n", frameCounter, ringHead, ringBuf[ringHead].delta.size(), dataSize() / 1024 );
 
 					lastState = ringHead;
 
@@ -1355,11 +1520,13 @@ class StateRecorder
 			}
 			snapIdx = snapIdx % ringBufSize;
 
-			EMUFILE_MEMORY *em = ringBuf[ snapIdx ];
-
-			em->fseek(SEEK_SET, 0);
+			if ( !restoreSnap( ringBuf[ snapIdx ] ) )
+			{
+				return -1;
+			}
+			stateBuf.fseek(0, SEEK_SET);
 
-			FCEUSS_LoadFP( em, SSLOADPARAM_NOBACKUP );
+			FCEUSS_LoadFP( &stateBuf, SSLOADPARAM_NOBACKUP );
 
 			frameCounter = lastLoadFrame = static_cast<unsigned int>(currFrameCounter);
 
@@ -1438,7 +1605,19 @@ class StateRecorder
 
 		size_t  dataSize(void)
 		{
-			return ringBuf.size() * ringBuf[0]->size();
+			size_t size = 0;
+
+			for (size_t i=0; i<ringBuf.size(); i++)
+			{
+				size += ringBuf[i].delta.size();
+
+				// Snapshots sharing a key frame sit next to each other
+				if (ringBuf[i].keyFrame && ((i == 0) || (ringBuf[i].keyFrame != ringBuf[i-1].keyFrame)) )
+				{
+					size += ringBuf[i].keyFrame->data.size();
+				}
+			}
+			return size;
 		}
 
 		size_t  ringBufferSize(void)
@@ -1449,12 +1628,270 @@ class StateRecorder
 		static int  lastState;
 	private:
 
-		void doSnap(void)
+		struct KeyFrame
+		{
+			std::vector<uint8> data;  // zlib compressed if compressed is set
+			uint32 size;              // uncompressed size of data
+			bool   compressed;
+			std::vector<stateChunk_t> chunks;
+			std::shared_ptr<FCEU::compressJob> pending; // data being compressed, data is empty until collected
+
+			KeyFrame(void)
+				: size(0), compressed(false)
+			{
+			}
+		};
+
+		struct Snap
+		{
+			std::shared_ptr<KeyFrame> keyFrame; // full state the delta is against, shared with the other snaps using it
+			std::vector<stateChunk_t> chunks;   // of the state, the key frame is laid out like this before the delta
+			std::vector<uint8> delta;  // zlib compressed if compressed is set
+			uint32 deltaSize;          // uncompressed size of delta
+			uint32 stateSize;
+			bool   compressed;
+			std::shared_ptr<FCEU::compressJob> pending; // delta being compressed, delta is empty until collectSnap
+
+			Snap(void)
+				: deltaSize(0), stateSize(0), compressed(false)
+			{
+			}
+		};
+
+		// Snapshots per key frame, a lower limit on the deltas kept around as the state
+		// drifts from its key frame
+		static const int keyFrameInterval = 30;
+
+		void doSnap( int snapIdx )
+		{
+			Snap &snap = ringBuf[ snapIdx ];
+
+			stateBuf.set_len(0);
+
+			// Uncompressed, so that consecutive states can be compared byte for byte
+			FCEUSS_SaveMS( &stateBuf, Z_NO_COMPRESSION );
+
+			const uint8 *state = stateBuf.buf();
+			size_t stateSize = stateBuf.size();
+
+			snap.stateSize  = static_cast<uint32>(stateSize);
+			snap.compressed = false;
+			snap.delta.clear();
+			snap.pending.reset();
+
+			stateChunkScan( state, stateSize, snap.chunks );
+
+			if (keyFrame && (snapsSinceKeyFrame < keyFrameInterval) )
+			{
+				baseBuf.resize( stateSize );
+				stateBaseBuild( &keyRaw[0], keyFrame->chunks, snap.chunks, &baseBuf[0] );
+				stateDeltaMake( &baseBuf[0], state, stateSize, deltaBuf );
+
+				// Loading some other state leaves little in common with the key frame
+				if (deltaBuf.size() > stateSize / 2)
+				{
+					keyFrame.reset();
+				}
+			}
+
+			if (!keyFrame || (snapsSinceKeyFrame >= keyFrameInterval) )
+			{
+				newKeyFrame( state, stateSize, snap.chunks );
+				snapsSinceKeyFrame = 1;
+				snap.keyFrame  = keyFrame;
+				snap.deltaSize = 0;
+				return;
+			}
+			snap.keyFrame  = keyFrame;
+			snap.deltaSize = static_cast<uint32>(deltaBuf.size());
+			snapsSinceKeyFrame++;
+
+			if ( compressing() && (deltaBuf.size() > 0) )
+			{	// Compressed on a worker thread, the emulation thread only hands the delta over
+				FCEU::compressPool &pool = FCEU::compressPool::get();
+				std::vector<uint8> buf = pool.getBuffer();
+
+				buf.swap( deltaBuf );
+
+				snap.pending = pool.submit( buf, compressionLevel );
+
+				pendingSnaps.push_back( snapIdx );
+				return;
+			}
+			snap.delta = deltaBuf;
+		}
+
+		// Same rule as FCEUSS_SaveMS, which saved the whole snapshots compressed before
+		bool compressing(void)
+		{
+			return (compressionLevel != Z_NO_COMPRESSION) && (compressSavestates || FCEUMOV_Mode(MOVIEMODE_TASEDITOR));
+		}
+
+		// The current key frame stays uncompressed in keyRaw for the next deltas
+		void newKeyFrame( const uint8 *state, size_t stateSize, const std::vector<stateChunk_t> &chunks )
+		{
+			keyFrame = std::make_shared<KeyFrame>();
+			keyFrame->size   = static_cast<uint32>(stateSize);
+			keyFrame->chunks = chunks;
+			keyRaw.assign( state, state + stateSize );
+
+			if (compressing())
+			{
+				FCEU::compressPool &pool = FCEU::compressPool::get();
+				std::vector<uint8> buf = pool.getBuffer();
+
+				buf.assign( state, state + stateSize );
+
+				keyFrame->pending = pool.submit( buf, compressionLevel );
+
+				pendingKeyFrames.push_back( keyFrame );
+				return;
+			}
+			keyFrame->data = keyRaw;
+		}
+
+		// Swaps in the compressed data of a job once it is done, the uncompressed data if it failed.
+		// Returns false if it is still running and wait isn't set.
+		static bool collectJob( std::shared_ptr<FCEU::compressJob> &pending, std::vector<uint8> &data, bool &compressed, bool wait )
+		{
+			if (!pending)
+			{
+				return true;
+			}
+			FCEU::compressPool &pool = FCEU::compressPool::get();
+
+			if (wait)
+			{
+				pool.wait( pending );
+			}
+			else if (!pool.isDone( pending ))
+			{
+				return false;
+			}
+			FCEU::compressJob &job = *pending;
+
+			if (job.ok)
+			{
+				data.swap( job.out );
+				compressed = true;
+				pool.recycle( job );
+			}
+			else
+			{
+				data.swap( job.in );
+			}
+			pending.reset();
+
+			return true;
+		}
+
+		bool collectSnap( Snap &snap, bool wait )
 		{
+			return collectJob( snap.pending, snap.delta, snap.compressed, wait );
+		}
 
+		bool collectKeyFrame( KeyFrame &key, bool wait )
+		{
+			return collectJob( key.pending, key.data, key.compressed, wait );
+		}
+
+		// Jobs finish about in the order they were submitted
+		void collectPendingSnaps(void)
+		{
+			while ( (pendingSnaps.size() > 0) && collectSnap( ringBuf[ pendingSnaps.front() ], false ) )
+			{
+				pendingSnaps.pop_front();
+			}
+			while ( (pendingKeyFrames.size() > 0) && collectKeyFrame( *pendingKeyFrames.front(), false ) )
+			{
+				pendingKeyFrames.pop_front();
+			}
+		}
+
+		// The uncompressed state of a key frame, NULL if it can't be decompressed.
+		// The last one decompressed is kept, loads mostly step through the same one.
+		const uint8 *keyFrameState( const std::shared_ptr<KeyFrame> &key )
+		{
+			if (key == keyFrame)
+			{
+				return &keyRaw[0];
+			}
+			if (key == restoredKeyFrame)
+			{
+				return &restoredKeyRaw[0];
+			}
+			collectKeyFrame( *key, true );
+
+			if (!key->compressed)
+			{
+				return &key->data[0];
+			}
+			uLongf len = key->size;
+
+			restoredKeyFrame.reset();
+			restoredKeyRaw.resize(len);
+
+			if ( (uncompress( &restoredKeyRaw[0], &len, &key->data[0], key->data.size() ) != Z_OK) || (len != key->size) )
+			{
+				return NULL;
+			}
+			restoredKeyFrame = key;
+
+			return &restoredKeyRaw[0];
+		}
+
+		// Rebuilds the state of a snapshot in stateBuf
+		bool restoreSnap( Snap &snap )
+		{
+			if (!snap.keyFrame)
+			{	// Nothing saved here yet
+				return false;
+			}
+			// Only a load of the snapshot being compressed waits for it
+			collectSnap( snap, true );
+
+			const uint8 *key = keyFrameState( snap.keyFrame );
+
+			if (key == NULL)
+			{
+				return false;
+			}
+			stateBuf.truncate(snap.stateSize);
+
+			uint8 *state = stateBuf.buf();
+
+			stateBaseBuild( key, snap.keyFrame->chunks, snap.chunks, state );
+
+			if (snap.compressed)
+			{
+				uLongf len = snap.deltaSize;
+
+				deltaBuf.resize(len);
+
+				if (uncompress( &deltaBuf[0], &len, &snap.delta[0], snap.delta.size() ) != Z_OK)
+				{
+					return false;
+				}
+				stateDeltaApply( &deltaBuf[0], len, state );
+			}
+			else if (snap.delta.size() > 0)
+			{
+				stateDeltaApply( &snap.delta[0], snap.delta.size(), state );
+			}
+			return true;
 		}
 
-		std::vector <EMUFILE_MEMORY*> ringBuf;
+		std::vector <Snap> ringBuf;
+		std::deque <int> pendingSnaps; // ring indices of snapshots with a compression job, oldest first
+		std::deque < std::shared_ptr<KeyFrame> > pendingKeyFrames; // same for key frames
+		std::shared_ptr<KeyFrame> keyFrame; // key frame new snapshots are compared against
+		std::vector<uint8> keyRaw;          // its uncompressed state
+		std::shared_ptr<KeyFrame> restoredKeyFrame; // last key frame decompressed to load a snapshot
+		std::vector<uint8> restoredKeyRaw;
+		int  snapsSinceKeyFrame;
+		EMUFILE_MEMORY stateBuf;
+		std::vector<uint8> deltaBuf;
+		std::vector<uint8> baseBuf; // key frame laid out like the state being saved
 		int  ringHead;
 		int  ringTail;
 		int  ringStart;
@@ -19,6 +19,7 @@
  */
 #pragma once
 #include <string>
+#include <vector>
 
 enum ENUM_SSLOADPARAMS
 {
@@ -32,6 +33,7 @@ void FCEUSS_SetLoadCallback( void (*cb)(bool) );
 
  //zlib values: 0 (none) through 9 (max) or -1 (default)
 bool FCEUSS_SaveMS(EMUFILE* outstream, int compressionLevel);
+bool FCEUSS_CompressMS(const std::vector<uint8> &in, std::vector<uint8> &out, int compressionLevel);
 
 bool FCEUSS_LoadFP(EMUFILE* is, ENUM_SSLOADPARAMS params);
 
@@ -0,0 +1,208 @@
+// compressPool.h
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <zlib.h>
+
+namespace FCEU
+{
+	// One buffer to compress, owned by the caller between submit and collecting the result
+	struct compressJob
+	{
+		typedef bool (*compressFunc)(const std::vector<uint8_t> &in, std::vector<uint8_t> &out, int level);
+
+		std::vector<uint8_t> in;
+		std::vector<uint8_t> out;
+		int  level;
+		compressFunc func;
+		bool ok;   // valid once done
+		bool done; // guarded by the pool mutex, use compressPool::isDone
+
+		compressJob(void)
+			: level(Z_DEFAULT_COMPRESSION), func(nullptr), ok(false), done(false)
+		{
+		}
+	};
+
+	// Worker threads compressing savestate data off the emulation thread. The emulation thread
+	// fills a buffer from getBuffer, submits it, and swaps the result in once isDone says so.
+	class compressPool
+	{
+		public:
+			// Jobs waiting for a worker before submit blocks, bounds the memory held by raw buffers
+			static const size_t maxQueued = 64;
+
+			static compressPool &get(void)
+			{
+				static compressPool pool;
+
+				return pool;
+			}
+
+			~compressPool(void)
+			{
+				{
+					std::lock_guard<std::mutex> lock(mtx);
+					quit = true;
+				}
+				jobCond.notify_all();
+
+				for (size_t i=0; i<workers.size(); i++)
+				{
+					workers[i].join();
+				}
+			}
+
+			// An empty buffer, with the capacity of a recycled one if there is any
+			std::vector<uint8_t> getBuffer(void)
+			{
+				std::vector<uint8_t> buf;
+				std::lock_guard<std::mutex> lock(mtx);
+
+				if (freeBuffers.size() > 0)
+				{
+					buf.swap( freeBuffers.back() );
+					freeBuffers.pop_back();
+				}
+				buf.clear();
+				return buf;
+			}
+
+			// Returns the job's input buffer to the pool, once the caller is done with it
+			void recycle( compressJob &job )
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+
+				if (freeBuffers.size() < maxFreeBuffers)
+				{
+					freeBuffers.push_back( std::vector<uint8_t>() );
+					freeBuffers.back().swap( job.in );
+				}
+				else
+				{
+					std::vector<uint8_t>().swap( job.in );
+				}
+			}
+
+			// Takes the contents of in, which is left empty
+			std::shared_ptr<compressJob> submit( std::vector<uint8_t> &in, int level, compressJob::compressFunc func = zlibCompress )
+			{
+				std::shared_ptr<compressJob> job = std::make_shared<compressJob>();
+
+				job->in.swap(in);
+				job->level = level;
+				job->func  = func;
+
+				std::unique_lock<std::mutex> lock(mtx);
+
+				if (workers.size() == 0)
+				{
+					startWorkers();
+				}
+				doneCond.wait( lock, [this]{ return queue.size() < maxQueued; } );
+
+				queue.push_back(job);
+				lock.unlock();
+
+				jobCond.notify_one();
+
+				return job;
+			}
+
+			bool isDone( const std::shared_ptr<compressJob> &job )
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+
+				return job->done;
+			}
+
+			void wait( const std::shared_ptr<compressJob> &job )
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+
+				doneCond.wait( lock, [&job]{ return job->done; } );
+			}
+
+			// Plain zlib stream, what uncompress expects
+			static bool zlibCompress( const std::vector<uint8_t> &in, std::vector<uint8_t> &out, int level )
+			{
+				uLongf len = compressBound( static_cast<uLong>(in.size()) );
+
+				out.resize(len);
+
+				if (compress2( out.data(), &len, in.data(), static_cast<uLong>(in.size()), level ) != Z_OK)
+				{
+					out.clear();
+					return false;
+				}
+				out.resize(len);
+				return true;
+			}
+
+		private:
+			static const size_t maxFreeBuffers = 16;
+
+			compressPool(void)
+				: quit(false)
+			{
+			}
+
+			// Under the lock
+			void startWorkers(void)
+			{
+				unsigned int n = std::thread::hardware_concurrency();
+
+				// Leave a core to the emulation thread
+				n = (n > 1) ? n - 1 : 1;
+
+				if (n > 4)
+				{
+					n = 4;
+				}
+				for (unsigned int i=0; i<n; i++)
+				{
+					workers.push_back( std::thread( &compressPool::workerProc, this ) );
+				}
+			}
+
+			void workerProc(void)
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+
+				while (1)
+				{
+					jobCond.wait( lock, [this]{ return quit || (queue.size() > 0); } );
+
+					if (quit)
+					{
+						break;
+					}
+					std::shared_ptr<compressJob> job = queue.front();
+
+					queue.pop_front();
+					lock.unlock();
+
+					bool ok = job->func( job->in, job->out, job->level );
+
+					lock.lock();
+					job->ok   = ok;
+					job->done = true;
+					doneCond.notify_all();
+				}
+			}
+
+			std::mutex mtx;
+			std::condition_variable jobCond;  // a job was queued or quitting
+			std::condition_variable doneCond; // a job finished, which also made room in the queue
+			std::deque< std::shared_ptr<compressJob> > queue;
+			std::vector< std::vector<uint8_t> > freeBuffers;
+			std::vector<std::thread> workers;
+			bool quit;
+	};
+};
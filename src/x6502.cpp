@@ -48,6 +48,39 @@ static X6502_MemHook* readMemHook = nullptr;
 static X6502_MemHook* writeMemHook = nullptr;
 static X6502_MemHook* execMemHook = nullptr;
 
+uint8 X6502_IntDepth = 0;
+uint32 X6502_IntKinds = 0;
+uint8 X6502_NmiEntered = 0;
+static uint8 IntEntryS[X6502_INT_MAX_DEPTH]; //S after each entry pushed PC and P, innermost last
+
+//leaves the handlers whose stack frame is gone once S is s: returned with RTI, or reset the
+//stack and jumped away without one
+static INLINE void IntPop(int s)
+{
+	while (X6502_IntDepth && (s > IntEntryS[X6502_IntDepth - 1]))
+	{
+		X6502_IntDepth--;
+		X6502_IntKinds >>= 1;
+	}
+}
+
+//after the pushes, interrupts nested deeper than X6502_INT_MAX_DEPTH are not counted
+static INLINE void IntEnter(uint32 isNmi)
+{
+	IntPop(_S + 3);
+
+	if (X6502_IntDepth < X6502_INT_MAX_DEPTH)
+	{
+		IntEntryS[X6502_IntDepth++] = _S;
+		X6502_IntKinds = (X6502_IntKinds << 1) | isNmi;
+	}
+}
+
+static INLINE void IntLeave(void)
+{
+	IntPop(_S);
+}
+
 void X6502_MemHook::Add(enum X6502_MemHook::Type type, void (*func)(unsigned int address, unsigned int value, void *userData), void *userData )
 {
 	X6502_MemHook** hookStart = nullptr;
@@ -156,11 +189,16 @@ void X6502_MemHook::Remove(enum X6502_MemHook::Type type, void (*func)(unsigned
 	}
 }
 
-//normal memory read
-static INLINE uint8 RdMem(unsigned int A)
+//The CPU loop is instantiated twice, see X6502_Run. With Debug false, the memory hook
+//checks below and the debugger calls in the loop compile away.
+
+//normal memory read, plain RAM and PRG pages straight from AReadDirect
+template<bool Debug>
+static INLINE uint8 RdMemT(unsigned int A)
 {
- _DB=ARead[A](A);
- if (readMemHook)
+ uint8 *direct=AReadDirect[A>>11];
+ _DB=direct ? direct[A] : ARead[A](A);
+ if (Debug && readMemHook)
  {
 	 readMemHook->call(A, _DB);
  }
@@ -168,20 +206,23 @@ static INLINE uint8 RdMem(unsigned int A)
 }
 
 //normal memory write
-static INLINE void WrMem(unsigned int A, uint8 V)
+template<bool Debug>
+static INLINE void WrMemT(unsigned int A, uint8 V)
 {
 	BWrite[A](A,V);
- 	if (writeMemHook)
+ 	if (Debug && writeMemHook)
  	{
  	        writeMemHook->call(A, V);
  	}
 	_DB = V;
 }
 
-static INLINE uint8 RdRAM(unsigned int A)
+template<bool Debug>
+static INLINE uint8 RdRAMT(unsigned int A)
 {
-  _DB=ARead[A](A);
-  if (readMemHook)
+  uint8 *direct=AReadDirect[A>>11];
+  _DB=direct ? direct[A] : ARead[A](A);
+  if (Debug && readMemHook)
   {
           readMemHook->call(A, _DB);
   }
@@ -190,10 +231,11 @@ static INLINE uint8 RdRAM(unsigned int A)
   return(_DB);
 }
 
-static INLINE void WrRAM(unsigned int A, uint8 V)
+template<bool Debug>
+static INLINE void WrRAMT(unsigned int A, uint8 V)
 {
 	RAM[A]=V;
- 	if (writeMemHook)
+ 	if (Debug && writeMemHook)
  	{
  	        writeMemHook->call(A, V);
  	}
@@ -202,8 +244,10 @@ static INLINE void WrRAM(unsigned int A, uint8 V)
 
 uint8 X6502_DMR(uint32 A)
 {
+ uint8 *direct;
  ADDCYC(1);
- _DB=ARead[A](A);
+ direct=AReadDirect[A>>11];
+ _DB=direct ? direct[A] : ARead[A](A);
   if (readMemHook)
   {
           readMemHook->call(A, _DB);
@@ -222,6 +266,12 @@ void X6502_DMW(uint32 A, uint8 V)
  _DB = V;
 }
 
+//the macros below and ops.inc are only expanded in X6502_RunLoop, where Debug is its template parameter
+#define RdMem(A) RdMemT<Debug>(A)
+#define WrMem(A,V) WrMemT<Debug>(A,V)
+#define RdRAM(A) RdRAMT<Debug>(A)
+#define WrRAM(A,V) WrRAMT<Debug>(A,V)
+
 #define PUSH(V) \
 {       \
  uint8 VTMP=V;  \
@@ -552,9 +602,13 @@ void X6502_Power(void)
  timestamp=soundtimestamp=0;
  X6502_Reset();
  StackAddrBackup = -1;
+ X6502_IntDepth = 0;
+ X6502_IntKinds = 0;
+ X6502_NmiEntered = 0;
 }
 
-void X6502_Run(int32 cycles)
+template<bool Debug>
+static void X6502_RunLoop(int32 cycles)
 {
   if(PAL)
    cycles*=15;    // 15*4=60
@@ -572,12 +626,13 @@ extern int test; test++;
    {
     if(_IRQlow&FCEU_IQRESET)
     {
-	 DEBUG( if(debug_loggingCD) LogCDVectors(0xFFFC); )
+	 DEBUG( if(Debug && debug_loggingCD) LogCDVectors(0xFFFC); )
      _PC=RdMem(0xFFFC);
      _PC|=RdMem(0xFFFD)<<8;
      _jammed=0;
      _PI=_P=I_FLAG;
      _IRQlow&=~FCEU_IQRESET;
+     DEBUG( X6502_IntDepth=0; X6502_IntKinds=0; X6502_NmiEntered=0 )
     }
     else if(_IRQlow&FCEU_IQNMI2)
      {
@@ -593,10 +648,11 @@ extern int test; test++;
       PUSH(_PC);
       PUSH((_P&~B_FLAG)|(U_FLAG));
       _P|=I_FLAG;
-	  DEBUG( if(debug_loggingCD) LogCDVectors(0xFFFA) );
+	  DEBUG( if(Debug && debug_loggingCD) LogCDVectors(0xFFFA) );
       _PC=RdMem(0xFFFA);
       _PC|=RdMem(0xFFFB)<<8;
       _IRQlow&=~FCEU_IQNMI;
+      DEBUG( IntEnter(1); X6502_NmiEntered=1 );
      }
     }
     else
@@ -608,9 +664,10 @@ extern int test; test++;
       PUSH(_PC);
       PUSH((_P&~B_FLAG)|(U_FLAG));
       _P|=I_FLAG;
-	  DEBUG( if(debug_loggingCD) LogCDVectors(0xFFFE) );
+	  DEBUG( if(Debug && debug_loggingCD) LogCDVectors(0xFFFE) );
       _PC=RdMem(0xFFFE);
       _PC|=RdMem(0xFFFF)<<8;
+      DEBUG( IntEnter(0) );
      }
     }
     _IRQlow&=~(FCEU_IQTEMP);
@@ -623,7 +680,9 @@ extern int test; test++;
    }
 
 	//will probably cause a major speed decrease on low-end systems
-   DEBUG( DebugCycle() );
+   DEBUG( if(Debug && X6502_IntDepth) IntPop(_S) );
+   DEBUG( if(Debug) DebugCycle() );
+   DEBUG( X6502_NmiEntered=0 );
 
    IncrementInstructionsCounters();
 
@@ -638,7 +697,7 @@ extern int test; test++;
    
    if (!overclocking)
     FCEU_SoundCPUHook(temp);
-   if (execMemHook)
+   if (Debug && execMemHook)
    {
            execMemHook->call(_PC, 0);
    }
@@ -650,6 +709,26 @@ extern int test; test++;
   }
 }
 
+#undef RdMem
+#undef WrMem
+#undef RdRAM
+#undef WrRAM
+
+//Runs the loop without the memory hook checks and the debugger when nothing needs them.
+//That is decided once per call, something set up while the CPU runs (from a breakpoint
+//or a hook) applies from the next call, at most a scanline later.
+void X6502_Run(int32 cycles)
+{
+ bool debug = readMemHook || writeMemHook || execMemHook;
+#ifdef FCEUDEF_DEBUGGER
+ debug = debug || DebugCycleActive();
+#endif
+ if (debug)
+  X6502_RunLoop<true>(cycles);
+ else
+  X6502_RunLoop<false>(cycles);
+}
+
 //--------------------------
 //---Called from debuggers
 void FCEUI_NMI(void)
@@ -666,12 +745,12 @@ void FCEUI_GetIVectors(uint16 *reset, uint16 *irq, uint16 *nmi)
 {
  fceuindbg=1;
 
- *reset=RdMem(0xFFFC);
- *reset|=RdMem(0xFFFD)<<8;
- *nmi=RdMem(0xFFFA);
- *nmi|=RdMem(0xFFFB)<<8;
- *irq=RdMem(0xFFFE);
- *irq|=RdMem(0xFFFF)<<8;
+ *reset=RdMemT<true>(0xFFFC);
+ *reset|=RdMemT<true>(0xFFFD)<<8;
+ *nmi=RdMemT<true>(0xFFFA);
+ *nmi|=RdMemT<true>(0xFFFB)<<8;
+ *irq=RdMemT<true>(0xFFFE);
+ *irq|=RdMemT<true>(0xFFFF)<<8;
  fceuindbg=0;
 }
 
@@ -732,6 +811,34 @@ const uint8 optype[256] = {
 /*0xF0*/	0,4,0,3,5,5,5,5,0,6,0,6,7,7,7,7,
 };
 
+//the opflow table tells the debugger which opcodes change the program flow, and which are undocumented
+//
+//  0x01 = Branch (relative)
+//  0x02 = Jump (JMP absolute/indirect, JSR)
+//  0x04 = RTS
+//  0x08 = RTI
+//  0x10 = Subroutine call (JSR)
+//  0x80 = Undocumented opcode
+//
+const uint8 opflow[256] = {
+/*0x00*/	0,0,0x80,0x80,0x80,0,0,0x80,0,0,0,0x80,0x80,0,0,0x80,
+/*0x10*/	0x01,0,0x80,0x80,0x80,0,0,0x80,0,0,0x80,0x80,0x80,0,0,0x80,
+/*0x20*/	0x12,0,0x80,0x80,0,0,0,0x80,0,0,0,0x80,0,0,0,0x80,
+/*0x30*/	0x01,0,0x80,0x80,0x80,0,0,0x80,0,0,0x80,0x80,0x80,0,0,0x80,
+/*0x40*/	0x08,0,0x80,0x80,0x80,0,0,0x80,0,0,0,0x80,0x02,0,0,0x80,
+/*0x50*/	0x01,0,0x80,0x80,0x80,0,0,0x80,0,0,0x80,0x80,0x80,0,0,0x80,
+/*0x60*/	0x04,0,0x80,0x80,0x80,0,0,0x80,0,0,0,0x80,0x02,0,0,0x80,
+/*0x70*/	0x01,0,0x80,0x80,0x80,0,0,0x80,0,0,0x80,0x80,0x80,0,0,0x80,
+/*0x80*/	0x80,0,0x80,0x80,0,0,0,0x80,0,0x80,0,0x80,0,0,0,0x80,
+/*0x90*/	0x01,0,0x80,0x80,0,0,0,0x80,0,0,0,0x80,0x80,0,0x80,0x80,
+/*0xA0*/	0,0,0,0x80,0,0,0,0x80,0,0,0,0x80,0,0,0,0x80,
+/*0xB0*/	0x01,0,0x80,0x80,0,0,0,0x80,0,0,0,0x80,0,0,0,0x80,
+/*0xC0*/	0,0,0x80,0x80,0,0,0,0x80,0,0,0,0x80,0,0,0,0x80,
+/*0xD0*/	0x01,0,0x80,0x80,0x80,0,0,0x80,0,0,0x80,0x80,0x80,0,0,0x80,
+/*0xE0*/	0,0,0x80,0x80,0,0,0,0x80,0,0,0,0x80,0,0,0,0x80,
+/*0xF0*/	0x01,0,0x80,0x80,0x80,0,0,0x80,0,0,0x80,0x80,0x80,0,0,0x80
+};
+
 // the opwrite table aids in predicting the value written for any 6502 opcode
 //
 //  0 = No value written
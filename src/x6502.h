@@ -34,6 +34,15 @@ extern const uint8 optype[256];
 // the opwrite table aids in predicting the value written for any 6502 opcode
 extern const uint8 opwrite[256];
 
+//the opflow table marks branches, jumps, returns and undocumented opcodes
+#define OPFLOW_BRANCH   0x01
+#define OPFLOW_JUMP     0x02
+#define OPFLOW_RTS      0x04
+#define OPFLOW_RTI      0x08
+#define OPFLOW_JSR      0x10
+#define OPFLOW_ILLEGAL  0x80
+extern const uint8 opflow[256];
+
 //-----------
 //mbg 6/30/06 - some of this was removed to mimic XD
 //#ifdef FCEUDEF_DEBUGGER
@@ -53,6 +62,17 @@ extern uint32 timestamp;
 extern uint32 soundtimestamp;
 extern int scanline;
 
+//interrupt handlers the CPU is in, for the trace loggers' capture filter. A handler counts from
+//the NMI/IRQ/BRK entry until S rises above where the entry left it, by RTI or by a handler that
+//resets the stack and never returns. Bit 0 of X6502_IntKinds is set while the innermost one is
+//an NMI handler. Debugger builds only, reset at power and reset, not kept in savestates.
+#define X6502_INT_MAX_DEPTH 32
+extern uint8 X6502_IntDepth;
+extern uint32 X6502_IntKinds;
+//set by the NMI dispatch until the first instruction of the handler has been through DebugCycle,
+//where the BZK trace index marks the handler start. Debugger builds only.
+extern uint8 X6502_NmiEntered;
+
 #define N_FLAG  0x80
 #define V_FLAG  0x40
 #define U_FLAG  0x20